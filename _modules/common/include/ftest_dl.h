@@ -1,7 +1,21 @@
 #pragma once
 
+/**
+ * Load a library. A library which is loaded already is loaded again from a
+ * copy, so every handle has globals of its own.
+ *
+ * @return The handle of the library, NULL on failure
+ */
 void *ftest_dl_open_lib(const char *lib_name);
 
 void *ftest_dl_get_sym(void *lib, const char *sym_name);
 
-void ftest_dl_close_lib(void *lib);
\ No newline at end of file
+void ftest_dl_close_lib(void *lib);
+
+/**
+ * Start reading the library file into the page cache in the background, so
+ * that a later ftest_dl_open_lib() on it does not wait for the disk.
+ *
+ * @return 0 on success, -1 with errno set if the prefetch could not start.
+ */
+int ftest_dl_prefetch_lib(const char *lib_name);
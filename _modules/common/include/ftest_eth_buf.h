@@ -1,7 +1,141 @@
+#pragma once
+#include "ftest_sched_entity.h"
 #include "ringbuffer.h"
+#include <stddef.h>
+#include <stdint.h>
 
-#define FTEST_ETH_INPROC_BUFFER_SIZE 65536 // 64KB
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
 
-extern ringbuffer_t ftest_eth_inproc_rb;
+#define FTEST_ETH_BUF_MAC_LEN 6
 
-extern uint8_t ftest_eth_inproc_rb_buffer[FTEST_ETH_INPROC_BUFFER_SIZE];
\ No newline at end of file
+/** Returned by ftest_eth_buf_route() for frames sent to every other port */
+#define FTEST_ETH_BUF_FLOOD (-1)
+
+/** Returned by ftest_eth_buf_route() for frames which go nowhere */
+#define FTEST_ETH_BUF_DROP (-2)
+
+/** Number of buckets of the ring occupancy histogram, of equal width */
+#define FTEST_ETH_BUF_OCCUPANCY_BUCKETS 8
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+/**
+ * Header of every frame on the in-process network, followed by the Ethernet
+ * frame itself.
+ */
+struct ftest_eth_hdr {
+  size_t len;
+  uint64_t sent_time;
+  uint64_t deliver_time;
+  int32_t src_port;
+  uint8_t payload[];
+} __attribute__((packed));
+
+/**
+ * Counters an interface keeps for its port. The runner reads them on exit.
+ */
+struct ftest_eth_port_stats {
+  uint64_t tx_frames;
+  uint64_t tx_bytes;
+  uint64_t rx_frames;
+  uint64_t rx_bytes;
+  /* Frames which could not be sent, mostly for lack of room in a ring */
+  uint64_t tx_dropped;
+  /* Frames lost on the emulated link */
+  uint64_t link_lost;
+  /* Frames overwritten in the ring before they were received */
+  uint64_t rx_overruns;
+  /* Frames dropped for lack of a net_pkt, or of net_bufs for their data */
+  uint64_t rx_no_pkt;
+  uint64_t rx_no_buf;
+  /* Frames the network stack refused */
+  uint64_t rx_errors;
+  /* How full the ring was each time the receiver drained it */
+  uint64_t occupancy[FTEST_ETH_BUF_OCCUPANCY_BUCKETS];
+};
+
+/******************************************************************************
+ API
+
+ The in-process network is a virtual L2 switch. Every interface is attached
+ to its own port, with a ring the interface receives from, on a named
+ segment. Segments are isolated from each other, as if each had a switch of
+ its own. Unicast frames to a known MAC address are only written to the ring
+ of the port it was learned on, while broadcast, multicast and unknown
+ unicast frames are flooded to the rings of all other ports of the segment.
+ ******************************************************************************/
+
+/**
+ * Attach an interface to a network segment, and learn its MAC address on the
+ * new port.
+ *
+ * @param segment Name of the segment, which is created by the first interface
+ * attached to it
+ * @param mac MAC address of the interface
+ * @param ring_size Size of the port's ring in bytes, 0 for the runner's
+ * default
+ * @param slot_size Size of fixed slots in bytes, 0 for the runner's default.
+ * Without slots, frames take only their actual length in the ring.
+ * @param entity The entity which owns the interface, woken up through its
+ * doorbell when a frame is written to the port's ring
+ * @return The port number, -1 with errno set on failure
+ */
+int ftest_eth_buf_attach(const char *segment, const uint8_t *mac,
+                         uint32_t ring_size, uint32_t slot_size,
+                         struct ftest_shed_entity_entry *entity);
+
+/**
+ * Register the counters the interface attached to a port keeps. They must stay
+ * valid until the runner exits.
+ *
+ * @return 0 on success, -1 with errno set on failure
+ */
+int ftest_eth_buf_set_stats(int port, const struct ftest_eth_port_stats *stats);
+
+/**
+ * Get the ring a port receives from, or NULL if there is no such port.
+ */
+ringbuffer_t *ftest_eth_buf_get_ring(int port);
+
+/**
+ * Find where a frame goes, and learn its source MAC address on the port it
+ * was sent from.
+ *
+ * @return The destination port, FTEST_ETH_BUF_FLOOD or FTEST_ETH_BUF_DROP
+ */
+int ftest_eth_buf_route(int src_port, const uint8_t *dst_mac,
+                        const uint8_t *src_mac);
+
+/**
+ * Wake up the owner of a port to take a frame sent at the given global
+ * virtual time from its ring. The frame reaches the port the lookahead after
+ * it was sent, rather than at its delivery time, as the receiver takes the
+ * frames in the order they were sent, and the ones due earlier may be
+ * queued behind it.
+ */
+int ftest_eth_buf_notify(int port, uint64_t sent_time);
+
+/**
+ * Stop waking up an entity removed from the schedule, as its entry may be
+ * reused by another one. Its ports stay on their segments, but frames written
+ * to their rings do not ring any doorbell anymore.
+ */
+void ftest_eth_buf_detach_entity(const struct ftest_shed_entity_entry *entity);
+
+/**
+ * Capture a frame, prefixed with its struct ftest_eth_hdr, as sent by the
+ * interface of its source port, if the runner captures the network. Frames
+ * passed to ftest_eth_buf_commit() are captured by it.
+ */
+void ftest_eth_buf_capture(const void *frame);
+
+/**
+ * Switch a frame, prefixed with its struct ftest_eth_hdr, to the rings of its
+ * destination ports. Meant to be passed to ftest_shed_defer(), so frames sent
+ * by concurrently running entities are switched in a deterministic order.
+ */
+int ftest_eth_buf_commit(const void *frame, uint32_t len);
@@ -0,0 +1,106 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+/** Opaque handle of an entity registered in the runner's scheduler */
+struct ftest_shed_entity_entry;
+
+typedef int (*ftest_shed_deferred_func_t)(const void *data, uint32_t len);
+
+/**
+ * Called by the scheduler to raise an event in the entity at the given local
+ * virtual time. Only called while the entity is not executing, or by the
+ * entity itself.
+ */
+typedef void (*ftest_shed_doorbell_func_t)(uint64_t time);
+
+/******************************************************************************
+ API
+
+ Scheduler services implemented by the runner, and available to the entities
+ loaded into it.
+ ******************************************************************************/
+
+/**
+ * Get the entity which is currently being initialized or dispatched by the
+ * scheduler. Entities shall call this during their initialization and keep
+ * the handle, as the current entity is not tracked while entities execute
+ * concurrently.
+ */
+struct ftest_shed_entity_entry *ftest_shed_get_current_entity(void);
+
+/**
+ * Get the index of the entity among the instances its loader loads from the
+ * same library, 0 if there is only one. Instances offset their addresses by
+ * it, so each of them gets addresses of its own.
+ */
+uint32_t ftest_shed_get_instance(const struct ftest_shed_entity_entry *entity);
+
+/**
+ * Get the global virtual time (in microseconds) of the event the entity is
+ * currently executing.
+ */
+uint64_t ftest_shed_get_time(const struct ftest_shed_entity_entry *entity);
+
+/**
+ * Declare the minimum virtual latency (in microseconds) of any interaction
+ * this entity has with other entities. The scheduler may execute entities
+ * concurrently within a window of the smallest declared latency.
+ */
+void ftest_shed_declare_lookahead(uint64_t lookahead);
+
+/**
+ * Get the smallest latency declared so far, UINT64_MAX if there is none. Data
+ * which another entity sent at time t shall only be acted upon from
+ * t + lookahead on, as it may only be published at the end of the parallel
+ * execution window it was sent in.
+ */
+uint64_t ftest_shed_get_lookahead(void);
+
+/**
+ * Check whether ftest_shed_defer() would currently defer the effects of the
+ * entity, instead of applying them immediately. While it does not, the entity
+ * may also publish its effects directly, without copying them.
+ */
+bool ftest_shed_is_deferring(const struct ftest_shed_entity_entry *entity);
+
+/**
+ * Run a function that has effects visible to other entities. When the entity
+ * executes concurrently with others, the data is copied and the function is
+ * called at the end of the execution window, in the same order in which the
+ * serial scheduler would have called it. The function shall not ring a
+ * doorbell earlier than the lookahead after the time it was deferred at.
+ *
+ * @return The result of the function if called immediately, 0 if deferred,
+ * a negative error code on failure.
+ */
+int ftest_shed_defer(struct ftest_shed_entity_entry *entity,
+                     ftest_shed_deferred_func_t func, const void *data,
+                     uint32_t len);
+
+/**
+ * Set the doorbell of the entity, which other entities ring to wake it up
+ * when they have something for it, so it does not have to poll for it.
+ *
+ * @return 0 on success, -EINVAL if the entity is NULL
+ */
+int ftest_shed_set_doorbell(struct ftest_shed_entity_entry *entity,
+                            ftest_shed_doorbell_func_t doorbell);
+
+/**
+ * Ring the doorbell of an entity, to wake it up at the given global virtual
+ * time. As this affects another entity, it shall only be called from a
+ * function passed to ftest_shed_defer(), or while ftest_shed_is_deferring()
+ * is false for the caller. The doorbell of a suspended entity is rung once it
+ * resumes. Ringing it from a deferred function for a time before the end of
+ * the parallel execution window, which the entity may already have run to,
+ * is a fatal error.
+ *
+ * @return 0 on success, -EINVAL if the entity is NULL
+ */
+int ftest_shed_ring_doorbell(struct ftest_shed_entity_entry *entity,
+                             uint64_t time);
@@ -0,0 +1,153 @@
+#pragma once
+#include "ftest_sched_entity.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+enum ftest_sock_chan_type {
+  FTEST_SOCK_CHAN_STREAM,
+  FTEST_SOCK_CHAN_DGRAM,
+};
+
+/**
+ * Results of the channel operations. The runner and the entities do not share
+ * errno values, so the entities map these to their own.
+ */
+typedef enum {
+  FTEST_SOCK_CHAN_OK = 0,
+  FTEST_SOCK_CHAN_AGAIN = -1,
+  FTEST_SOCK_CHAN_INVAL = -2,
+  FTEST_SOCK_CHAN_NOMEM = -3,
+  FTEST_SOCK_CHAN_ADDRINUSE = -4,
+  FTEST_SOCK_CHAN_CONNREFUSED = -5,
+  FTEST_SOCK_CHAN_NOTCONN = -6,
+  FTEST_SOCK_CHAN_ISCONN = -7,
+  FTEST_SOCK_CHAN_PIPE = -8,
+} ftest_sock_chan_result_t;
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+/** Opaque channel endpoint, owned by one socket of an entity */
+struct ftest_sock_chan;
+
+/** IPv4 address and port, both in host byte order */
+struct ftest_sock_chan_addr {
+  uint32_t ip;
+  uint16_t port;
+};
+
+/******************************************************************************
+ API
+
+ In-memory stream and datagram channels between the sockets of the entities,
+ a shortcut around their network stacks. Endpoints are addressed by the IPv4
+ addresses the entities declare, and every change visible to another entity
+ rings its doorbell. The channels are only used while the entities execute
+ one at a time, so these are never called concurrently.
+ ******************************************************************************/
+
+/**
+ * Open an endpoint.
+ *
+ * @param type Stream or datagram
+ * @param ip Address the endpoint is bound to unless bound explicitly
+ * @param entity The entity which owns the socket, and whose doorbell is rung
+ * when the endpoint becomes readable or writable
+ * @return The endpoint, or NULL if out of memory
+ */
+struct ftest_sock_chan *ftest_sock_chan_open(enum ftest_sock_chan_type type,
+                                             uint32_t ip,
+                                             struct ftest_shed_entity_entry
+                                                 *entity);
+
+/**
+ * Close an endpoint. The peer of a stream sees the end of the stream once it
+ * has received everything sent before, and connections not accepted yet are
+ * closed as well.
+ */
+void ftest_sock_chan_close(struct ftest_sock_chan *chan);
+
+/**
+ * Bind an endpoint to an address. Port 0 picks a free ephemeral port.
+ */
+ftest_sock_chan_result_t
+ftest_sock_chan_bind(struct ftest_sock_chan *chan,
+                     const struct ftest_sock_chan_addr *addr);
+
+ftest_sock_chan_result_t
+ftest_sock_chan_listen(struct ftest_sock_chan *chan, int backlog);
+
+/**
+ * Take a connection from the backlog of a listening stream endpoint.
+ *
+ * @return FTEST_SOCK_CHAN_AGAIN if there is none yet
+ */
+ftest_sock_chan_result_t
+ftest_sock_chan_accept(struct ftest_sock_chan *chan,
+                       struct ftest_sock_chan **conn,
+                       struct ftest_sock_chan_addr *peer);
+
+/**
+ * Connect a stream endpoint to a listening one, which completes right away,
+ * or set the default destination of a datagram endpoint.
+ */
+ftest_sock_chan_result_t
+ftest_sock_chan_connect(struct ftest_sock_chan *chan,
+                        const struct ftest_sock_chan_addr *peer);
+
+/**
+ * Send data. A stream takes as much as its peer has room for, and nothing of
+ * an empty send. A datagram is dropped if it does not fit, as it would be on
+ * a network.
+ *
+ * @param dest Destination of a datagram, NULL for the connected peer
+ * @return The number of bytes sent, or a negative result
+ */
+int32_t ftest_sock_chan_send(struct ftest_sock_chan *chan, const void *data,
+                             uint32_t len,
+                             const struct ftest_sock_chan_addr *dest);
+
+/**
+ * Receive data. A stream returns as many bytes as are available, a datagram
+ * endpoint one datagram, truncated to the buffer.
+ *
+ * @param src Filled with the sender's address unless NULL
+ * @param peek Leave the data in the channel
+ * @return The number of bytes received, 0 at the end of a stream, or a
+ * negative result
+ */
+int32_t ftest_sock_chan_recv(struct ftest_sock_chan *chan, void *buf,
+                             uint32_t len, struct ftest_sock_chan_addr *src,
+                             bool peek);
+
+/**
+ * Check whether a receive, or an accept on a listening endpoint, would not
+ * return FTEST_SOCK_CHAN_AGAIN.
+ */
+bool ftest_sock_chan_is_readable(const struct ftest_sock_chan *chan);
+
+/**
+ * Check whether a send would not return FTEST_SOCK_CHAN_AGAIN.
+ */
+bool ftest_sock_chan_is_writable(const struct ftest_sock_chan *chan);
+
+/**
+ * Stop waking up an entity removed from the schedule, as its entry may be
+ * reused by another one. Its endpoints stay open, but changes to them do not
+ * ring any doorbell anymore.
+ */
+void ftest_sock_chan_detach_entity(
+    const struct ftest_shed_entity_entry *entity);
+
+ftest_sock_chan_result_t
+ftest_sock_chan_get_local(const struct ftest_sock_chan *chan,
+                          struct ftest_sock_chan_addr *addr);
+
+ftest_sock_chan_result_t
+ftest_sock_chan_get_peer(const struct ftest_sock_chan *chan,
+                         struct ftest_sock_chan_addr *addr);
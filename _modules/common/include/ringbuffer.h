@@ -11,13 +11,52 @@ typedef struct {
   uint8_t data[];       // Flexible array member for actual data
 } rb_entry_t;
 
+// Variable-length record header
+typedef struct {
+  uint32_t write_index; // Byte position when this record was written
+  uint32_t len;         // Length of the data, or RB_VAR_WRAP_MARKER
+  uint8_t data[];       // Flexible array member for actual data
+} rb_var_entry_t;
+
+// Marks the unused tail of the buffer, the next record starts at its beginning
+#define RB_VAR_WRAP_MARKER UINT32_MAX
+
+// Records in variable-length mode start at multiples of this
+#define RB_VAR_ALIGN 8
+
+// Maximum number of readers which can be registered with a ring buffer
+#ifndef RB_MAX_READERS
+#define RB_MAX_READERS 256
+#endif
+
+// Entry handed out by rb_read_batch()
+typedef struct {
+  const void *base;    // Data of the entry in the buffer
+  uint32_t len;        // Size of the data
+  uint32_t next_index; // Reader index past this entry
+} rb_iovec_t;
+
+// Ring buffer statistics
+typedef struct {
+  uint32_t stalls; // Writes which had to wait for readers in lossless mode
+  uint32_t saved;  // Writes which waited and then succeeded without overrun
+} rb_stats_t;
+
 // Ring buffer structure
 typedef struct {
-  uint8_t *buffer;      // Raw buffer memory
-  uint32_t size;        // Total buffer size in bytes
-  uint32_t entry_size;  // Size of each entry (including header)
-  uint32_t num_entries; // Number of entries that fit in buffer
-  uint32_t write_index; // Current write index (monotonically increasing)
+  uint8_t *buffer;         // Raw buffer memory
+  uint32_t size;           // Total buffer size in bytes
+  uint32_t entry_size;     // Size of each entry (including header)
+  uint32_t num_entries;    // Number of entries that fit in buffer
+  uint32_t write_index;    // Current write index (monotonically increasing)
+  bool var_length;         // Records are variable-length, indices are in bytes
+  uint32_t reserved;       // Bytes reserved by rb_reserve(), not committed yet
+  uint32_t reserved_index; // Index of the entry reserved by rb_reserve()
+  uint32_t index_mask;     // num_entries - 1 in power-of-two mode, else 0
+  uint8_t entry_shift;     // log2(entry_size) in power-of-two mode
+  bool lossless;           // Never overwrite data of registered readers
+  rb_stats_t stats;        // Lossless mode statistics
+  const uint32_t *readers[RB_MAX_READERS]; // Indices of registered readers
 } ringbuffer_t;
 
 // Return codes
@@ -25,7 +64,8 @@ typedef enum {
   RB_OK = 0,
   RB_ERROR = -1,
   RB_OVERRUN = -2,
-  RB_INVALID_PARAM = -3
+  RB_INVALID_PARAM = -3,
+  RB_FULL = -4
 } rb_result_t;
 
 /**
@@ -39,12 +79,71 @@ typedef enum {
 rb_result_t rb_init(ringbuffer_t *rb, uint8_t *buffer, uint32_t buffer_size,
                     uint32_t data_size);
 
+/**
+ * Initialize ring buffer in power-of-two mode, where both the entry size and
+ * the number of entries are powers of two, so entries are located with masks
+ * and shifts instead of divisions. The buffer may not be used up entirely.
+ * @param rb Ring buffer structure
+ * @param buffer Memory buffer to use
+ * @param buffer_size Total size of buffer in bytes
+ * @param data_size Minimum size of data portion of each entry
+ * @return RB_OK on success, error code otherwise
+ */
+rb_result_t rb_init_pow2(ringbuffer_t *rb, uint8_t *buffer,
+                         uint32_t buffer_size, uint32_t data_size);
+
+/**
+ * Initialize ring buffer in variable-length mode, where every record takes
+ * only as much space as its data (plus a small header). Reader indices are
+ * byte positions in this mode.
+ * @param rb Ring buffer structure
+ * @param buffer Memory buffer to use
+ * @param buffer_size Total size of buffer in bytes, a power of two
+ * @return RB_OK on success, error code otherwise
+ */
+rb_result_t rb_init_var(ringbuffer_t *rb, uint8_t *buffer,
+                        uint32_t buffer_size);
+
+/**
+ * Set whether writes may overwrite data not yet read by registered readers
+ * @param rb Ring buffer structure
+ * @param lossless In lossless mode, writes which would overwrite unread data
+ * fail with RB_FULL instead
+ */
+void rb_set_lossless(ringbuffer_t *rb, bool lossless);
+
+/**
+ * Register a reader, so lossless writes do not overwrite its unread data
+ * @param rb Ring buffer structure
+ * @param reader_index Reader's index, which the reader keeps updating
+ * @return Reader handle (non-negative) on success, error code otherwise
+ */
+int rb_register_reader(ringbuffer_t *rb, const uint32_t *reader_index);
+
+/**
+ * Unregister a reader
+ * @param rb Ring buffer structure
+ * @param reader Reader handle returned by rb_register_reader()
+ */
+void rb_unregister_reader(ringbuffer_t *rb, int reader);
+
+/**
+ * Check whether data can be written without overwriting the unread data of
+ * any registered reader. Readers which were already overrun are not
+ * considered, as their data is lost anyway.
+ * @param rb Ring buffer structure
+ * @param data_size Size of data to write
+ * @return true if there is room, false otherwise
+ */
+bool rb_has_room(const ringbuffer_t *rb, uint32_t data_size);
+
 /**
  * Write data to ring buffer
  * @param rb Ring buffer structure
  * @param data Data to write
  * @param data_size Size of data to write
- * @return RB_OK on success, error code otherwise
+ * @return RB_OK on success, RB_FULL if there is no room in lossless mode,
+ * error code otherwise
  */
 rb_result_t rb_write(ringbuffer_t *rb, const void *data, uint32_t data_size);
 
@@ -62,6 +161,96 @@ rb_result_t rb_write(ringbuffer_t *rb, const void *data, uint32_t data_size);
 rb_result_t rb_read(ringbuffer_t *rb, uint32_t reader_index, void *data,
                     uint32_t data_size, uint32_t *actual_index);
 
+/**
+ * Read data from ring buffer and advance the reader's index past it
+ * @param rb Ring buffer structure
+ * @param reader_index Reader's current index, updated to the next entry. On
+ * overrun in variable-length mode, it skips to the current write index.
+ * @param data Buffer to store read data
+ * @param data_size Size of data buffer
+ * @param read_size Pointer to store the size of the read data (can be NULL).
+ * In fixed-size mode this is always data_size.
+ * @return RB_OK on success, RB_OVERRUN if data was overwritten, error code
+ * otherwise
+ */
+rb_result_t rb_read_next(ringbuffer_t *rb, uint32_t *reader_index, void *data,
+                         uint32_t data_size, uint32_t *read_size);
+
+/**
+ * Reserve space for the next entry, so the writer can fill it in place.
+ * Only one entry can be reserved at a time, and no other write may happen
+ * until it is committed.
+ * @param rb Ring buffer structure
+ * @param max_size Maximum size of the data that will be committed
+ * @return Pointer to the data of the entry in the buffer, NULL on error or if
+ * there is no room in lossless mode
+ */
+void *rb_reserve(ringbuffer_t *rb, uint32_t max_size);
+
+/**
+ * Reserve space for the next entry, waiting for the readers to make room for
+ * it in lossless mode
+ * @param rb Ring buffer structure
+ * @param max_size Maximum size of the data that will be committed
+ * @param wait Called while there is no room, shall let the readers progress.
+ * Returns false to give up.
+ * @param arg Argument passed to wait
+ * @return Pointer to the data of the entry in the buffer, NULL on error or if
+ * the writer gave up
+ */
+void *rb_reserve_wait(ringbuffer_t *rb, uint32_t max_size,
+                      bool (*wait)(void *arg), void *arg);
+
+/**
+ * Publish the entry reserved by rb_reserve()
+ * @param rb Ring buffer structure
+ * @param data_size Actual size of the data, at most the reserved size. Zero
+ * drops the reservation without publishing anything, though what it overwrote
+ * is lost for readers which had not read it yet.
+ * @return RB_OK on success, error code otherwise
+ */
+rb_result_t rb_commit(ringbuffer_t *rb, uint32_t data_size);
+
+/**
+ * Get a pointer to the data of an entry in the buffer without copying it
+ * @param rb Ring buffer structure
+ * @param reader_index Reader's current index
+ * @param data Pointer to store the address of the data
+ * @param data_size Pointer to store the size of the data (in fixed-size mode,
+ * the size of the data portion of the entry)
+ * @return RB_OK on success, RB_OVERRUN if data was overwritten, error code
+ * otherwise
+ */
+rb_result_t rb_peek(const ringbuffer_t *rb, uint32_t reader_index,
+                    const void **data, uint32_t *data_size);
+
+/**
+ * Get pointers to up to max_count consecutive entries without copying them.
+ * Entries are valid at the time of the call; a reader which uses them later
+ * shall check each of them with rb_is_overrun() before trusting the data.
+ * @param rb Ring buffer structure
+ * @param reader_index Reader's current index
+ * @param iov Array to store the entries in
+ * @param max_count Size of the array
+ * @param count Pointer to store the number of entries stored
+ * @return RB_OK on success (including when no entries are available),
+ * RB_OVERRUN if the first entry was overwritten, error code otherwise
+ */
+rb_result_t rb_read_batch(const ringbuffer_t *rb, uint32_t reader_index,
+                          rb_iovec_t *iov, uint32_t max_count,
+                          uint32_t *count);
+
+/**
+ * Finish using the entry obtained by rb_peek() and advance the reader's index
+ * past it. The data must not be used if this returns RB_OVERRUN, as it was
+ * overwritten while the reader was using it.
+ * @param rb Ring buffer structure
+ * @param reader_index Reader's current index, updated to the next entry
+ * @return RB_OK on success, RB_OVERRUN if data was overwritten, error code
+ * otherwise
+ */
+rb_result_t rb_release(const ringbuffer_t *rb, uint32_t *reader_index);
+
 /**
  * Get current write index (for readers to track their position)
  * @param rb Ring buffer structure
@@ -73,10 +262,25 @@ uint32_t rb_get_write_index(const ringbuffer_t *rb);
  * Get number of entries available for reading from a given reader index
  * @param rb Ring buffer structure
  * @param reader_index Reader's current index
- * @return Number of entries available
+ * @return Number of entries available (bytes in variable-length mode)
  */
 uint32_t rb_available(const ringbuffer_t *rb, uint32_t reader_index);
 
+/**
+ * Get the number of entries the buffer holds at most
+ * @param rb Ring buffer structure
+ * @return Capacity in entries (bytes in variable-length mode), as counted by
+ * rb_available()
+ */
+uint32_t rb_get_capacity(const ringbuffer_t *rb);
+
+/**
+ * Get the lossless mode statistics
+ * @param rb Ring buffer structure
+ * @param stats Pointer to store the statistics
+ */
+void rb_get_stats(const ringbuffer_t *rb, rb_stats_t *stats);
+
 /**
  * Check if the ring buffer is valid
  * @param rb Ring buffer structure
@@ -1,6 +1,8 @@
 #include "ftest_eth_buf.h"
+#include "ftest_eth_doorbell.h"
+#include "ftest_eth_link.h"
+#include "ftest_sched_entity.h"
 #include "ringbuffer.h"
-#include "ftest_pcap.h"
 #include "zephyr/kernel.h"
 #include "zephyr/kernel/thread.h"
 #include "zephyr/logging/log_core.h"
@@ -8,6 +10,7 @@
 #include "zephyr/net/net_if.h"
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <zephyr/logging/log.h>
 
 /******************************************************************************
@@ -18,32 +21,53 @@
 
 #define ETH_HDR_LEN sizeof(struct net_eth_hdr)
 #define FTEST_HDR_LEN (sizeof(struct ftest_eth_hdr))
-#define TOTAL_PLD_LEN (FTEST_HDR_LEN + ETH_HDR_LEN + NET_ETH_MTU)
+#define TOTAL_PLD_LEN                                                          \
+  (FTEST_HDR_LEN + ETH_HDR_LEN + CONFIG_FTEST_ETH_INPROC_MTU)
 #define NET_BUF_TIMEOUT K_MSEC(100)
+#define FTEST_ETH_RX_BATCH 16
+#define FTEST_ETH_DOORBELL_IRQ_PRIO 2
+#define FTEST_ETH_INSTANCE_COUNT DT_NUM_INST_STATUS_OKAY(DT_DRV_COMPAT)
 
 /******************************************************************************
  Structures
  ******************************************************************************/
 
-struct ftest_eth_hdr {
-  size_t len;
-  uint8_t payload[];
-} __packed;
-
 struct ftest_eth_inproc_config {
   uint8_t mac[6];
   const char *ip;
   const char *mask;
+  const char *segment;
+  struct ftest_eth_link_config link;
+  uint32_t ring_size;
+  uint32_t slot_size;
+};
+
+/* A received frame waiting for its delivery time */
+struct ftest_eth_delayed {
+  uint64_t deliver_time;
+  struct net_pkt *pkt;
 };
 
 struct ftest_eth_inproc_data {
   uint8_t send_buf[TOTAL_PLD_LEN];
-  uint8_t recv_buf[TOTAL_PLD_LEN];
+  uint8_t mac[6];
+  int port;
+  ringbuffer_t *rb;
   uint32_t ringbuf_rx_index;
+  struct ftest_eth_delayed delay_line[CONFIG_FTEST_ETH_INPROC_DELAY_LINE];
+  size_t delayed_count;
+  struct ftest_eth_link link;
   struct net_linkaddr ll_addr;
+  struct k_sem rx_sem;
+  bool started;
   struct k_thread rx_thread;
   struct z_thread_stack_element *rx_stack;
   size_t rx_stack_size;
+  struct ftest_shed_entity_entry *sched_entity;
+  struct ftest_eth_port_stats stats;
+#if CONFIG_NET_STATISTICS_ETHERNET
+  struct net_stats_eth eth_stats;
+#endif
 };
 
 /******************************************************************************
@@ -52,15 +76,41 @@ struct ftest_eth_inproc_data {
 
 LOG_MODULE_REGISTER(DT_DRV_COMPAT, LOG_LEVEL_ERR);
 
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+/* Interfaces woken up by the doorbell interrupt, shared by all of them */
+static struct ftest_eth_inproc_data
+    *ftest_eth_doorbell_targets[FTEST_ETH_INSTANCE_COUNT];
+static size_t ftest_eth_doorbell_target_count = 0;
+
 /******************************************************************************
  Driver implementation
  ******************************************************************************/
 
-static struct net_pkt *prepare_pkt(struct net_if *iface, uint8_t *payload,
-                                   int count, int *status) {
+/**
+ * Let the readers of a full ring catch up - the sender sleeps, which lets the
+ * scheduler run the other entities in the meantime.
+ */
+static bool ftest_eth_wait_for_readers(void *give_up_ptr) {
+  k_timepoint_t *give_up = give_up_ptr;
+
+  if (sys_timepoint_expired(*give_up)) {
+    return false;
+  }
+
+  k_sleep(K_USEC(CONFIG_FTEST_ETH_INPROC_STALL_US));
+
+  return true;
+}
+
+static struct net_pkt *prepare_pkt(struct net_if *iface,
+                                   const uint8_t *payload, int count,
+                                   k_timeout_t timeout, int *status) {
 
   struct net_pkt *pkt =
-      net_pkt_rx_alloc_with_buffer(iface, count, AF_UNSPEC, 0, NET_BUF_TIMEOUT);
+      net_pkt_rx_alloc_with_buffer(iface, count, AF_UNSPEC, 0, timeout);
 
   if (!pkt) {
     *status = -ENOMEM;
@@ -80,68 +130,271 @@ static struct net_pkt *prepare_pkt(struct net_if *iface, uint8_t *payload,
   return pkt;
 }
 
-static void ftest_eth_rx_task(void *iface_ptr, void *unused1, void *unused2) {
-  ARG_UNUSED(unused1);
-  ARG_UNUSED(unused2);
+/**
+ * Copy a frame from the ring into a packet, and move past it. The length is
+ * the one checked against the record, as the header may be overwritten while
+ * waiting for a packet.
+ *
+ * @return 0 on success, -ENOMEM if no packet could be allocated in time, in
+ * which case the frame stays in the ring, other negative errno if the frame
+ * was lost
+ */
+static int ftest_eth_rx_take(struct net_if *iface,
+                             struct ftest_eth_inproc_data *data,
+                             const struct ftest_eth_hdr *ftest_hdr,
+                             uint32_t len, uint32_t next_index,
+                             k_timeout_t timeout, struct net_pkt **pkt) {
+  /* The frame is copied into the packet straight from the ring */
+  int status;
+  *pkt = prepare_pkt(iface, ftest_hdr->payload, len, timeout, &status);
+
+  if (status == -ENOMEM) {
+    return status;
+  }
 
-  struct net_if *iface = iface_ptr;
-  const struct device *dev = net_if_get_device(iface);
-  struct ftest_eth_inproc_data *data = dev->data;
+  bool overrun = rb_is_overrun(data->rb, data->ringbuf_rx_index);
+  data->ringbuf_rx_index = next_index;
 
-  LOG_DBG("Starting ZETH RX thread");
+  if (!*pkt) {
+    LOG_ERR("Failed to prepare packet: %d", status);
+    data->stats.rx_no_buf++;
+    return status;
+  }
 
-  while (true) {
-    if (net_if_is_up(iface)) {
-      while (rb_available(&ftest_eth_inproc_rb, data->ringbuf_rx_index) > 0) {
+  if (overrun) {
+    LOG_WRN("Frame overwritten while receiving it, data will be lost");
+    data->stats.rx_overruns++;
+    net_pkt_unref(*pkt);
+    return -EIO;
+  }
 
-        rb_result_t res = rb_read(&ftest_eth_inproc_rb, data->ringbuf_rx_index,
-                                  data->recv_buf, TOTAL_PLD_LEN, NULL);
-        data->ringbuf_rx_index++;
+  return 0;
+}
 
-        if (res != RB_OK && res != RB_OVERRUN) {
-          LOG_ERR("Failed to read from ring buffer: %d", res);
-          continue;
-        }
+/**
+ * Pass a received packet to the network stack.
+ */
+static void ftest_eth_rx_deliver(struct net_if *iface,
+                                 struct ftest_eth_inproc_data *data,
+                                 struct net_pkt *pkt) {
+  size_t len = net_pkt_get_len(pkt);
+  int status = net_recv_data(iface, pkt);
+  if (status < 0) {
+    LOG_ERR("Failed to receive data on iface %p, status %d", iface, status);
+    data->stats.rx_errors++;
+    net_pkt_unref(pkt);
+    return;
+  }
 
-        if (res == RB_OVERRUN) {
-          LOG_WRN("Ring buffer overrun detected, data will be lost");
-          continue;
-        }
+  data->stats.rx_frames++;
+  data->stats.rx_bytes += len;
 
-        struct ftest_eth_hdr *ftest_hdr =
-            (struct ftest_eth_hdr *)data->recv_buf;
-        uint8_t *payload = ftest_hdr->payload;
+  LOG_INF("Received pkt %p len %zu on iface %p", pkt, len, iface);
+}
 
-        int status;
-        struct net_pkt *pkt =
-            prepare_pkt(iface, payload, ftest_hdr->len, &status);
+/**
+ * Hold a packet back until its delivery time. The delay line is kept sorted,
+ * packets due at the same time keep the order they were received in.
+ */
+static void ftest_eth_rx_delay(struct ftest_eth_inproc_data *data,
+                               struct net_pkt *pkt, uint64_t deliver_time) {
+  size_t i = data->delayed_count;
+
+  while (i > 0 && data->delay_line[i - 1].deliver_time > deliver_time) {
+    data->delay_line[i] = data->delay_line[i - 1];
+    i--;
+  }
 
-        if (!pkt) {
-          net_pkt_unref(pkt);
-          LOG_ERR("Failed to prepare packet: %d", status);
-          continue;
-        }
+  data->delay_line[i] = (struct ftest_eth_delayed){
+      .deliver_time = deliver_time,
+      .pkt = pkt,
+  };
+  data->delayed_count++;
+}
+
+static void ftest_eth_rx_deliver_due(struct net_if *iface,
+                                     struct ftest_eth_inproc_data *data,
+                                     uint64_t now) {
+  size_t due = 0;
 
-        status = net_recv_data(iface, pkt);
-        if (status < 0) {
-          LOG_ERR("Failed to receive data on iface %p, status %d", iface,
-                  status);
-          net_pkt_unref(pkt);
-          continue;
+  while (due < data->delayed_count &&
+         data->delay_line[due].deliver_time <= now) {
+    ftest_eth_rx_deliver(iface, data, data->delay_line[due].pkt);
+    due++;
+  }
+
+  data->delayed_count -= due;
+  memmove(data->delay_line, data->delay_line + due,
+          data->delayed_count * sizeof(data->delay_line[0]));
+}
+
+/**
+ * Count how full the ring is, as the receiver is about to drain it.
+ */
+static void ftest_eth_rx_sample_occupancy(struct ftest_eth_inproc_data *data) {
+  uint64_t capacity = rb_get_capacity(data->rb);
+  uint64_t available = rb_available(data->rb, data->ringbuf_rx_index);
+
+  if (capacity == 0) {
+    return;
+  }
+
+  size_t bucket = available * FTEST_ETH_BUF_OCCUPANCY_BUCKETS / capacity;
+
+  data->stats.occupancy[MIN(bucket, FTEST_ETH_BUF_OCCUPANCY_BUCKETS - 1)]++;
+}
+
+/**
+ * Pass every frame which is already due to the network stack. The frames
+ * which are not are moved from the ring to the delay line, as long as there
+ * is room for them, since with jitter and reordering the frames do not have
+ * to arrive in the order they were sent. Frames sent less than the lookahead
+ * ago are left in the ring, as the parallel scheduler may not have written
+ * them yet, and taking them would make the receiver depend on it.
+ *
+ * @return The earliest time at which a frame still on the link reaches the
+ * port or is due, or UINT64_MAX if there is none
+ */
+static uint64_t ftest_eth_rx_drain(struct net_if *iface,
+                                   struct ftest_eth_inproc_data *data) {
+  uint64_t now = ftest_shed_get_time(data->sched_entity);
+  uint64_t lookahead = ftest_shed_get_lookahead();
+  uint64_t blocked_time = UINT64_MAX;
+  rb_iovec_t frames[FTEST_ETH_RX_BATCH];
+  uint32_t count;
+
+  ftest_eth_rx_deliver_due(iface, data, now);
+  ftest_eth_rx_sample_occupancy(data);
+
+  while (blocked_time == UINT64_MAX) {
+    rb_result_t res = rb_read_batch(data->rb, data->ringbuf_rx_index, frames,
+                                    ARRAY_SIZE(frames), &count);
+
+    if (res == RB_OVERRUN) {
+      LOG_WRN("Ring buffer overrun detected, data will be lost");
+      data->stats.rx_overruns++;
+      rb_release(data->rb, &data->ringbuf_rx_index);
+      continue;
+    }
+
+    if (res != RB_OK) {
+      LOG_ERR("Failed to read from ring buffer: %d", res);
+      break;
+    }
+
+    if (count == 0) {
+      break;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+      const struct ftest_eth_hdr *ftest_hdr = frames[i].base;
+      struct net_pkt *pkt;
+
+      /* Taking an earlier frame may have waited for a packet, while the
+       * writers went on */
+      if (rb_is_overrun(data->rb, data->ringbuf_rx_index)) {
+        LOG_WRN("Ring buffer overrun detected, data will be lost");
+        data->stats.rx_overruns++;
+        rb_release(data->rb, &data->ringbuf_rx_index);
+        break;
+      }
+
+      uint32_t len = ftest_hdr->len;
+
+      if (frames[i].len < FTEST_HDR_LEN ||
+          len > frames[i].len - FTEST_HDR_LEN) {
+        LOG_ERR("Frame of %u bytes does not fit its record, dropped", len);
+        data->stats.rx_errors++;
+        data->ringbuf_rx_index = frames[i].next_index;
+        continue;
+      }
+
+      /* The frames behind it in the ring were sent later, and reach the
+       * port later as well, even if some of them are due earlier */
+      if (ftest_hdr->sent_time + lookahead > now) {
+        blocked_time = ftest_hdr->sent_time + lookahead;
+        break;
+      }
+
+      bool due = ftest_hdr->deliver_time <= now;
+
+      if (!due && data->delayed_count == ARRAY_SIZE(data->delay_line)) {
+        blocked_time = ftest_hdr->deliver_time;
+        break;
+      }
+
+      /* A frame on the link does not wait for a free packet, it rather stays
+       * in the ring */
+      int status = ftest_eth_rx_take(iface, data, ftest_hdr, len,
+                                     frames[i].next_index,
+                                     due ? NET_BUF_TIMEOUT : K_NO_WAIT, &pkt);
+
+      if (status == -ENOMEM) {
+        if (!due) {
+          blocked_time = ftest_hdr->deliver_time;
+          break;
         }
 
-        LOG_INF("Received pkt %p len %d on iface %p", pkt, ftest_hdr->len,
-                iface);
+        LOG_ERR("Failed to allocate a packet, frame dropped");
+        data->stats.rx_no_pkt++;
+        data->ringbuf_rx_index = frames[i].next_index;
+        continue;
+      }
 
-#if CONFIG_FTEST_ETH_OUTPUT_PCAP
-        ftest_pcap_write_packet(ftest_hdr->payload, ftest_hdr->len,
-                                k_uptime_get());
-#endif
+      if (status < 0) {
+        continue;
+      }
+
+      if (due) {
+        ftest_eth_rx_deliver(iface, data, pkt);
+      } else {
+        ftest_eth_rx_delay(data, pkt, ftest_hdr->deliver_time);
       }
-      k_yield();
     }
+  }
 
-    k_sleep(K_MSEC(10));
+  if (data->delayed_count > 0) {
+    return MIN(blocked_time, data->delay_line[0].deliver_time);
+  }
+
+  return blocked_time;
+}
+
+static void ftest_eth_rx_task(void *iface_ptr, void *unused1, void *unused2) {
+  ARG_UNUSED(unused1);
+  ARG_UNUSED(unused2);
+
+  struct net_if *iface = iface_ptr;
+  const struct device *dev = net_if_get_device(iface);
+  struct ftest_eth_inproc_data *data = dev->data;
+
+  LOG_DBG("Starting ZETH RX thread");
+
+  while (true) {
+    /* Frames are left in the ring while the interface is down, the start of
+     * the interface wakes the thread up to catch up on them */
+    if (data->started) {
+      uint64_t deliver_time = ftest_eth_rx_drain(iface, data);
+
+      /* The doorbell only keeps the earliest ring, so the one for the next
+       * frame still on the link may have been dropped. It is rung again
+       * rather than waited for with a timeout, so the frame is received at
+       * exactly its delivery time */
+      if (deliver_time != UINT64_MAX) {
+        ftest_eth_doorbell_ring_after(deliver_time -
+                                      ftest_shed_get_time(data->sched_entity));
+      }
+    }
+
+    k_sem_take(&data->rx_sem, K_FOREVER);
+  }
+}
+
+static void ftest_eth_doorbell_isr(const void *arg) {
+  ARG_UNUSED(arg);
+
+  for (size_t i = 0; i < ftest_eth_doorbell_target_count; i++) {
+    k_sem_give(&ftest_eth_doorbell_targets[i]->rx_sem);
   }
 }
 
@@ -156,20 +409,64 @@ static void ftest_eth_iface_init(struct net_if *iface) {
 
   ethernet_init(iface);
 
-  if (!rb_is_valid(&ftest_eth_inproc_rb)) {
-    rb_result_t res =
-        rb_init(&ftest_eth_inproc_rb, ftest_eth_inproc_rb_buffer,
-                sizeof(ftest_eth_inproc_rb_buffer), TOTAL_PLD_LEN);
+  /* The interface is started even when the rest of this fails */
+  k_sem_init(&data->rx_sem, 0, 1);
 
-    if (res != RB_OK) {
-      LOG_ERR("Failed to initialize eth ring buffer: %d", res);
-      return;
-    }
+  /* The interface is initialized as a part of the entity boot, so this is the
+   * only point where the scheduler knows which entity it belongs to */
+  data->sched_entity = ftest_shed_get_current_entity();
+  ftest_shed_declare_lookahead(config->link.latency_us);
+
+  /* Instances of one entity library offset the device part of the address */
+  uint32_t instance = ftest_shed_get_instance(data->sched_entity);
+  uint32_t nic = (config->mac[3] << 16 | config->mac[4] << 8 | config->mac[5]) +
+                 instance;
+
+  memcpy(data->mac, config->mac, 3);
+  data->mac[3] = nic >> 16;
+  data->mac[4] = nic >> 8;
+  data->mac[5] = nic;
+
+  ftest_eth_link_init(&data->link, &config->link, data->mac,
+                      sizeof(data->mac));
+
+  data->port =
+      ftest_eth_buf_attach(config->segment, data->mac, config->ring_size,
+                           config->slot_size, data->sched_entity);
+  if (data->port < 0) {
+    LOG_ERR("Failed to attach to network segment %s", config->segment);
+    return;
+  }
+
+  data->rb = ftest_eth_buf_get_ring(data->port);
+
+  if (ftest_eth_buf_set_stats(data->port, &data->stats) < 0) {
+    LOG_ERR("Failed to register the statistics of port %d", data->port);
   }
 
-  data->ringbuf_rx_index = rb_get_write_index(&ftest_eth_inproc_rb);
+  data->ringbuf_rx_index = rb_get_write_index(data->rb);
+
+  int rb_res = rb_register_reader(data->rb, &data->ringbuf_rx_index);
+  if (rb_res < 0) {
+    LOG_ERR("Failed to register eth ring buffer reader: %d", rb_res);
+    return;
+  }
+
+  if (ftest_eth_doorbell_target_count == 0) {
+    IRQ_CONNECT(CONFIG_FTEST_ETH_INPROC_DOORBELL_IRQ,
+                FTEST_ETH_DOORBELL_IRQ_PRIO, ftest_eth_doorbell_isr, NULL, 0);
+    irq_enable(CONFIG_FTEST_ETH_INPROC_DOORBELL_IRQ);
+  }
 
-  int res = net_linkaddr_set(&data->ll_addr, config->mac, sizeof(config->mac));
+  ftest_eth_doorbell_targets[ftest_eth_doorbell_target_count++] = data;
+
+  if (ftest_shed_set_doorbell(data->sched_entity, ftest_eth_doorbell_ring) <
+      0) {
+    LOG_ERR("Failed to set the RX doorbell");
+    return;
+  }
+
+  int res = net_linkaddr_set(&data->ll_addr, data->mac, sizeof(data->mac));
   if (res < 0) {
     LOG_ERR("Failed to convert link address: %d", res);
     return;
@@ -192,18 +489,32 @@ static void ftest_eth_iface_init(struct net_if *iface) {
     return;
   }
 
-  struct net_if_addr *addr_res =
-      net_if_ipv4_addr_add(iface, &addr, NET_ADDR_MANUAL, 0);
+  res = net_addr_pton(AF_INET, config->mask, &netmask);
 
-  if (addr_res == NULL) {
-    NET_ERR("Failed to add IPv4 address: %s", config->ip);
+  if (res < 0) {
+    NET_ERR("Invalid netmask: %s", config->mask);
     return;
   }
 
-  res = net_addr_pton(AF_INET, config->mask, &netmask);
+  uint32_t base_ip = ntohl(addr.s_addr);
+  uint32_t mask = ntohl(netmask.s_addr);
 
-  if (res < 0) {
-    NET_ERR("Invalid netmask: %s", config->mask);
+  if (((base_ip + instance) & mask) != (base_ip & mask)) {
+    NET_ERR("Instance %u does not fit into the subnet of %s/%s", instance,
+            config->ip, config->mask);
+    return;
+  }
+
+  addr.s_addr = htonl(base_ip + instance);
+
+  char ip[NET_IPV4_ADDR_LEN];
+  net_addr_ntop(AF_INET, &addr, ip, sizeof(ip));
+
+  struct net_if_addr *addr_res =
+      net_if_ipv4_addr_add(iface, &addr, NET_ADDR_MANUAL, 0);
+
+  if (addr_res == NULL) {
+    NET_ERR("Failed to add IPv4 address: %s", ip);
     return;
   }
 
@@ -224,37 +535,123 @@ static void ftest_eth_iface_init(struct net_if *iface) {
   }
 
   LOG_INF("Eth interface %p initialized with MAC "
-          "%02x:%02x:%02x:%02x:%02x:%02x, address %s, netmask %s",
-          iface, config->mac[0], config->mac[1], config->mac[2], config->mac[3],
-          config->mac[4], config->mac[5], config->ip, config->mask);
+          "%02x:%02x:%02x:%02x:%02x:%02x, address %s, netmask %s, segment %s",
+          iface, data->mac[0], data->mac[1], data->mac[2], data->mac[3],
+          data->mac[4], data->mac[5], ip, config->mask, config->segment);
 }
 
 static int ftest_eth_iface_send(const struct device *dev, struct net_pkt *pkt) {
   struct ftest_eth_inproc_data *data = dev->data;
   int count = net_pkt_get_len(pkt);
   int ret;
+  uint64_t deliver_time;
+
+  /* Unicast frames to a known port are built right in its ring. Others are
+   * copied to each port they are flooded to, and so are all frames which
+   * have to be held back until the end of a parallel execution window */
+  int dst_port = FTEST_ETH_BUF_FLOOD;
+
+  if (!ftest_shed_is_deferring(data->sched_entity)) {
+    struct net_eth_hdr *eth_hdr = NET_ETH_HDR(pkt);
 
+    dst_port = ftest_eth_buf_route(data->port, eth_hdr->dst.addr,
+                                   eth_hdr->src.addr);
+  }
+
+  if (dst_port == FTEST_ETH_BUF_DROP) {
+    return 0;
+  }
+
+  bool in_place = dst_port != FTEST_ETH_BUF_FLOOD;
+  ringbuffer_t *dst_rb = ftest_eth_buf_get_ring(dst_port);
   struct ftest_eth_hdr *ftest_hdr = (struct ftest_eth_hdr *)data->send_buf;
+
+  if (in_place) {
+    k_timepoint_t give_up =
+        sys_timepoint_calc(K_MSEC(CONFIG_FTEST_ETH_INPROC_STALL_TIMEOUT_MS));
+
+    ftest_hdr = rb_reserve_wait(dst_rb, FTEST_HDR_LEN + count,
+                                ftest_eth_wait_for_readers, &give_up);
+  }
+
+  if (!ftest_hdr) {
+    LOG_ERR("Cannot reserve space for pkt %p", pkt);
+    data->stats.tx_dropped++;
+    return -ENOMEM;
+  }
+
+  /* Only once the frame has room, as the sender may have waited for it */
+  if (!ftest_eth_link_transmit(&data->link,
+                               ftest_shed_get_time(data->sched_entity), count,
+                               &deliver_time)) {
+    LOG_DBG("Pkt %p lost on the link", pkt);
+    data->stats.link_lost++;
+    if (in_place) {
+      rb_commit(dst_rb, 0);
+    }
+    return 0;
+  }
+
   ftest_hdr->len = count;
+  ftest_hdr->sent_time = ftest_shed_get_time(data->sched_entity);
+  ftest_hdr->deliver_time = deliver_time;
+  ftest_hdr->src_port = data->port;
 
   ret = net_pkt_read(pkt, ftest_hdr->payload, count);
   if (ret) {
     LOG_ERR("Cannot retrieve pkt %p data (%d)", pkt, ret);
+    data->stats.tx_dropped++;
+    if (in_place) {
+      rb_commit(dst_rb, 0);
+    }
     return ret;
   }
 
-  ret = rb_write(&ftest_eth_inproc_rb, data->send_buf, TOTAL_PLD_LEN);
+  if (in_place) {
+    /* Frames which are not built in place are captured by the runner when
+     * it switches them */
+    ftest_eth_buf_capture(ftest_hdr);
+    ret = rb_commit(dst_rb, FTEST_HDR_LEN + count);
+
+    /* Wake up the receiver once the frame reaches it */
+    if (ret == RB_OK &&
+        ftest_eth_buf_notify(dst_port, ftest_hdr->sent_time) < 0) {
+      LOG_ERR("Cannot notify the receiver of pkt %p", pkt);
+    }
+  } else {
+    ret = ftest_shed_defer(data->sched_entity, ftest_eth_buf_commit,
+                           data->send_buf, FTEST_HDR_LEN + count);
+  }
+
   if (ret < 0) {
     LOG_ERR("Cannot send pkt %p (%d)", pkt, ret);
+    data->stats.tx_dropped++;
+    return ret;
   }
 
+  data->stats.tx_frames++;
+  data->stats.tx_bytes += count;
+
   LOG_INF("Sent pkt %p len %d", pkt, count);
 
-#if CONFIG_FTEST_ETH_OUTPUT_PCAP
-  ftest_pcap_write_packet(ftest_hdr->payload, ftest_hdr->len, k_uptime_get());
-#endif
+  return 0;
+}
+
+static int ftest_eth_iface_start(const struct device *dev) {
+  struct ftest_eth_inproc_data *data = dev->data;
 
-  return ret < 0 ? ret : 0;
+  data->started = true;
+  k_sem_give(&data->rx_sem);
+
+  return 0;
+}
+
+static int ftest_eth_iface_stop(const struct device *dev) {
+  struct ftest_eth_inproc_data *data = dev->data;
+
+  data->started = false;
+
+  return 0;
 }
 
 static int ftest_eth_iface_set_config(const struct device *dev,
@@ -265,18 +662,56 @@ static int ftest_eth_iface_set_config(const struct device *dev,
 
 static enum ethernet_hw_caps
 ftest_eth_iface_get_capabilities(const struct device *dev) {
+  ARG_UNUSED(dev);
+
+#if CONFIG_FTEST_ETH_INPROC_CHECKSUM_OFFLOAD
+  /* Frames are copied between the entities as they are, and are never
+   * corrupted on the way, so there is nothing for checksums to catch */
+  return ETHERNET_HW_TX_CHKSUM_OFFLOAD | ETHERNET_HW_RX_CHKSUM_OFFLOAD;
+#else
   return 0;
+#endif
 }
 
+#if CONFIG_NET_STATISTICS_ETHERNET
+static struct net_stats_eth *
+ftest_eth_iface_get_stats(const struct device *dev) {
+  struct ftest_eth_inproc_data *data = dev->data;
+  const struct ftest_eth_port_stats *stats = &data->stats;
+  struct net_stats_eth *eth_stats = &data->eth_stats;
+
+  eth_stats->bytes.sent = stats->tx_bytes;
+  eth_stats->bytes.received = stats->rx_bytes;
+  eth_stats->pkts.tx = stats->tx_frames;
+  eth_stats->pkts.rx = stats->rx_frames;
+  eth_stats->errors.tx = stats->tx_dropped;
+  eth_stats->errors.rx = stats->rx_overruns + stats->rx_no_pkt +
+                         stats->rx_no_buf + stats->rx_errors;
+  eth_stats->error_details.rx_over_errors = stats->rx_overruns;
+  eth_stats->error_details.rx_buf_alloc_failed = stats->rx_no_pkt;
+  eth_stats->error_details.rx_no_buffer_count = stats->rx_no_buf;
+  /* Frames lost on the emulated link are dropped on the way out, as far as
+   * the stack can tell */
+  eth_stats->tx_dropped = stats->tx_dropped + stats->link_lost;
+
+  return eth_stats;
+}
+#endif
+
 /******************************************************************************
  Driver registration
  ******************************************************************************/
 
 static struct ethernet_api ftest_eth_iface_api = {
     .iface_api.init = ftest_eth_iface_init,
+    .start = ftest_eth_iface_start,
+    .stop = ftest_eth_iface_stop,
     .send = ftest_eth_iface_send,
     .set_config = ftest_eth_iface_set_config,
     .get_capabilities = ftest_eth_iface_get_capabilities,
+#if CONFIG_NET_STATISTICS_ETHERNET
+    .get_stats = ftest_eth_iface_get_stats,
+#endif
 };
 
 #define FTEST_ETH_INPROC_INIT(inst)                                            \
@@ -294,11 +729,24 @@ static struct ethernet_api ftest_eth_iface_api = {
           .mac = DT_PROP(DT_DRV_INST(inst), mac),                              \
           .ip = DT_PROP(DT_DRV_INST(inst), ip),                                \
           .mask = DT_PROP(DT_DRV_INST(inst), mask),                            \
+          .segment = DT_PROP(DT_DRV_INST(inst), segment),                      \
+          .link =                                                              \
+              {                                                                \
+                  .latency_us = DT_PROP(DT_DRV_INST(inst), latency_us),        \
+                  .bandwidth_kbps =                                            \
+                      DT_PROP(DT_DRV_INST(inst), bandwidth_kbps),              \
+                  .jitter_us = DT_PROP(DT_DRV_INST(inst), jitter_us),          \
+                  .loss_ppm = DT_PROP(DT_DRV_INST(inst), loss_ppm),            \
+                  .reorder_ppm = DT_PROP(DT_DRV_INST(inst), reorder_ppm),      \
+                  .seed = DT_PROP(DT_DRV_INST(inst), link_seed),               \
+              },                                                               \
+          .ring_size = DT_PROP(DT_DRV_INST(inst), ring_size),                  \
+          .slot_size = DT_PROP(DT_DRV_INST(inst), slot_size),                  \
   };                                                                           \
                                                                                \
   ETH_NET_DEVICE_DT_INST_DEFINE(                                               \
       inst, NULL, NULL, &ftest_eth_inproc_data_##inst,                         \
       &ftest_eth_inproc_config_##inst, CONFIG_ETH_INIT_PRIORITY,               \
-      &ftest_eth_iface_api, NET_ETH_MTU);
+      &ftest_eth_iface_api, CONFIG_FTEST_ETH_INPROC_MTU);
 
 DT_INST_FOREACH_STATUS_OKAY(FTEST_ETH_INPROC_INIT)
\ No newline at end of file
@@ -0,0 +1,689 @@
+#include "ftest_eth_doorbell.h"
+#include "ftest_sched_entity.h"
+#include "ftest_sock_chan.h"
+#include "sockets_internal.h"
+#include "zephyr/kernel.h"
+#include "zephyr/net/net_if.h"
+#include "zephyr/net/offloaded_netdev.h"
+#include "zephyr/net/socket.h"
+#include "zephyr/net/socket_offload.h"
+#include "zephyr/sys/fdtable.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <zephyr/logging/log.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#define DT_DRV_COMPAT ftest_eth_inproc
+
+#define FTEST_SOCK_DOORBELL_IRQ_PRIO 2
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+struct ftest_sock_offload_config {
+  const char *ip;
+  const char *mask;
+};
+
+struct ftest_sock {
+  struct ftest_sock_chan *chan;
+  bool in_use;
+  bool nonblock;
+  k_timeout_t rcv_timeout;
+  k_timeout_t snd_timeout;
+  /* Raised by the doorbell, for the threads blocked on the socket */
+  struct k_poll_signal signal;
+};
+
+/******************************************************************************
+ Module confiugration
+ ******************************************************************************/
+
+LOG_MODULE_REGISTER(ftest_sock_offload, LOG_LEVEL_ERR);
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static const struct socket_op_vtable ftest_sock_vtable;
+
+static struct ftest_sock ftest_socks[CONFIG_FTEST_SOCK_OFFLOAD_MAX_SOCKETS];
+
+/* Address of the first interface, which sockets are bound to by default */
+static uint32_t ftest_sock_default_ip = 0;
+static struct ftest_shed_entity_entry *ftest_sock_sched_entity = NULL;
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+static int ftest_sock_errno(ftest_sock_chan_result_t res) {
+  switch (res) {
+  case FTEST_SOCK_CHAN_OK:
+    return 0;
+  case FTEST_SOCK_CHAN_AGAIN:
+    return EAGAIN;
+  case FTEST_SOCK_CHAN_NOMEM:
+    return ENOMEM;
+  case FTEST_SOCK_CHAN_ADDRINUSE:
+    return EADDRINUSE;
+  case FTEST_SOCK_CHAN_CONNREFUSED:
+    return ECONNREFUSED;
+  case FTEST_SOCK_CHAN_NOTCONN:
+    return ENOTCONN;
+  case FTEST_SOCK_CHAN_ISCONN:
+    return EISCONN;
+  case FTEST_SOCK_CHAN_PIPE:
+    return EPIPE;
+  default:
+    return EINVAL;
+  }
+}
+
+static int ftest_sock_fail(int err) {
+  errno = err;
+  return -1;
+}
+
+static int ftest_sock_result(ftest_sock_chan_result_t res) {
+  return res == FTEST_SOCK_CHAN_OK ? 0 : ftest_sock_fail(ftest_sock_errno(res));
+}
+
+static int ftest_sock_to_chan_addr(const struct sockaddr *addr,
+                                   socklen_t addrlen,
+                                   struct ftest_sock_chan_addr *chan_addr) {
+  if (addr == NULL || addrlen < sizeof(struct sockaddr_in)) {
+    return -EINVAL;
+  }
+
+  if (addr->sa_family != AF_INET) {
+    return -EAFNOSUPPORT;
+  }
+
+  const struct sockaddr_in *addr_in = net_sin(addr);
+
+  chan_addr->ip = ntohl(addr_in->sin_addr.s_addr);
+  chan_addr->port = ntohs(addr_in->sin_port);
+
+  /* The runner has no wildcard address of an entity */
+  if (chan_addr->ip == INADDR_ANY) {
+    chan_addr->ip = ftest_sock_default_ip;
+  }
+
+  return 0;
+}
+
+static void
+ftest_sock_from_chan_addr(const struct ftest_sock_chan_addr *chan_addr,
+                          struct sockaddr *addr, socklen_t *addrlen) {
+  if (addr == NULL || addrlen == NULL) {
+    return;
+  }
+
+  struct sockaddr_in addr_in = {
+      .sin_family = AF_INET,
+      .sin_port = htons(chan_addr->port),
+      .sin_addr.s_addr = htonl(chan_addr->ip),
+  };
+
+  memcpy(addr, &addr_in, MIN(*addrlen, sizeof(addr_in)));
+  *addrlen = sizeof(addr_in);
+}
+
+static struct ftest_sock *ftest_sock_alloc(struct ftest_sock_chan *chan) {
+  for (size_t i = 0; i < ARRAY_SIZE(ftest_socks); i++) {
+    struct ftest_sock *sock = &ftest_socks[i];
+
+    if (!sock->in_use) {
+      *sock = (struct ftest_sock){
+          .chan = chan,
+          .in_use = true,
+          .rcv_timeout = K_FOREVER,
+          .snd_timeout = K_FOREVER,
+      };
+      k_poll_signal_init(&sock->signal);
+      return sock;
+    }
+  }
+
+  return NULL;
+}
+
+/**
+ * Give a channel endpoint a file descriptor.
+ *
+ * @return The file descriptor, -1 with errno set on failure
+ */
+static int ftest_sock_new_fd(struct ftest_sock_chan *chan) {
+  int fd = zvfs_reserve_fd();
+
+  if (fd < 0) {
+    return -1;
+  }
+
+  struct ftest_sock *sock = ftest_sock_alloc(chan);
+
+  if (sock == NULL) {
+    zvfs_free_fd(fd);
+    return ftest_sock_fail(ENOMEM);
+  }
+
+  zvfs_finalize_typed_fd(fd, sock, &ftest_sock_vtable.fd_vtable,
+                         ZVFS_MODE_IFSOCK);
+
+  return fd;
+}
+
+/**
+ * Wait until the socket is ready, as told by the channel. The other entities
+ * ring the doorbell when they change a channel, so the socket sleeps in
+ * virtual time meanwhile.
+ *
+ * @return 0 once ready, -EAGAIN on timeout
+ */
+static int ftest_sock_wait(struct ftest_sock *sock,
+                           bool (*is_ready)(const struct ftest_sock_chan *),
+                           k_timeout_t timeout) {
+  k_timepoint_t end = sys_timepoint_calc(sock->nonblock ? K_NO_WAIT : timeout);
+
+  while (true) {
+    /* Reset before checking, so a ring in between is not lost */
+    k_poll_signal_reset(&sock->signal);
+
+    if (is_ready(sock->chan)) {
+      return 0;
+    }
+
+    if (sys_timepoint_expired(end)) {
+      return -EAGAIN;
+    }
+
+    struct k_poll_event event = K_POLL_EVENT_INITIALIZER(
+        K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY, &sock->signal);
+
+    if (k_poll(&event, 1, sys_timepoint_timeout(end)) == -EAGAIN) {
+      return -EAGAIN;
+    }
+  }
+}
+
+static void ftest_sock_doorbell_isr(const void *arg) {
+  ARG_UNUSED(arg);
+
+  for (size_t i = 0; i < ARRAY_SIZE(ftest_socks); i++) {
+    if (ftest_socks[i].in_use) {
+      k_poll_signal_raise(&ftest_socks[i].signal, 0);
+    }
+  }
+}
+
+/******************************************************************************
+ Driver implementation
+ ******************************************************************************/
+
+static ssize_t ftest_sock_sendto(void *obj, const void *buf, size_t len,
+                                 int flags, const struct sockaddr *dest_addr,
+                                 socklen_t addrlen) {
+  struct ftest_sock *sock = obj;
+  struct ftest_sock_chan_addr dest;
+
+  if (dest_addr != NULL) {
+    int res = ftest_sock_to_chan_addr(dest_addr, addrlen, &dest);
+
+    if (res < 0) {
+      return ftest_sock_fail(-res);
+    }
+  }
+
+  int32_t sent;
+
+  /* Only waits while the channel is full, a send which fails for any other
+   * reason fails right away */
+  while ((sent = ftest_sock_chan_send(sock->chan, buf, len,
+                                      dest_addr != NULL ? &dest : NULL)) ==
+         FTEST_SOCK_CHAN_AGAIN) {
+    if ((flags & ZSOCK_MSG_DONTWAIT) ||
+        ftest_sock_wait(sock, ftest_sock_chan_is_writable, sock->snd_timeout) <
+            0) {
+      return ftest_sock_fail(EAGAIN);
+    }
+  }
+
+  if (sent < 0) {
+    return ftest_sock_fail(ftest_sock_errno(sent));
+  }
+
+  return sent;
+}
+
+static ssize_t ftest_sock_recvfrom(void *obj, void *buf, size_t max_len,
+                                   int flags, struct sockaddr *src_addr,
+                                   socklen_t *addrlen) {
+  struct ftest_sock *sock = obj;
+  struct ftest_sock_chan_addr src;
+  int32_t received;
+
+  /* As for a send, a receive which cannot succeed does not wait, like one on
+   * a listening or unconnected stream socket */
+  while ((received = ftest_sock_chan_recv(sock->chan, buf, max_len, &src,
+                                          flags & ZSOCK_MSG_PEEK)) ==
+         FTEST_SOCK_CHAN_AGAIN) {
+    if ((flags & ZSOCK_MSG_DONTWAIT) ||
+        ftest_sock_wait(sock, ftest_sock_chan_is_readable, sock->rcv_timeout) <
+            0) {
+      return ftest_sock_fail(EAGAIN);
+    }
+  }
+
+  if (received < 0) {
+    return ftest_sock_fail(ftest_sock_errno(received));
+  }
+
+  ftest_sock_from_chan_addr(&src, src_addr, addrlen);
+
+  return received;
+}
+
+static ssize_t ftest_sock_read(void *obj, void *buf, size_t sz) {
+  return ftest_sock_recvfrom(obj, buf, sz, 0, NULL, NULL);
+}
+
+static ssize_t ftest_sock_write(void *obj, const void *buf, size_t sz) {
+  return ftest_sock_sendto(obj, buf, sz, 0, NULL, 0);
+}
+
+static int ftest_sock_close(void *obj) {
+  struct ftest_sock *sock = obj;
+
+  ftest_sock_chan_close(sock->chan);
+  sock->chan = NULL;
+  sock->in_use = false;
+
+  return 0;
+}
+
+static int ftest_sock_poll_prepare(struct ftest_sock *sock,
+                                   struct zsock_pollfd *pfd,
+                                   struct k_poll_event **pev,
+                                   struct k_poll_event *pev_end) {
+  if (*pev == pev_end) {
+    return -ENOMEM;
+  }
+
+  /* Any change of the channel raises the signal, readiness is sorted out in
+   * ftest_sock_poll_update() */
+  k_poll_signal_reset(&sock->signal);
+  k_poll_event_init(*pev, K_POLL_TYPE_SIGNAL, K_POLL_MODE_NOTIFY_ONLY,
+                    &sock->signal);
+  (*pev)++;
+
+  if (((pfd->events & ZSOCK_POLLIN) &&
+       ftest_sock_chan_is_readable(sock->chan)) ||
+      ((pfd->events & ZSOCK_POLLOUT) &&
+       ftest_sock_chan_is_writable(sock->chan))) {
+    return -EALREADY;
+  }
+
+  return 0;
+}
+
+static int ftest_sock_poll_update(struct ftest_sock *sock,
+                                  struct zsock_pollfd *pfd,
+                                  struct k_poll_event **pev) {
+  (*pev)++;
+
+  if ((pfd->events & ZSOCK_POLLIN) &&
+      ftest_sock_chan_is_readable(sock->chan)) {
+    pfd->revents |= ZSOCK_POLLIN;
+  }
+
+  if ((pfd->events & ZSOCK_POLLOUT) &&
+      ftest_sock_chan_is_writable(sock->chan)) {
+    pfd->revents |= ZSOCK_POLLOUT;
+  }
+
+  return 0;
+}
+
+static int ftest_sock_ioctl(void *obj, unsigned int request, va_list args) {
+  struct ftest_sock *sock = obj;
+
+  switch (request) {
+  case ZFD_IOCTL_POLL_PREPARE: {
+    struct zsock_pollfd *pfd = va_arg(args, struct zsock_pollfd *);
+    struct k_poll_event **pev = va_arg(args, struct k_poll_event **);
+    struct k_poll_event *pev_end = va_arg(args, struct k_poll_event *);
+
+    return ftest_sock_poll_prepare(sock, pfd, pev, pev_end);
+  }
+
+  case ZFD_IOCTL_POLL_UPDATE: {
+    struct zsock_pollfd *pfd = va_arg(args, struct zsock_pollfd *);
+    struct k_poll_event **pev = va_arg(args, struct k_poll_event **);
+
+    return ftest_sock_poll_update(sock, pfd, pev);
+  }
+
+  case F_GETFL:
+    return sock->nonblock ? O_NONBLOCK : 0;
+
+  case F_SETFL:
+    sock->nonblock = (va_arg(args, int) & O_NONBLOCK) != 0;
+    return 0;
+
+  default:
+    return ftest_sock_fail(EOPNOTSUPP);
+  }
+}
+
+static int ftest_sock_bind(void *obj, const struct sockaddr *addr,
+                           socklen_t addrlen) {
+  struct ftest_sock *sock = obj;
+  struct ftest_sock_chan_addr chan_addr;
+  int res = ftest_sock_to_chan_addr(addr, addrlen, &chan_addr);
+
+  if (res < 0) {
+    return ftest_sock_fail(-res);
+  }
+
+  return ftest_sock_result(ftest_sock_chan_bind(sock->chan, &chan_addr));
+}
+
+static int ftest_sock_connect(void *obj, const struct sockaddr *addr,
+                              socklen_t addrlen) {
+  struct ftest_sock *sock = obj;
+  struct ftest_sock_chan_addr chan_addr;
+  int res = ftest_sock_to_chan_addr(addr, addrlen, &chan_addr);
+
+  if (res < 0) {
+    return ftest_sock_fail(-res);
+  }
+
+  return ftest_sock_result(ftest_sock_chan_connect(sock->chan, &chan_addr));
+}
+
+static int ftest_sock_listen(void *obj, int backlog) {
+  struct ftest_sock *sock = obj;
+
+  return ftest_sock_result(ftest_sock_chan_listen(sock->chan, backlog));
+}
+
+static int ftest_sock_accept(void *obj, struct sockaddr *addr,
+                             socklen_t *addrlen) {
+  struct ftest_sock *sock = obj;
+  struct ftest_sock_chan *conn;
+  struct ftest_sock_chan_addr peer;
+
+  if (ftest_sock_wait(sock, ftest_sock_chan_is_readable, K_FOREVER) < 0) {
+    return ftest_sock_fail(EAGAIN);
+  }
+
+  ftest_sock_chan_result_t res =
+      ftest_sock_chan_accept(sock->chan, &conn, &peer);
+
+  if (res != FTEST_SOCK_CHAN_OK) {
+    return ftest_sock_fail(ftest_sock_errno(res));
+  }
+
+  int fd = ftest_sock_new_fd(conn);
+
+  if (fd < 0) {
+    ftest_sock_chan_close(conn);
+    return -1;
+  }
+
+  ftest_sock_from_chan_addr(&peer, addr, addrlen);
+
+  return fd;
+}
+
+static int ftest_sock_getsockopt(void *obj, int level, int optname,
+                                 void *optval, socklen_t *optlen) {
+  ARG_UNUSED(obj);
+
+  if (level == SOL_SOCKET && optname == SO_ERROR && optval != NULL &&
+      optlen != NULL && *optlen >= sizeof(int)) {
+    /* Connections complete right away, so there is never a pending error */
+    *(int *)optval = 0;
+    *optlen = sizeof(int);
+    return 0;
+  }
+
+  return ftest_sock_fail(ENOPROTOOPT);
+}
+
+static int ftest_sock_setsockopt(void *obj, int level, int optname,
+                                 const void *optval, socklen_t optlen) {
+  struct ftest_sock *sock = obj;
+
+  if (level != SOL_SOCKET) {
+    /* Options of the protocols, like TCP_NODELAY, have nothing to tune */
+    return 0;
+  }
+
+  switch (optname) {
+  case SO_RCVTIMEO:
+  case SO_SNDTIMEO: {
+    if (optval == NULL || optlen < sizeof(struct zsock_timeval)) {
+      return ftest_sock_fail(EINVAL);
+    }
+
+    const struct zsock_timeval *tv = optval;
+    k_timeout_t timeout = K_FOREVER;
+
+    if (tv->tv_sec != 0 || tv->tv_usec != 0) {
+      timeout = K_USEC(tv->tv_sec * USEC_PER_SEC + tv->tv_usec);
+    }
+
+    if (optname == SO_RCVTIMEO) {
+      sock->rcv_timeout = timeout;
+    } else {
+      sock->snd_timeout = timeout;
+    }
+
+    return 0;
+  }
+
+  case SO_REUSEADDR:
+  case SO_REUSEPORT:
+  case SO_KEEPALIVE:
+  case SO_RCVBUF:
+  case SO_SNDBUF:
+    return 0;
+
+  default:
+    return ftest_sock_fail(ENOPROTOOPT);
+  }
+}
+
+static int ftest_sock_getpeername(void *obj, struct sockaddr *addr,
+                                  socklen_t *addrlen) {
+  struct ftest_sock *sock = obj;
+  struct ftest_sock_chan_addr peer;
+  ftest_sock_chan_result_t res = ftest_sock_chan_get_peer(sock->chan, &peer);
+
+  if (res != FTEST_SOCK_CHAN_OK) {
+    return ftest_sock_fail(ftest_sock_errno(res));
+  }
+
+  ftest_sock_from_chan_addr(&peer, addr, addrlen);
+
+  return 0;
+}
+
+static int ftest_sock_getsockname(void *obj, struct sockaddr *addr,
+                                  socklen_t *addrlen) {
+  struct ftest_sock *sock = obj;
+  struct ftest_sock_chan_addr local;
+  ftest_sock_chan_result_t res = ftest_sock_chan_get_local(sock->chan, &local);
+
+  if (res != FTEST_SOCK_CHAN_OK) {
+    return ftest_sock_fail(ftest_sock_errno(res));
+  }
+
+  ftest_sock_from_chan_addr(&local, addr, addrlen);
+
+  return 0;
+}
+
+static bool ftest_sock_is_supported(int family, int type, int proto) {
+  if (family != AF_INET) {
+    return false;
+  }
+
+  return (type == SOCK_STREAM && (proto == 0 || proto == IPPROTO_TCP)) ||
+         (type == SOCK_DGRAM && (proto == 0 || proto == IPPROTO_UDP));
+}
+
+static int ftest_sock_create(int family, int type, int proto) {
+  if (!ftest_sock_is_supported(family, type, proto)) {
+    return ftest_sock_fail(EAFNOSUPPORT);
+  }
+
+  struct ftest_sock_chan *chan = ftest_sock_chan_open(
+      type == SOCK_STREAM ? FTEST_SOCK_CHAN_STREAM : FTEST_SOCK_CHAN_DGRAM,
+      ftest_sock_default_ip, ftest_sock_sched_entity);
+
+  if (chan == NULL) {
+    return ftest_sock_fail(ENOMEM);
+  }
+
+  int fd = ftest_sock_new_fd(chan);
+
+  if (fd < 0) {
+    ftest_sock_chan_close(chan);
+  }
+
+  return fd;
+}
+
+/******************************************************************************
+ Driver API
+ ******************************************************************************/
+
+static void ftest_sock_iface_init(struct net_if *iface) {
+  const struct device *dev = net_if_get_device(iface);
+  const struct ftest_sock_offload_config *config = dev->config;
+  struct in_addr addr;
+  struct in_addr netmask;
+
+  net_if_socket_offload_set(iface, ftest_sock_create);
+
+  int res = net_addr_pton(AF_INET, config->ip, &addr);
+
+  if (res < 0) {
+    LOG_ERR("Invalid address: %s", config->ip);
+    return;
+  }
+
+  res = net_addr_pton(AF_INET, config->mask, &netmask);
+
+  if (res < 0) {
+    LOG_ERR("Invalid netmask: %s", config->mask);
+    return;
+  }
+
+  /* Instances of one entity library offset the host part of the address */
+  uint32_t instance = ftest_shed_get_instance(ftest_shed_get_current_entity());
+  uint32_t base_ip = ntohl(addr.s_addr);
+  uint32_t mask = ntohl(netmask.s_addr);
+
+  if (((base_ip + instance) & mask) != (base_ip & mask)) {
+    LOG_ERR("Instance %u does not fit into the subnet of %s/%s", instance,
+            config->ip, config->mask);
+    return;
+  }
+
+  addr.s_addr = htonl(base_ip + instance);
+
+  char ip[NET_IPV4_ADDR_LEN];
+  net_addr_ntop(AF_INET, &addr, ip, sizeof(ip));
+
+  /* Only kept for the applications which look the address up */
+  if (net_if_ipv4_addr_add(iface, &addr, NET_ADDR_MANUAL, 0) == NULL) {
+    LOG_ERR("Failed to add IPv4 address: %s", ip);
+    return;
+  }
+
+  if (!net_if_ipv4_set_netmask_by_addr(iface, &addr, &netmask)) {
+    LOG_ERR("Failed to set netmask: %s", config->mask);
+    return;
+  }
+
+  if (ftest_sock_sched_entity != NULL) {
+    return;
+  }
+
+  /* The interface is initialized as a part of the entity boot, so this is the
+   * only point where the scheduler knows which entity it belongs to. The
+   * channels do not delay anything, so the entity never runs concurrently
+   * with the others */
+  ftest_sock_sched_entity = ftest_shed_get_current_entity();
+  ftest_shed_declare_lookahead(0);
+
+  ftest_sock_default_ip = ntohl(addr.s_addr);
+
+  IRQ_CONNECT(CONFIG_FTEST_ETH_INPROC_DOORBELL_IRQ,
+              FTEST_SOCK_DOORBELL_IRQ_PRIO, ftest_sock_doorbell_isr, NULL, 0);
+  irq_enable(CONFIG_FTEST_ETH_INPROC_DOORBELL_IRQ);
+
+  if (ftest_shed_set_doorbell(ftest_sock_sched_entity,
+                              ftest_eth_doorbell_ring) < 0) {
+    LOG_ERR("Failed to set the socket doorbell");
+    return;
+  }
+
+  LOG_INF("Sockets offloaded on iface %p, address %s, netmask %s", iface, ip,
+          config->mask);
+}
+
+/******************************************************************************
+ Driver registration
+ ******************************************************************************/
+
+static const struct socket_op_vtable ftest_sock_vtable = {
+    .fd_vtable =
+        {
+            .read = ftest_sock_read,
+            .write = ftest_sock_write,
+            .close = ftest_sock_close,
+            .ioctl = ftest_sock_ioctl,
+        },
+    .bind = ftest_sock_bind,
+    .connect = ftest_sock_connect,
+    .listen = ftest_sock_listen,
+    .accept = ftest_sock_accept,
+    .sendto = ftest_sock_sendto,
+    .recvfrom = ftest_sock_recvfrom,
+    .getsockopt = ftest_sock_getsockopt,
+    .setsockopt = ftest_sock_setsockopt,
+    .getpeername = ftest_sock_getpeername,
+    .getsockname = ftest_sock_getsockname,
+};
+
+NET_SOCKET_OFFLOAD_REGISTER(ftest_sock_offload,
+                            CONFIG_NET_SOCKETS_OFFLOAD_PRIORITY, AF_INET,
+                            ftest_sock_is_supported, ftest_sock_create);
+
+static struct offloaded_if_api ftest_sock_iface_api = {
+    .iface_api.init = ftest_sock_iface_init,
+};
+
+#define FTEST_SOCK_OFFLOAD_INIT(inst)                                          \
+  static const struct ftest_sock_offload_config                                \
+      ftest_sock_offload_config_##inst = {                                     \
+          .ip = DT_PROP(DT_DRV_INST(inst), ip),                                \
+          .mask = DT_PROP(DT_DRV_INST(inst), mask),                            \
+  };                                                                           \
+                                                                               \
+  NET_DEVICE_DT_INST_OFFLOAD_DEFINE(                                           \
+      inst, NULL, NULL, NULL, &ftest_sock_offload_config_##inst,               \
+      CONFIG_ETH_INIT_PRIORITY, &ftest_sock_iface_api, NET_ETH_MTU);
+
+DT_INST_FOREACH_STATUS_OKAY(FTEST_SOCK_OFFLOAD_INIT)
@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * Doorbell of the in-process network interfaces of the entity, rung by the
+ * runner's scheduler when a frame is sent. Raises the doorbell interrupt once
+ * the entity reaches the given local virtual time.
+ */
+void ftest_eth_doorbell_ring(uint64_t time);
+
+/**
+ * Ring the doorbell of the entity itself, after the given virtual delay.
+ */
+void ftest_eth_doorbell_ring_after(uint64_t delay);
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+/** Properties of the emulated link of an in-process interface */
+struct ftest_eth_link_config {
+  uint32_t latency_us;
+  uint32_t bandwidth_kbps;
+  uint32_t jitter_us;
+  uint32_t loss_ppm;
+  uint32_t reorder_ppm;
+  uint32_t seed;
+};
+
+/** State of the link, only changed by the frames sent over it */
+struct ftest_eth_link {
+  const struct ftest_eth_link_config *config;
+  uint64_t rng;
+  /* The time at which the last frame sent is fully serialized */
+  uint64_t free_time;
+};
+
+/******************************************************************************
+ API
+ ******************************************************************************/
+
+/**
+ * Set up the link of an interface. Interfaces with the same seed still get
+ * pseudo-random sequences of their own, derived from their MAC address.
+ */
+void ftest_eth_link_init(struct ftest_eth_link *link,
+                         const struct ftest_eth_link_config *config,
+                         const uint8_t *mac, size_t mac_len);
+
+/**
+ * Emulate the link for a frame the interface sends. The frame is serialized
+ * after the ones sent before it, then propagates for latency-us and a random
+ * jitter. A reordered frame is held back for another latency-us and
+ * jitter-us, so the frames sent after it may overtake it.
+ *
+ * @param now Global virtual time at which the frame is sent
+ * @param len Length of the frame in bytes
+ * @param deliver_time Set to the global virtual time at which the frame
+ * reaches the receivers
+ * @return false if the frame is lost on the link
+ */
+bool ftest_eth_link_transmit(struct ftest_eth_link *link, uint64_t now,
+                             size_t len, uint64_t *deliver_time);
@@ -0,0 +1,19 @@
+#include "nsi_hw_scheduler.h"
+#include <stdint.h>
+
+/******************************************************************************
+ API
+ ******************************************************************************/
+
+uint64_t ftest_entity_exec_until(const uint64_t *horizon) {
+  uint64_t event_count = 0;
+
+  /* The scheduler only calls this when the entity has the earliest event, so
+   * at least that one is always executed */
+  do {
+    nsi_hws_one_event();
+    event_count++;
+  } while (nsi_hws_get_next_event_time() < *horizon);
+
+  return event_count;
+}
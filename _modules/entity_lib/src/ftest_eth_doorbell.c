@@ -0,0 +1,51 @@
+#include "ftest_eth_doorbell.h"
+#include "irq_ctrl.h"
+#include "nsi_hw_scheduler.h"
+#include "nsi_hws_models_if.h"
+#include <stdint.h>
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static uint64_t ftest_eth_doorbell_timer = NSI_NEVER;
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+static void ftest_eth_doorbell_triggered(void) {
+  ftest_eth_doorbell_timer = NSI_NEVER;
+  nsi_hws_find_next_event();
+
+  hw_irq_ctrl_set_irq(CONFIG_FTEST_ETH_INPROC_DOORBELL_IRQ);
+}
+
+NSI_HW_EVENT(ftest_eth_doorbell_timer, ftest_eth_doorbell_triggered, 900);
+
+/******************************************************************************
+ API
+ ******************************************************************************/
+
+void ftest_eth_doorbell_ring(uint64_t time) {
+  /* The HW scheduler cannot go back in time, a late ring fires right away.
+   * Only rings held while the entity was suspended can be late, as frames
+   * reach it no earlier than the lookahead after they were sent, which the
+   * parallel scheduler checks */
+  uint64_t now = nsi_hws_get_time();
+
+  if (time < now) {
+    time = now;
+  }
+
+  /* Only the earliest ring is kept, the receiver rings again by itself for
+   * the frames still on the link once it is woken up */
+  if (time < ftest_eth_doorbell_timer) {
+    ftest_eth_doorbell_timer = time;
+    nsi_hws_find_next_event();
+  }
+}
+
+void ftest_eth_doorbell_ring_after(uint64_t delay) {
+  ftest_eth_doorbell_ring(nsi_hws_get_time() + delay);
+}
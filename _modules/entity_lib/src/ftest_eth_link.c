@@ -0,0 +1,77 @@
+#include "ftest_eth_link.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#define FTEST_ETH_LINK_PPM 1000000u
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+/**
+ * Next number of the link's pseudo-random sequence (splitmix64), which only
+ * depends on the seed and on the frames sent so far.
+ */
+static uint64_t ftest_eth_link_random(struct ftest_eth_link *link) {
+  uint64_t z = (link->rng += 0x9e3779b97f4a7c15ull);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+  return z ^ (z >> 31);
+}
+
+static bool ftest_eth_link_chance(struct ftest_eth_link *link, uint32_t ppm) {
+  return ppm > 0 && ftest_eth_link_random(link) % FTEST_ETH_LINK_PPM < ppm;
+}
+
+/******************************************************************************
+ API
+ ******************************************************************************/
+
+void ftest_eth_link_init(struct ftest_eth_link *link,
+                         const struct ftest_eth_link_config *config,
+                         const uint8_t *mac, size_t mac_len) {
+  link->config = config;
+  link->free_time = 0;
+  link->rng = config->seed;
+
+  for (size_t i = 0; i < mac_len; i++) {
+    link->rng = (link->rng << 8 | link->rng >> 56) ^ mac[i];
+  }
+}
+
+bool ftest_eth_link_transmit(struct ftest_eth_link *link, uint64_t now,
+                             size_t len, uint64_t *deliver_time) {
+  const struct ftest_eth_link_config *config = link->config;
+  uint64_t sent_time = now > link->free_time ? now : link->free_time;
+
+  if (config->bandwidth_kbps > 0) {
+    uint64_t bits = (uint64_t)len * 8 * 1000;
+
+    sent_time += (bits + config->bandwidth_kbps - 1) / config->bandwidth_kbps;
+  }
+
+  link->free_time = sent_time;
+
+  if (ftest_eth_link_chance(link, config->loss_ppm)) {
+    return false;
+  }
+
+  *deliver_time = sent_time + config->latency_us;
+
+  if (config->jitter_us > 0) {
+    *deliver_time += ftest_eth_link_random(link) % (config->jitter_us + 1);
+  }
+
+  if (ftest_eth_link_chance(link, config->reorder_ppm)) {
+    *deliver_time += config->latency_us + config->jitter_us;
+  }
+
+  return true;
+}
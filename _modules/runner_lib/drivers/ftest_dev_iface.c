@@ -35,6 +35,7 @@ LOG_MODULE_REGISTER(gpio_iface);
 struct ftest_device_iface_config {
   const char *remote_label;
   const struct device *entity_dev;
+  uint32_t instance;
 };
 
 /******************************************************************************
@@ -42,10 +43,10 @@ struct ftest_device_iface_config {
  ******************************************************************************/
 
 static const struct device *
-ftest_iface_get_remote_device(const struct device *entity,
+ftest_iface_get_remote_device(const struct device *entity, uint32_t instance,
                               const char *dev_name) {
   const struct ftest_entity_api *ftest_entity_api =
-      ftest_entity_loader_get_api(entity);
+      ftest_entity_loader_get_instance_api(entity, instance);
 
   if (!ftest_entity_api) {
     LOG_ERR("Failed to get device_get_binding symbol from entity loader");
@@ -63,7 +64,7 @@ ftest_iface_get_remote_device(const struct device *entity,
 }
 
 static int
-ftest_iface_get_api(const struct device *entity_dev,
+ftest_iface_get_api(const struct device *entity_dev, uint32_t instance,
                     const struct ftest_entity_api **ftest_entity_api) {
 
   if (!entity_dev || !device_is_ready(entity_dev)) {
@@ -71,7 +72,8 @@ ftest_iface_get_api(const struct device *entity_dev,
     return -ENODEV;
   }
 
-  *ftest_entity_api = ftest_entity_loader_get_api(entity_dev);
+  *ftest_entity_api =
+      ftest_entity_loader_get_instance_api(entity_dev, instance);
 
   if (!*ftest_entity_api) {
     LOG_ERR("Failed to get device_get_binding symbol from entity loader");
@@ -94,15 +96,16 @@ static int device_iface_init(const struct device *dev) {
     return -ENODEV;
   }
 
-  data->remote_dev =
-      ftest_iface_get_remote_device(config->entity_dev, config->remote_label);
+  data->remote_dev = ftest_iface_get_remote_device(
+      config->entity_dev, config->instance, config->remote_label);
 
   if (!data->remote_dev) {
     LOG_ERR("Failed to get remote device %s", config->remote_label);
     return -ENODEV;
   }
 
-  int ret = ftest_iface_get_api(config->entity_dev, &data->entity_api);
+  int ret = ftest_iface_get_api(config->entity_dev, config->instance,
+                                &data->entity_api);
 
   if (ret < 0) {
     LOG_ERR("Failed to get entity API: %d", ret);
@@ -135,6 +138,10 @@ ftest_device_iface_get_remote(const struct device *iface_dev) {
     k_panic();
   }
 
+  /* Every access to a remote device may change the timeline of its entity */
+  const struct ftest_device_iface_config *config = iface_dev->config;
+  ftest_entity_loader_touch_instance(config->entity_dev, config->instance);
+
   return *remote_iface;
 }
 
@@ -148,11 +155,16 @@ ftest_device_iface_get_remote(const struct device *iface_dev) {
       "The parent node of \"" STRINGIFY(                                       \
           DT_DRV_COMPAT) "\" driver shall necessarily be an instance of "      \
                          "\"" STRINGIFY(DT_PARENT_COMPAT) "\"");               \
+  static_assert(DT_INST_PROP(inst, instance) <                                 \
+                    DT_PROP(DT_INST_PARENT(inst), instances),                  \
+                "The instance of \"" STRINGIFY(                                \
+                    DT_DRV_COMPAT) "\" exceeds the instances of its parent");  \
                                                                                \
   static const struct ftest_device_iface_config                                \
       ftest_device_iface_config_##inst = {                                     \
           .remote_label = DT_INST_PROP(inst, remote_label),                    \
           .entity_dev = DEVICE_DT_GET(DT_INST_PARENT(inst)),                   \
+          .instance = DT_INST_PROP(inst, instance),                            \
   };                                                                           \
                                                                                \
   static struct ftest_remote_dev_iface ftest_device_iface_data_##inst = {0};   \
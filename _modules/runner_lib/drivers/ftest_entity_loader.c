@@ -2,6 +2,7 @@
 #include "ftest_dl.h"
 #include "ftest_entity_api.h"
 #include "ftest_sched.h"
+#include "zephyr/init.h"
 #include "zephyr/kernel.h"
 #include "zephyr/logging/log.h"
 #include <errno.h>
@@ -13,6 +14,9 @@
 
 #define DT_DRV_COMPAT ftest_entity_loader
 
+/* Room for the device name and the index of the instance */
+#define FTEST_ENTITY_LOADER_NAME_LEN 48
+
 /******************************************************************************
  Module configuration
  ******************************************************************************/
@@ -23,21 +27,49 @@ LOG_MODULE_REGISTER(entity_loader);
  Structures
  ******************************************************************************/
 
-struct ftest_entity_loader_data {
+/** One copy of the entity library, scheduled as an entity of its own */
+struct ftest_entity_loader_instance {
   void *entity_handle;
   struct ftest_entity_api *api;
   struct ftest_shed_entity_config entity_config;
+  char name[FTEST_ENTITY_LOADER_NAME_LEN];
+};
+
+struct ftest_entity_loader_data {
+  struct ftest_entity_loader_instance *instances;
 };
 
 struct ftest_entity_loader_api {
-  void *(*get_sym)(const struct device *dev, const char *func_name);
+  void *(*get_sym)(const struct device *dev, uint32_t instance,
+                   const char *func_name);
 };
 
 /******************************************************************************
  Utilities
  ******************************************************************************/
 
+static struct ftest_entity_loader_instance *
+entity_loader_get_instance(const struct device *dev, uint32_t instance) {
+  const struct ftest_entity_loader_config *config = dev->config;
+  struct ftest_entity_loader_data *data = dev->data;
+
+  if (!data || !data->instances || instance >= config->instance_count) {
+    return NULL;
+  }
+
+  return &data->instances[instance];
+}
+
+static void entity_loader_close_instance(
+    struct ftest_entity_loader_instance *instance) {
+  if (instance->entity_handle) {
+    ftest_dl_close_lib(instance->entity_handle);
+    instance->entity_handle = NULL;
+  }
+}
+
 static void *entity_loader_get_sym_close_on_fail(const struct device *dev,
+                                                 uint32_t instance,
                                                  const char *sym_name) {
   const struct ftest_entity_loader_api *api = dev->api;
   if (!api || !api->get_sym) {
@@ -45,70 +77,102 @@ static void *entity_loader_get_sym_close_on_fail(const struct device *dev,
     return NULL;
   }
 
-  void *symbol = api->get_sym(dev, sym_name);
+  void *symbol = api->get_sym(dev, instance, sym_name);
 
   if (!symbol) {
     LOG_ERR("Failed to find symbol '%s' in entity library", sym_name);
-    struct ftest_entity_loader_data *data = dev->data;
-    if (data->entity_handle) {
-      ftest_dl_close_lib(data->entity_handle);
-      data->entity_handle = NULL;
-    }
+    entity_loader_close_instance(entity_loader_get_instance(dev, instance));
   }
 
   return symbol;
 }
 
-/******************************************************************************
- Driver implementation
- ******************************************************************************/
-
-static int entity_loader_init(const struct device *dev) {
+/**
+ * Load one instance of the entity library and add it to the schedule. Every
+ * instance after the first is loaded from a copy of the library.
+ */
+static int entity_loader_load_instance(const struct device *dev,
+                                       uint32_t index) {
   const struct ftest_entity_loader_api *api = dev->api;
   const struct ftest_entity_loader_config *config = dev->config;
-  struct ftest_entity_loader_data *data = dev->data;
-
-  if (!config || !config->entity_path) {
-    return -EINVAL;
+  struct ftest_entity_loader_instance *instance =
+      entity_loader_get_instance(dev, index);
+
+  if (config->instance_count > 1) {
+    snprintf(instance->name, sizeof(instance->name), "%s[%u]", dev->name,
+             index);
+    instance->entity_config.name = instance->name;
+  } else {
+    instance->entity_config.name = dev->name;
   }
 
-  data->entity_handle = ftest_dl_open_lib(config->entity_path);
+  instance->entity_config.instance = index;
 
-  if (data->entity_handle == NULL) {
+  uint64_t load_start_ns = ftest_shed_get_wall_time_ns();
+  instance->entity_handle = ftest_dl_open_lib(config->entity_path);
+  uint64_t resolve_start_ns = ftest_shed_get_wall_time_ns();
+
+  if (instance->entity_handle == NULL) {
     return -ENOENT;
   }
 
+  instance->entity_config.load_profile.dlopen_ns =
+      resolve_start_ns - load_start_ns;
+
   struct {
     void *sym_assign;
     const char *sym_name;
   } symbols[] = {
-      {&data->entity_config.init_func, "nsi_init"},
-      {&data->entity_config.exec_func, "nsi_hws_one_event"},
-      {&data->entity_config.find_next_event, "nsi_hws_find_next_event"},
-      {&data->entity_config.get_next_event_time, "nsi_hws_get_next_event_time"},
+      {&instance->entity_config.init_func, "nsi_init"},
+      {&instance->entity_config.exec_func, "nsi_hws_one_event"},
+      {&instance->entity_config.find_next_event, "nsi_hws_find_next_event"},
+      {&instance->entity_config.get_next_event_time,
+       "nsi_hws_get_next_event_time"},
+      {&instance->entity_config.get_time, "nsi_hws_get_time"},
   };
 
   for (size_t i = 0; i < ARRAY_SIZE(symbols); i++) {
     void **sym_ptr = symbols[i].sym_assign;
-    *sym_ptr = entity_loader_get_sym_close_on_fail(dev, symbols[i].sym_name);
+    *sym_ptr =
+        entity_loader_get_sym_close_on_fail(dev, index, symbols[i].sym_name);
     if (!*sym_ptr) {
       return -ENOENT;
     }
   }
 
-  int status = ftest_add_entity_to_schedule(&data->entity_config);
+  /* Optional - entities built without it are dispatched one event at a time */
+  instance->entity_config.exec_until_func =
+      api->get_sym(dev, index, "ftest_entity_exec_until");
+
+  instance->entity_config.load_profile.resolve_ns =
+      ftest_shed_get_wall_time_ns() - resolve_start_ns;
+
+  int status = ftest_add_entity_to_schedule(&instance->entity_config);
   if (status < 0) {
     LOG_ERR("Failed to add entity to scheduler: %d", status);
-    ftest_dl_close_lib(data->entity_handle);
+    entity_loader_close_instance(instance);
     return status;
   }
 
+  return 0;
+}
+
+/**
+ * Wait until the scheduler has initialized a loaded instance, and take its
+ * API.
+ */
+static int entity_loader_await_instance(const struct device *dev,
+                                        uint32_t index) {
+  const struct ftest_entity_loader_api *api = dev->api;
+  struct ftest_entity_loader_instance *instance =
+      entity_loader_get_instance(dev, index);
+
   struct ftest_entity_api *(*get_api_func)(void) =
-      api->get_sym(dev, "ftest_entity_api_get");
+      api->get_sym(dev, index, "ftest_entity_api_get");
 
   if (!get_api_func) {
     LOG_ERR("Failed to find 'ftest_entity_api_get' in entity library");
-    ftest_dl_close_lib(data->entity_handle);
+    entity_loader_close_instance(instance);
     return -ENOENT;
   }
 
@@ -116,7 +180,7 @@ static int entity_loader_init(const struct device *dev) {
   while (get_api_func() == NULL) {
     if (--retry_count == 0) {
       LOG_ERR("Entity API not initialized after retries");
-      ftest_dl_close_lib(data->entity_handle);
+      entity_loader_close_instance(instance);
       return -EAGAIN;
     }
 
@@ -124,24 +188,60 @@ static int entity_loader_init(const struct device *dev) {
     k_msleep(100);
   }
 
-  data->api = get_api_func();
+  instance->api = get_api_func();
 
-  if (!data->api || !data->api->initialized) {
-    LOG_ERR("Unexpected entity API state: %p", data->api);
-    ftest_dl_close_lib(data->entity_handle);
+  if (!instance->api || !instance->api->initialized) {
+    LOG_ERR("Unexpected entity API state: %p", instance->api);
+    entity_loader_close_instance(instance);
     return -ENOSYS;
   }
 
-  LOG_INF("Entity library loaded successfully: %s", config->entity_path);
+  return 0;
+}
+
+/******************************************************************************
+ Driver implementation
+ ******************************************************************************/
+
+static int entity_loader_init(const struct device *dev) {
+  const struct ftest_entity_loader_config *config = dev->config;
+
+  if (!config || !config->entity_path || config->instance_count == 0) {
+    return -EINVAL;
+  }
+
+  /* All instances are scheduled before waiting for any of them, so they are
+   * initialized in one go */
+  for (uint32_t i = 0; i < config->instance_count; i++) {
+    int status = entity_loader_load_instance(dev, i);
+    if (status < 0) {
+      return status;
+    }
+  }
+
+  for (uint32_t i = 0; i < config->instance_count; i++) {
+    int status = entity_loader_await_instance(dev, i);
+    if (status < 0) {
+      return status;
+    }
+  }
+
+  LOG_INF("Entity library loaded successfully: %s (%u instances)",
+          config->entity_path, config->instance_count);
 
   return 0;
 }
 
 static void *entity_loader_get_sym(const struct device *dev,
-                                   const char *sym_name) {
-  struct ftest_entity_loader_data *data = dev->data;
+                                   uint32_t instance, const char *sym_name) {
+  struct ftest_entity_loader_instance *entity =
+      entity_loader_get_instance(dev, instance);
+
+  if (entity == NULL) {
+    return NULL;
+  }
 
-  void *symbol = ftest_dl_get_sym(data->entity_handle, sym_name);
+  void *symbol = ftest_dl_get_sym(entity->entity_handle, sym_name);
 
   if (symbol == NULL) {
     return NULL;
@@ -154,8 +254,20 @@ static void *entity_loader_get_sym(const struct device *dev,
  Driver API
  ******************************************************************************/
 
+uint32_t ftest_entity_loader_get_instance_count(const struct device *dev) {
+  const struct ftest_entity_loader_config *config = dev->config;
+
+  return config->instance_count;
+}
+
 void *ftest_entity_loader_get_sym(const struct device *dev,
                                   const char *sym_name) {
+  return ftest_entity_loader_get_instance_sym(dev, 0, sym_name);
+}
+
+void *ftest_entity_loader_get_instance_sym(const struct device *dev,
+                                           uint32_t instance,
+                                           const char *sym_name) {
   const struct ftest_entity_loader_api *api = dev->api;
 
   if (!api || !api->get_sym) {
@@ -163,20 +275,128 @@ void *ftest_entity_loader_get_sym(const struct device *dev,
     return NULL;
   }
 
-  return api->get_sym(dev, sym_name);
+  return api->get_sym(dev, instance, sym_name);
 }
 
-struct ftest_entity_api *ftest_entity_loader_get_api(const struct device *dev) {
+int ftest_entity_loader_suspend(const struct device *dev) {
+  const struct ftest_entity_loader_config *config = dev->config;
+  struct ftest_entity_loader_data *data = dev->data;
+
+  for (uint32_t i = 0; i < config->instance_count; i++) {
+    int status = ftest_shed_suspend_entity(&data->instances[i].entity_config);
+
+    if (status < 0) {
+      LOG_ERR("Failed to suspend entity %s: %d",
+              data->instances[i].entity_config.name, status);
+      return status;
+    }
+  }
+
+  return 0;
+}
+
+int ftest_entity_loader_resume(const struct device *dev) {
+  const struct ftest_entity_loader_config *config = dev->config;
   struct ftest_entity_loader_data *data = dev->data;
 
-  if (!data || !data->api) {
+  for (uint32_t i = 0; i < config->instance_count; i++) {
+    int status = ftest_shed_resume_entity(&data->instances[i].entity_config);
+
+    if (status < 0) {
+      LOG_ERR("Failed to resume entity %s: %d",
+              data->instances[i].entity_config.name, status);
+      return status;
+    }
+  }
+
+  return 0;
+}
+
+int ftest_entity_loader_unschedule(const struct device *dev) {
+  const struct ftest_entity_loader_config *config = dev->config;
+  struct ftest_entity_loader_data *data = dev->data;
+
+  for (uint32_t i = 0; i < config->instance_count; i++) {
+    int status =
+        ftest_remove_entity_from_schedule(&data->instances[i].entity_config);
+
+    if (status < 0) {
+      LOG_ERR("Failed to remove entity %s from schedule: %d",
+              data->instances[i].entity_config.name, status);
+      return status;
+    }
+  }
+
+  return 0;
+}
+
+int ftest_entity_loader_touch(const struct device *dev) {
+  return ftest_entity_loader_touch_instance(dev, 0);
+}
+
+int ftest_entity_loader_touch_instance(const struct device *dev,
+                                       uint32_t instance) {
+  struct ftest_entity_loader_instance *entity =
+      entity_loader_get_instance(dev, instance);
+
+  if (!entity || !entity->entity_handle) {
+    LOG_ERR("Entity library not loaded");
+    return -ENODEV;
+  }
+
+  return ftest_shed_entity_touched(&entity->entity_config);
+}
+
+struct ftest_entity_api *ftest_entity_loader_get_api(const struct device *dev) {
+  return ftest_entity_loader_get_instance_api(dev, 0);
+}
+
+struct ftest_entity_api *
+ftest_entity_loader_get_instance_api(const struct device *dev,
+                                     uint32_t instance) {
+  struct ftest_entity_loader_instance *entity =
+      entity_loader_get_instance(dev, instance);
+
+  if (!entity || !entity->api) {
     LOG_ERR("Entity loader API not initialized");
     return NULL;
   }
 
-  return data->api;
+  return entity->api;
 }
 
+/******************************************************************************
+ Library prefetch
+ ******************************************************************************/
+
+#if CONFIG_FTEST_ENTITY_LOADER_PREFETCH &&                                    \
+    DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
+
+#define FTEST_ENTITY_LOADER_PATH(inst) DT_INST_PROP(inst, entity_path),
+
+/**
+ * The loaders open the libraries one after another, and the dynamic linker
+ * does not relocate libraries concurrently anyway. Reading all the library
+ * files in the background as early as possible lets the disk I/O of every
+ * library overlap with the loading of the ones before it.
+ */
+static int entity_loader_prefetch(void) {
+  static const char *const paths[] = {
+      DT_INST_FOREACH_STATUS_OKAY(FTEST_ENTITY_LOADER_PATH)};
+
+  for (size_t i = 0; i < ARRAY_SIZE(paths); i++) {
+    if (ftest_dl_prefetch_lib(paths[i]) < 0) {
+      LOG_WRN("Failed to prefetch entity library: %s", paths[i]);
+    }
+  }
+
+  return 0;
+}
+
+SYS_INIT(entity_loader_prefetch, PRE_KERNEL_1, 0);
+
+#endif
+
 /******************************************************************************
  Driver registration
  ******************************************************************************/
@@ -184,9 +404,15 @@ struct ftest_entity_api *ftest_entity_loader_get_api(const struct device *dev) {
 #define FTEST_ENTITY_LOADER_INIT(inst)                                         \
   static struct ftest_entity_loader_config entity_loader_config_##inst = {     \
       .entity_path = DT_INST_PROP(inst, entity_path),                          \
+      .instance_count = DT_INST_PROP(inst, instances),                         \
   };                                                                           \
                                                                                \
-  static struct ftest_entity_loader_data entity_loader_data_##inst = {0};      \
+  static struct ftest_entity_loader_instance                                   \
+      entity_loader_instances_##inst[DT_INST_PROP(inst, instances)];           \
+                                                                               \
+  static struct ftest_entity_loader_data entity_loader_data_##inst = {         \
+      .instances = entity_loader_instances_##inst,                             \
+  };                                                                           \
                                                                                \
   static const struct ftest_entity_loader_api entity_loader_api_##inst = {     \
       .get_sym = entity_loader_get_sym,                                        \
@@ -0,0 +1,23 @@
+#include "ftest_jobs.h"
+#include "zephyr/ztest.h"
+
+/******************************************************************************
+ Test sharding
+
+ Every FTEST job runs the whole suite, but only the tests it owns - the rest
+ are reported as skipped, and run by one of the other jobs.
+ ******************************************************************************/
+
+static unsigned ftest_jobs_test_index;
+
+static void ftest_jobs_shard_before_each(const struct ztest_unit_test *test,
+                                         void *data) {
+  ARG_UNUSED(test);
+  ARG_UNUSED(data);
+
+  if (!ftest_jobs_owns_test(ftest_jobs_test_index++)) {
+    ztest_test_skip();
+  }
+}
+
+ZTEST_RULE(ftest_jobs_shard, ftest_jobs_shard_before_each, NULL);
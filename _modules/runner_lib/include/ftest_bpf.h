@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+/* Most instructions a program may have, as in the Linux kernel */
+#define FTEST_BPF_MAX_INSNS 4096
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+/** A classic BPF instruction, as printed by `tcpdump -ddd` */
+struct ftest_bpf_insn {
+  uint16_t code;
+  uint8_t jt;
+  uint8_t jf;
+  uint32_t k;
+};
+
+struct ftest_bpf_prog {
+  struct ftest_bpf_insn *insns;
+  uint32_t len;
+};
+
+/******************************************************************************
+ API
+
+ An interpreter of classic BPF programs, the bytecode tcpdump and libpcap
+ compile their filter expressions to, run on Ethernet frames. Programs are
+ validated when loaded, so running them needs no checks besides the bounds
+ of the frame.
+ ******************************************************************************/
+
+/**
+ * Load a program from a file in the format of `tcpdump -ddd`: the number of
+ * instructions, followed by the code, jt, jf and k of every instruction, all
+ * in decimal and separated by whitespace.
+ *
+ * @return 0 on success, -1 with errno set otherwise - EINVAL if the file is
+ * not a valid program
+ */
+int ftest_bpf_load(struct ftest_bpf_prog *prog, const char *path);
+
+/**
+ * Check that a program only jumps forward within itself, only uses the
+ * scratch memory it has, never divides by a constant zero and always ends
+ * with a return.
+ *
+ * @return 0 if the program is valid, -1 with errno set to EINVAL otherwise
+ */
+int ftest_bpf_validate(const struct ftest_bpf_insn *insns, uint32_t len);
+
+/**
+ * Run a valid program on a frame.
+ *
+ * @return The number of bytes of the frame to keep, 0 to drop it - as is
+ * returned when the program reads past the end of the frame or divides by zero
+ */
+uint32_t ftest_bpf_run(const struct ftest_bpf_prog *prog, const uint8_t *frame,
+                       uint32_t len);
+
+void ftest_bpf_free(struct ftest_bpf_prog *prog);
@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+
+/**
+ * Take the checkpoint requested with -ftest_checkpoint_at=<us>, if the
+ * simulation is about to execute an event at or after that virtual time.
+ *
+ * Shall only be called by the scheduler between dispatches, when none of the
+ * entities is executing.
+ */
+void ftest_checkpoint_poll(uint64_t next_event_time);
@@ -7,13 +7,62 @@
 
 struct ftest_entity_loader_config {
   const char *entity_path;
+  uint32_t instance_count;
 };
 
 /******************************************************************************
  API
  ******************************************************************************/
 
+/**
+ * Get the number of instances of the entity library the loader runs, each an
+ * entity of its own with its own global state.
+ */
+uint32_t ftest_entity_loader_get_instance_count(const struct device *dev);
+
+/**
+ * Get a symbol of the first instance of the entity library.
+ */
 void *ftest_entity_loader_get_sym(const struct device *dev,
                                   const char *sym_name);
 
-struct ftest_entity_api *ftest_entity_loader_get_api(const struct device *dev);
\ No newline at end of file
+void *ftest_entity_loader_get_instance_sym(const struct device *dev,
+                                           uint32_t instance,
+                                           const char *sym_name);
+
+/**
+ * Get the API of the first instance of the entity.
+ */
+struct ftest_entity_api *ftest_entity_loader_get_api(const struct device *dev);
+
+struct ftest_entity_api *
+ftest_entity_loader_get_instance_api(const struct device *dev,
+                                     uint32_t instance);
+
+/**
+ * Stop dispatching the events of all instances of the entity, e.g. for test
+ * cases that do not use it. Their virtual clocks stand still until they are
+ * resumed.
+ */
+int ftest_entity_loader_suspend(const struct device *dev);
+
+/**
+ * Resume dispatching the events of all instances of a suspended entity.
+ */
+int ftest_entity_loader_resume(const struct device *dev);
+
+/**
+ * Remove all instances of the entity from the schedule for the rest of the
+ * run.
+ */
+int ftest_entity_loader_unschedule(const struct device *dev);
+
+/**
+ * Mark the first instance of the entity as touched by the runner, so the
+ * scheduler re-evaluates the time of its next event after the current
+ * dispatch.
+ */
+int ftest_entity_loader_touch(const struct device *dev);
+
+int ftest_entity_loader_touch_instance(const struct device *dev,
+                                       uint32_t instance);
@@ -0,0 +1,30 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Split the test run into the number of jobs requested with -ftest_jobs=<n>.
+ *
+ * Shall be called at the very start of the process, before any thread is
+ * created. Forks one child per job; the children return from this function
+ * and run the simulation, while the parent waits for them, prints their logs
+ * and exits with the combined result. Returns immediately when no jobs were
+ * requested.
+ */
+void ftest_jobs_fork(int argc, char *argv[]);
+
+/**
+ * Check whether the test with the given index (in the order in which the
+ * tests are executed) shall run in this process.
+ */
+bool ftest_jobs_owns_test(unsigned test_index);
+
+/**
+ * Get the name under which this process writes an output file, so the jobs
+ * do not overwrite each other's: the name itself when the run is not split,
+ * otherwise with the index of the job before its extension (e.g.
+ * capture_2.pcapng).
+ *
+ * @return Either name or buf, which holds size bytes
+ */
+const char *ftest_jobs_file_name(const char *name, char *buf, size_t size);
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+enum ftest_pcap_direction {
+  FTEST_PCAP_INBOUND = 1,
+  FTEST_PCAP_OUTBOUND = 2,
+};
+
+/******************************************************************************
+ API
+
+ The runner's packet capture, a single pcapng file with an interface for every
+ interface of the entities on the in-process network. Blocks are buffered in
+ memory and written to the file by a host thread, so writing a frame never
+ waits for the disk unless both buffers are full. As a flight recorder, only
+ the most recent frames are kept in memory, and written to the file only if
+ the runner fails.
+ ******************************************************************************/
+
+/**
+ * Describe an interface in the capture.
+ *
+ * @param name Name of the interface, as shown by the capture tools
+ * @param description Description of the interface, NULL for none
+ * @param mac MAC address of the interface
+ * @return The number of the interface in the capture, -1 if the capture could
+ * not be opened
+ */
+int ftest_pcap_add_interface(const char *name, const char *description,
+                             const uint8_t *mac);
+
+/**
+ * Add a frame to the capture.
+ *
+ * @param interface The interface, as returned by ftest_pcap_add_interface()
+ * @param direction Whether the interface sent or received the frame
+ * @param time The global virtual time of the frame, in microseconds
+ */
+void ftest_pcap_write_frame(int interface, enum ftest_pcap_direction direction,
+                            const uint8_t *frame, uint32_t len, uint64_t time);
@@ -4,17 +4,95 @@
  Structures
  ******************************************************************************/
 
+#include "ftest_sched_entity.h"
 #include <stdint.h>
+
+/** Wall-clock cost of loading an entity library, for the boot profile */
+struct ftest_shed_load_profile {
+  uint64_t dlopen_ns;
+  uint64_t resolve_ns;
+};
+
 struct ftest_shed_entity_config {
+  const char *name;
+  /** Index among the instances loaded from the same library by one loader */
+  uint32_t instance;
+  struct ftest_shed_load_profile load_profile;
+
   void (*init_func)(int argc, char *argv[]);
   void (*exec_func)(void);
   void (*find_next_event)(void);
   uint64_t (*get_next_event_time)(void);
+  uint64_t (*get_time)(void);
+
+  /**
+   * Optional. Execute the events of the entity until the next one is due at,
+   * or after the given horizon (in the entity's time). The horizon is re-read
+   * before every event. Returns the number of executed events.
+   */
+  uint64_t (*exec_until_func)(const uint64_t *horizon);
+
+  /** Set by the scheduler while the entity is in the schedule */
+  struct ftest_shed_entity_entry *entry;
 };
 
 /******************************************************************************
  API
  ******************************************************************************/
 
+uint64_t ftest_shed_get_wall_time_ns(void);
+
+/**
+ * Get the name of an entity, NULL if it has none.
+ */
+const char *
+ftest_shed_get_entity_name(const struct ftest_shed_entity_entry *entity);
+
+/**
+ * Add an entity to the schedule. It is initialized before the next dispatch.
+ *
+ * @return 0 on success, -EINVAL if the configuration lacks a function, -EEXIST
+ * if the entity is already scheduled
+ */
 int ftest_add_entity_to_schedule(
     struct ftest_shed_entity_config *entity_config);
+
+/**
+ * Remove the entity from the schedule for good. Its events are not dispatched
+ * anymore, but the library stays loaded, as its threads cannot be torn down.
+ * Its network ports and sockets stay open, but do not wake it up anymore.
+ *
+ * @return 0 on success, -ENOENT if the entity is not scheduled, -EPERM for the
+ * runner
+ */
+int ftest_remove_entity_from_schedule(
+    const struct ftest_shed_entity_config *entity_config);
+
+/**
+ * Stop dispatching the events of an initialized entity. The virtual clock of
+ * the entity stands still until it is resumed.
+ *
+ * @return 0 on success, -ENOENT if the entity is not scheduled, -EPERM for the
+ * runner, -EAGAIN if the entity is not initialized yet
+ */
+int ftest_shed_suspend_entity(
+    const struct ftest_shed_entity_config *entity_config);
+
+/**
+ * Put a suspended entity back into the schedule. Its pending events are
+ * shifted by the time it spent suspended.
+ *
+ * @return 0 on success, -ENOENT if the entity is not scheduled
+ */
+int ftest_shed_resume_entity(
+    const struct ftest_shed_entity_config *entity_config);
+
+/**
+ * Notify the scheduler that the timeline of an entity was changed from outside
+ * of its own execution (e.g. the runner poked one of its devices), so its next
+ * event time has to be re-evaluated before the next dispatch.
+ *
+ * @return 0 on success, -ENOENT if the entity is not scheduled
+ */
+int ftest_shed_entity_touched(
+    const struct ftest_shed_entity_config *entity_config);
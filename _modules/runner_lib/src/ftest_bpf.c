@@ -0,0 +1,398 @@
+#include "ftest_bpf.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#define BPF_CLASS(code) ((code) & 0x07)
+#define BPF_LD 0x00
+#define BPF_LDX 0x01
+#define BPF_ST 0x02
+#define BPF_STX 0x03
+#define BPF_ALU 0x04
+#define BPF_JMP 0x05
+#define BPF_RET 0x06
+#define BPF_MISC 0x07
+
+#define BPF_SIZE(code) ((code) & 0x18)
+#define BPF_W 0x00
+#define BPF_H 0x08
+#define BPF_B 0x10
+
+#define BPF_MODE(code) ((code) & 0xe0)
+#define BPF_IMM 0x00
+#define BPF_ABS 0x20
+#define BPF_IND 0x40
+#define BPF_MEM 0x60
+#define BPF_LEN 0x80
+#define BPF_MSH 0xa0
+
+#define BPF_OP(code) ((code) & 0xf0)
+#define BPF_ADD 0x00
+#define BPF_SUB 0x10
+#define BPF_MUL 0x20
+#define BPF_DIV 0x30
+#define BPF_OR 0x40
+#define BPF_AND 0x50
+#define BPF_LSH 0x60
+#define BPF_RSH 0x70
+#define BPF_NEG 0x80
+#define BPF_MOD 0x90
+#define BPF_XOR 0xa0
+
+#define BPF_JA 0x00
+#define BPF_JEQ 0x10
+#define BPF_JGT 0x20
+#define BPF_JGE 0x30
+#define BPF_JSET 0x40
+
+#define BPF_SRC(code) ((code) & 0x08)
+#define BPF_K 0x00
+#define BPF_X 0x08
+
+#define BPF_RVAL(code) ((code) & 0x18)
+#define BPF_A 0x10
+
+#define BPF_MISCOP(code) ((code) & 0xf8)
+#define BPF_TAX 0x00
+#define BPF_TXA 0x80
+
+#define BPF_MEMWORDS 16
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+/**
+ * Load a big-endian value of the given size from a frame.
+ *
+ * @return Whether the value lies within the frame
+ */
+static bool ftest_bpf_load_frame(const uint8_t *frame, uint32_t len,
+                                 uint32_t offset, uint16_t size,
+                                 uint32_t *value) {
+  uint32_t width = size == BPF_W ? 4 : size == BPF_H ? 2 : 1;
+
+  if (offset > len || len - offset < width) {
+    return false;
+  }
+
+  *value = 0;
+  for (uint32_t i = 0; i < width; i++) {
+    *value = (*value << 8) | frame[offset + i];
+  }
+
+  return true;
+}
+
+static bool ftest_bpf_valid_load(uint16_t code, uint32_t k) {
+  switch (BPF_MODE(code)) {
+  case BPF_IMM:
+  case BPF_LEN:
+    return BPF_SIZE(code) == BPF_W;
+  case BPF_ABS:
+  case BPF_IND:
+    return BPF_CLASS(code) == BPF_LD && BPF_SIZE(code) != 0x18;
+  case BPF_MEM:
+    return BPF_SIZE(code) == BPF_W && k < BPF_MEMWORDS;
+  case BPF_MSH:
+    return BPF_CLASS(code) == BPF_LDX && BPF_SIZE(code) == BPF_B;
+  default:
+    return false;
+  }
+}
+
+static bool ftest_bpf_valid_alu(uint16_t code, uint32_t k) {
+  switch (BPF_OP(code)) {
+  case BPF_ADD:
+  case BPF_SUB:
+  case BPF_MUL:
+  case BPF_OR:
+  case BPF_AND:
+  case BPF_LSH:
+  case BPF_RSH:
+  case BPF_XOR:
+  case BPF_NEG:
+    return true;
+  case BPF_DIV:
+  case BPF_MOD:
+    return BPF_SRC(code) == BPF_X || k != 0;
+  default:
+    return false;
+  }
+}
+
+/**
+ * Check that the targets of a jump lie within the program, which also rules
+ * out loops as the offsets are unsigned.
+ */
+static bool ftest_bpf_valid_jump(const struct ftest_bpf_insn *insn,
+                                 uint32_t remaining) {
+  switch (BPF_OP(insn->code)) {
+  case BPF_JA:
+    return insn->k < remaining;
+  case BPF_JEQ:
+  case BPF_JGT:
+  case BPF_JGE:
+  case BPF_JSET:
+    return insn->jt < remaining && insn->jf < remaining;
+  default:
+    return false;
+  }
+}
+
+/******************************************************************************
+ API
+ ******************************************************************************/
+
+int ftest_bpf_validate(const struct ftest_bpf_insn *insns, uint32_t len) {
+  if (len == 0 || len > FTEST_BPF_MAX_INSNS ||
+      BPF_CLASS(insns[len - 1].code) != BPF_RET) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (uint32_t pc = 0; pc < len; pc++) {
+    const struct ftest_bpf_insn *insn = &insns[pc];
+    bool valid;
+
+    switch (BPF_CLASS(insn->code)) {
+    case BPF_LD:
+    case BPF_LDX:
+      valid = ftest_bpf_valid_load(insn->code, insn->k);
+      break;
+    case BPF_ST:
+    case BPF_STX:
+      valid = insn->k < BPF_MEMWORDS;
+      break;
+    case BPF_ALU:
+      valid = ftest_bpf_valid_alu(insn->code, insn->k);
+      break;
+    case BPF_JMP:
+      valid = ftest_bpf_valid_jump(insn, len - pc - 1);
+      break;
+    case BPF_RET:
+      valid = BPF_RVAL(insn->code) == BPF_K || BPF_RVAL(insn->code) == BPF_A;
+      break;
+    default:
+      valid = BPF_MISCOP(insn->code) == BPF_TAX ||
+              BPF_MISCOP(insn->code) == BPF_TXA;
+      break;
+    }
+
+    if (!valid) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int ftest_bpf_load(struct ftest_bpf_prog *prog, const char *path) {
+  FILE *file = fopen(path, "r");
+  uint32_t len;
+
+  if (file == NULL) {
+    return -1;
+  }
+
+  if (fscanf(file, "%u", &len) != 1 || len == 0 ||
+      len > FTEST_BPF_MAX_INSNS) {
+    fclose(file);
+    errno = EINVAL;
+    return -1;
+  }
+
+  struct ftest_bpf_insn *insns = calloc(len, sizeof(*insns));
+
+  if (insns == NULL) {
+    fclose(file);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < len; i++) {
+    unsigned code, jt, jf, k;
+
+    if (fscanf(file, "%u %u %u %u", &code, &jt, &jf, &k) != 4 ||
+        code > UINT16_MAX || jt > UINT8_MAX || jf > UINT8_MAX) {
+      free(insns);
+      fclose(file);
+      errno = EINVAL;
+      return -1;
+    }
+
+    insns[i] = (struct ftest_bpf_insn){
+        .code = code, .jt = jt, .jf = jf, .k = k};
+  }
+
+  fclose(file);
+
+  if (ftest_bpf_validate(insns, len) < 0) {
+    free(insns);
+    return -1;
+  }
+
+  prog->insns = insns;
+  prog->len = len;
+
+  return 0;
+}
+
+uint32_t ftest_bpf_run(const struct ftest_bpf_prog *prog, const uint8_t *frame,
+                       uint32_t len) {
+  uint32_t a = 0;
+  uint32_t x = 0;
+  uint32_t mem[BPF_MEMWORDS] = {0};
+  uint32_t value;
+
+  for (uint32_t pc = 0;; pc++) {
+    const struct ftest_bpf_insn *insn = &prog->insns[pc];
+    uint16_t code = insn->code;
+    uint32_t k = insn->k;
+    uint32_t src = BPF_SRC(code) == BPF_X ? x : k;
+
+    switch (BPF_CLASS(code)) {
+    case BPF_LD:
+      switch (BPF_MODE(code)) {
+      case BPF_IMM:
+        a = k;
+        break;
+      case BPF_LEN:
+        a = len;
+        break;
+      case BPF_MEM:
+        a = mem[k];
+        break;
+      case BPF_IND:
+        if (k > UINT32_MAX - x) {
+          return 0;
+        }
+        k += x;
+        /* fall through */
+      default:
+        if (!ftest_bpf_load_frame(frame, len, k, BPF_SIZE(code), &value)) {
+          return 0;
+        }
+        a = value;
+        break;
+      }
+      break;
+
+    case BPF_LDX:
+      switch (BPF_MODE(code)) {
+      case BPF_IMM:
+        x = k;
+        break;
+      case BPF_LEN:
+        x = len;
+        break;
+      case BPF_MEM:
+        x = mem[k];
+        break;
+      default:
+        /* The length of an IPv4 header */
+        if (k >= len) {
+          return 0;
+        }
+        x = (frame[k] & 0x0f) * 4;
+        break;
+      }
+      break;
+
+    case BPF_ST:
+      mem[k] = a;
+      break;
+
+    case BPF_STX:
+      mem[k] = x;
+      break;
+
+    case BPF_ALU:
+      switch (BPF_OP(code)) {
+      case BPF_ADD:
+        a += src;
+        break;
+      case BPF_SUB:
+        a -= src;
+        break;
+      case BPF_MUL:
+        a *= src;
+        break;
+      case BPF_DIV:
+        if (src == 0) {
+          return 0;
+        }
+        a /= src;
+        break;
+      case BPF_MOD:
+        if (src == 0) {
+          return 0;
+        }
+        a %= src;
+        break;
+      case BPF_OR:
+        a |= src;
+        break;
+      case BPF_AND:
+        a &= src;
+        break;
+      case BPF_XOR:
+        a ^= src;
+        break;
+      case BPF_LSH:
+        a = src < 32 ? a << src : 0;
+        break;
+      case BPF_RSH:
+        a = src < 32 ? a >> src : 0;
+        break;
+      default:
+        a = -a;
+        break;
+      }
+      break;
+
+    case BPF_JMP:
+      switch (BPF_OP(code)) {
+      case BPF_JA:
+        pc += k;
+        break;
+      case BPF_JEQ:
+        pc += a == src ? insn->jt : insn->jf;
+        break;
+      case BPF_JGT:
+        pc += a > src ? insn->jt : insn->jf;
+        break;
+      case BPF_JGE:
+        pc += a >= src ? insn->jt : insn->jf;
+        break;
+      default:
+        pc += a & src ? insn->jt : insn->jf;
+        break;
+      }
+      break;
+
+    case BPF_RET:
+      return BPF_RVAL(code) == BPF_A ? a : k;
+
+    default:
+      if (BPF_MISCOP(code) == BPF_TAX) {
+        x = a;
+      } else {
+        a = x;
+      }
+      break;
+    }
+  }
+}
+
+void ftest_bpf_free(struct ftest_bpf_prog *prog) {
+  free(prog->insns);
+  prog->insns = NULL;
+  prog->len = 0;
+}
@@ -0,0 +1,123 @@
+#include "ftest_checkpoint.h"
+#include "nsi_cmdline.h"
+#include "nsi_hw_scheduler.h"
+#include "nsi_tasks.h"
+#include "nsi_tracing.h"
+#include <criu/criu.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static uint64_t ftest_checkpoint_time = NSI_NEVER;
+static char *ftest_checkpoint_dir = "ftest_checkpoint";
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+/**
+ * Dump the whole process - every loaded entity with its threads, the rings
+ * and the scheduler - and keep running.
+ *
+ * @return 0 after the dump, 1 when running from the restored checkpoint, a
+ * negative value on failure.
+ */
+static int ftest_checkpoint_dump(void) {
+  if (mkdir(ftest_checkpoint_dir, 0755) < 0 && errno != EEXIST) {
+    nsi_print_warning("FTEST checkpoint: cannot create %s: %s\n",
+                      ftest_checkpoint_dir, strerror(errno));
+    return -1;
+  }
+
+  int dir_fd = open(ftest_checkpoint_dir, O_DIRECTORY | O_RDONLY);
+  if (dir_fd < 0) {
+    nsi_print_warning("FTEST checkpoint: cannot open %s: %s\n",
+                      ftest_checkpoint_dir, strerror(errno));
+    return -1;
+  }
+
+  int status = criu_init_opts();
+  if (status == 0) {
+    criu_set_images_dir_fd(dir_fd);
+    criu_set_log_file("dump.log");
+    criu_set_log_level(4);
+    criu_set_leave_running(true);
+    criu_set_shell_job(true);
+    criu_set_ext_unix_sk(true);
+    criu_set_file_locks(true);
+
+    status = criu_dump();
+  }
+
+  close(dir_fd);
+
+  return status;
+}
+
+/******************************************************************************
+ API
+ ******************************************************************************/
+
+void ftest_checkpoint_poll(uint64_t next_event_time) {
+  if (next_event_time < ftest_checkpoint_time) {
+    return;
+  }
+
+  uint64_t requested_time = ftest_checkpoint_time;
+  ftest_checkpoint_time = NSI_NEVER;
+
+  int status = ftest_checkpoint_dump();
+
+  if (status == 0) {
+    nsi_print_trace("FTEST checkpoint at %llu us stored in %s, restore with "
+                    "`criu restore -D %s --shell-job`\n",
+                    (unsigned long long)requested_time, ftest_checkpoint_dir,
+                    ftest_checkpoint_dir);
+  } else if (status == 1) {
+    nsi_print_trace("FTEST restored from the checkpoint at %llu us\n",
+                    (unsigned long long)requested_time);
+  } else {
+    nsi_print_warning("FTEST checkpoint at %llu us failed: %d, see %s/dump.log"
+                      "\n",
+                      (unsigned long long)requested_time, status,
+                      ftest_checkpoint_dir);
+  }
+}
+
+/******************************************************************************
+ Command line
+ ******************************************************************************/
+
+static void ftest_checkpoint_register_options(void) {
+  static struct args_struct_t ftest_checkpoint_options[] = {
+      {
+          .option = "ftest_checkpoint_at",
+          .name = "time_us",
+          .type = 'U',
+          .dest = &ftest_checkpoint_time,
+          .descript = "Store a checkpoint of the whole simulation once it "
+                      "reaches this virtual time (in microseconds), between "
+                      "two dispatches of the scheduler.",
+      },
+      {
+          .option = "ftest_checkpoint_dir",
+          .name = "path",
+          .type = 's',
+          .dest = &ftest_checkpoint_dir,
+          .descript = "Directory where the checkpoint is stored "
+                      "(ftest_checkpoint by default).",
+      },
+      ARG_TABLE_ENDMARKER,
+  };
+
+  nsi_add_command_line_opts(ftest_checkpoint_options);
+}
+
+NSI_TASK(ftest_checkpoint_register_options, PRE_BOOT_1, 10);
@@ -1,10 +1,134 @@
 #include "ftest_dl.h"
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if CONFIG_FTEST_ENTITY_LOADER_LAZY_BINDING
+#define FTEST_DL_BINDING RTLD_LAZY
+#else
+#define FTEST_DL_BINDING RTLD_NOW
+#endif
+
+#define FTEST_DL_PREFETCH_CHUNK 65536
+
+static void *ftest_dl_prefetch_worker(void *arg) {
+  char *lib_name = arg;
+
+  int fd = open(lib_name, O_RDONLY | O_CLOEXEC);
+
+  if (fd >= 0) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+
+    /* Several workers may be reading at once, each into its own buffer */
+    char sink[FTEST_DL_PREFETCH_CHUNK];
+
+    while (read(fd, sink, sizeof(sink)) > 0) {
+    }
+
+    close(fd);
+  }
+
+  free(lib_name);
+  return NULL;
+}
+
+/**
+ * Copy a library into an anonymous file in memory, so it can be loaded once
+ * more with globals of its own.
+ *
+ * @return The file descriptor of the copy, -1 with errno set on failure
+ */
+static int ftest_dl_copy_lib(const char *lib_name) {
+  int src = open(lib_name, O_RDONLY | O_CLOEXEC);
+  struct stat st;
+
+  if (src < 0) {
+    return -1;
+  }
+
+  int copy = memfd_create("ftest_entity", MFD_CLOEXEC);
+
+  if (copy < 0 || fstat(src, &st) < 0) {
+    int error = errno;
+    if (copy >= 0) {
+      close(copy);
+    }
+    close(src);
+    errno = error;
+    return -1;
+  }
+
+  off_t offset = 0;
+
+  while (offset < st.st_size) {
+    ssize_t res = sendfile(copy, src, &offset, st.st_size - offset);
+
+    if (res <= 0) {
+      int error = res < 0 ? errno : EIO;
+      close(copy);
+      close(src);
+      errno = error;
+      return -1;
+    }
+  }
+
+  close(src);
+
+  return copy;
+}
+
+/**
+ * The dynamic linker hands out the handle of a library which is loaded
+ * already, and with it the same globals, so every further instance is
+ * loaded from a copy of its own.
+ */
+static void *ftest_dl_open_copy(const char *lib_name) {
+  int copy = ftest_dl_copy_lib(lib_name);
+
+  if (copy < 0) {
+    printf("Error copying entity library %s: %s\n", lib_name,
+           strerror(errno));
+    return NULL;
+  }
+
+  char path[32];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", copy);
+
+  void *lib = dlopen(path, FTEST_DL_BINDING | RTLD_LOCAL | RTLD_DEEPBIND);
+  char *error = dlerror();
+
+  if (error != NULL) {
+    printf("Error loading entity library copy: %s", error);
+    close(copy);
+    return NULL;
+  }
+
+  /* Left open, as the dynamic linker tells libraries apart by their paths -
+   * another copy at the same path would get the handle of this one */
+
+  return lib;
+}
 
 void *ftest_dl_open_lib(const char *lib_name) {
-  void *lib = dlopen(lib_name, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
+  void *loaded = dlopen(lib_name, RTLD_LAZY | RTLD_NOLOAD);
+
+  if (loaded != NULL) {
+    dlclose(loaded);
+    return ftest_dl_open_copy(lib_name);
+  }
+
+  /* Clear the error of the lookup above */
+  dlerror();
+
+  void *lib = dlopen(lib_name, FTEST_DL_BINDING | RTLD_LOCAL | RTLD_DEEPBIND);
 
   char *error = dlerror();
 
@@ -37,4 +161,33 @@ void ftest_dl_close_lib(void *lib) {
   if (lib) {
     dlclose(lib);
   }
-}
\ No newline at end of file
+}
+
+int ftest_dl_prefetch_lib(const char *lib_name) {
+  if (!lib_name) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  char *name_copy = strdup(lib_name);
+  if (!name_copy) {
+    return -1;
+  }
+
+  pthread_attr_t attr;
+  pthread_t thread;
+
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  int status =
+      pthread_create(&thread, &attr, ftest_dl_prefetch_worker, name_copy);
+  pthread_attr_destroy(&attr);
+
+  if (status != 0) {
+    free(name_copy);
+    errno = status;
+    return -1;
+  }
+
+  return 0;
+}
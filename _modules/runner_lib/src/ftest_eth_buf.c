@@ -1,7 +1,489 @@
 #include "ftest_eth_buf.h"
+#include "ftest_pcap.h"
+#include "ftest_sched.h"
+#include "ftest_sched_entity.h"
+#include "nsi_tasks.h"
+#include "nsi_tracing.h"
 #include "ringbuffer.h"
+#include <errno.h>
+#include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
-ringbuffer_t ftest_eth_inproc_rb = {0};
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
 
-uint8_t ftest_eth_inproc_rb_buffer[FTEST_ETH_INPROC_BUFFER_SIZE] = {0}; // 64KB buffer
\ No newline at end of file
+#ifndef CONFIG_FTEST_ETH_INPROC_RING_SIZE
+#define CONFIG_FTEST_ETH_INPROC_RING_SIZE 65536
+#endif
+
+#ifndef CONFIG_FTEST_ETH_INPROC_SLOT_SIZE
+#define CONFIG_FTEST_ETH_INPROC_SLOT_SIZE 0
+#endif
+
+#ifndef CONFIG_FTEST_ETH_INPROC_MAX_PORTS
+#define CONFIG_FTEST_ETH_INPROC_MAX_PORTS 16
+#endif
+
+#define FTEST_ETH_BUF_HUGEPAGE_SIZE (2u * 1024 * 1024)
+
+/* Room for the addresses learned from source MACs besides the ports' own */
+#define FTEST_ETH_BUF_MAC_TABLE_SIZE (4 * CONFIG_FTEST_ETH_INPROC_MAX_PORTS)
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+struct ftest_eth_port {
+  ringbuffer_t rb;
+  struct ftest_shed_entity_entry *entity;
+  uint8_t mac[FTEST_ETH_BUF_MAC_LEN];
+  const struct ftest_eth_port_stats *stats;
+  /* The interface of the port in the capture, -1 if not captured */
+  int pcap_interface;
+  int segment;
+  /* The next port on the same segment, -1 for the last one */
+  int next_port;
+};
+
+struct ftest_eth_segment {
+  char *name;
+  int first_port;
+  int last_port;
+};
+
+struct ftest_eth_mac_entry {
+  uint8_t mac[FTEST_ETH_BUF_MAC_LEN];
+  bool used;
+  int segment;
+  int port;
+};
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static struct ftest_eth_port ftest_eth_ports[CONFIG_FTEST_ETH_INPROC_MAX_PORTS];
+static int ftest_eth_port_count = 0;
+
+/* There are never more segments than ports */
+static struct ftest_eth_segment
+    ftest_eth_segments[CONFIG_FTEST_ETH_INPROC_MAX_PORTS];
+static int ftest_eth_segment_count = 0;
+
+/* Open addressing table of the MAC addresses learned on each segment, never
+ * shrinks */
+static struct ftest_eth_mac_entry
+    ftest_eth_mac_table[FTEST_ETH_BUF_MAC_TABLE_SIZE];
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+#if CONFIG_FTEST_ETH_INPROC_RING_HUGEPAGE
+static size_t ftest_eth_buf_map_size(uint32_t size) {
+  return ((size_t)size + FTEST_ETH_BUF_HUGEPAGE_SIZE - 1) &
+         ~(size_t)(FTEST_ETH_BUF_HUGEPAGE_SIZE - 1);
+}
+#endif
+
+/**
+ * Allocate the ring of a port as it is attached, so only the ports in use
+ * take memory.
+ */
+static uint8_t *ftest_eth_buf_alloc(uint32_t size) {
+#if CONFIG_FTEST_ETH_INPROC_RING_HUGEPAGE
+  size_t map_size = ftest_eth_buf_map_size(size);
+
+  void *buffer = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+  if (buffer == MAP_FAILED) {
+    /* No reserved hugepages - let transparent hugepages back it if they can */
+    buffer = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (buffer == MAP_FAILED) {
+      return NULL;
+    }
+
+    madvise(buffer, map_size, MADV_HUGEPAGE);
+  }
+
+  return buffer;
+#else
+  return aligned_alloc(RB_VAR_ALIGN, (size + RB_VAR_ALIGN - 1) &
+                                         ~(uint32_t)(RB_VAR_ALIGN - 1));
+#endif
+}
+
+static void ftest_eth_buf_free(uint8_t *buffer, uint32_t size) {
+#if CONFIG_FTEST_ETH_INPROC_RING_HUGEPAGE
+  munmap(buffer, ftest_eth_buf_map_size(size));
+#else
+  (void)size;
+  free(buffer);
+#endif
+}
+
+static bool ftest_eth_buf_is_port(int port) {
+  return port >= 0 && port < ftest_eth_port_count;
+}
+
+static struct ftest_eth_mac_entry *ftest_eth_buf_find_mac(int segment,
+                                                          const uint8_t *mac) {
+  uint32_t hash = 2166136261u ^ (uint32_t)segment;
+
+  for (int i = 0; i < FTEST_ETH_BUF_MAC_LEN; i++) {
+    hash = (hash ^ mac[i]) * 16777619u;
+  }
+
+  /* Either the entry of the address, or the free one it would take. NULL
+   * only if the table is full and the address is not in it */
+  for (size_t i = 0; i < FTEST_ETH_BUF_MAC_TABLE_SIZE; i++) {
+    struct ftest_eth_mac_entry *entry =
+        &ftest_eth_mac_table[(hash + i) % FTEST_ETH_BUF_MAC_TABLE_SIZE];
+
+    if (!entry->used || (entry->segment == segment &&
+                         memcmp(entry->mac, mac, FTEST_ETH_BUF_MAC_LEN) == 0)) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+static void ftest_eth_buf_learn(const uint8_t *mac, int port) {
+  int segment = ftest_eth_ports[port].segment;
+  struct ftest_eth_mac_entry *entry = ftest_eth_buf_find_mac(segment, mac);
+
+  /* Addresses which do not fit are flooded to, like unknown ones */
+  if (entry == NULL) {
+    return;
+  }
+
+  memcpy(entry->mac, mac, FTEST_ETH_BUF_MAC_LEN);
+  entry->used = true;
+  entry->segment = segment;
+  entry->port = port;
+}
+
+static int ftest_eth_buf_get_segment(const char *name) {
+  for (int i = 0; i < ftest_eth_segment_count; i++) {
+    if (strcmp(ftest_eth_segments[i].name, name) == 0) {
+      return i;
+    }
+  }
+
+  char *name_copy = strdup(name);
+  if (name_copy == NULL) {
+    return -1;
+  }
+
+  ftest_eth_segments[ftest_eth_segment_count] = (struct ftest_eth_segment){
+      .name = name_copy,
+      .first_port = -1,
+      .last_port = -1,
+  };
+
+  return ftest_eth_segment_count++;
+}
+
+static int ftest_eth_buf_add_to_capture(int port) {
+#if CONFIG_FTEST_ETH_OUTPUT_PCAP
+  const struct ftest_eth_port *eth_port = &ftest_eth_ports[port];
+  const char *entity_name = ftest_shed_get_entity_name(eth_port->entity);
+  char name[64];
+  char description[128];
+
+  snprintf(name, sizeof(name), "%s-%d", entity_name ? entity_name : "port",
+           port);
+  snprintf(description, sizeof(description), "Port %d on segment %s", port,
+           ftest_eth_segments[eth_port->segment].name);
+
+  return ftest_pcap_add_interface(name, description, eth_port->mac);
+#else
+  (void)port;
+  return -1;
+#endif
+}
+
+static int ftest_eth_buf_forward(int port, const struct ftest_eth_hdr *frame,
+                                 uint32_t len) {
+  rb_result_t res = rb_write(&ftest_eth_ports[port].rb, frame, len);
+
+  if (res != RB_OK) {
+    return res;
+  }
+
+  return ftest_eth_buf_notify(port, frame->sent_time);
+}
+
+/******************************************************************************
+ API
+ ******************************************************************************/
+
+int ftest_eth_buf_attach(const char *segment, const uint8_t *mac,
+                         uint32_t ring_size, uint32_t slot_size,
+                         struct ftest_shed_entity_entry *entity) {
+  if (segment == NULL || mac == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (ftest_eth_port_count == CONFIG_FTEST_ETH_INPROC_MAX_PORTS) {
+    nsi_print_warning("FTEST eth switch has no free port, the maximum is %d\n",
+                      CONFIG_FTEST_ETH_INPROC_MAX_PORTS);
+    errno = ENOSPC;
+    return -1;
+  }
+
+  if (ring_size == 0) {
+    ring_size = CONFIG_FTEST_ETH_INPROC_RING_SIZE;
+  }
+
+  if (slot_size == 0) {
+    slot_size = CONFIG_FTEST_ETH_INPROC_SLOT_SIZE;
+  }
+
+  int port = ftest_eth_port_count;
+  struct ftest_eth_port *eth_port = &ftest_eth_ports[port];
+
+  uint8_t *buffer = ftest_eth_buf_alloc(ring_size);
+  if (buffer == NULL) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  rb_result_t res = slot_size
+                        ? rb_init_pow2(&eth_port->rb, buffer, ring_size,
+                                       slot_size)
+                        : rb_init_var(&eth_port->rb, buffer, ring_size);
+
+  if (res != RB_OK) {
+    ftest_eth_buf_free(buffer, ring_size);
+    errno = EINVAL;
+    return -1;
+  }
+
+#if CONFIG_FTEST_ETH_INPROC_LOSSLESS
+  rb_set_lossless(&eth_port->rb, true);
+#endif
+
+  int segment_index = ftest_eth_buf_get_segment(segment);
+  if (segment_index < 0) {
+    ftest_eth_buf_free(buffer, ring_size);
+    errno = ENOMEM;
+    return -1;
+  }
+
+  struct ftest_eth_segment *eth_segment = &ftest_eth_segments[segment_index];
+
+  if (eth_segment->last_port < 0) {
+    eth_segment->first_port = port;
+  } else {
+    ftest_eth_ports[eth_segment->last_port].next_port = port;
+  }
+  eth_segment->last_port = port;
+
+  eth_port->entity = entity;
+  memcpy(eth_port->mac, mac, FTEST_ETH_BUF_MAC_LEN);
+  eth_port->stats = NULL;
+  eth_port->segment = segment_index;
+  eth_port->next_port = -1;
+  ftest_eth_port_count++;
+
+  ftest_eth_buf_learn(mac, port);
+
+  eth_port->pcap_interface = ftest_eth_buf_add_to_capture(port);
+
+  return port;
+}
+
+int ftest_eth_buf_set_stats(int port,
+                            const struct ftest_eth_port_stats *stats) {
+  if (!ftest_eth_buf_is_port(port)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ftest_eth_ports[port].stats = stats;
+
+  return 0;
+}
+
+ringbuffer_t *ftest_eth_buf_get_ring(int port) {
+  return ftest_eth_buf_is_port(port) ? &ftest_eth_ports[port].rb : NULL;
+}
+
+int ftest_eth_buf_route(int src_port, const uint8_t *dst_mac,
+                        const uint8_t *src_mac) {
+  if (!ftest_eth_buf_is_port(src_port)) {
+    return FTEST_ETH_BUF_DROP;
+  }
+
+  if (!(src_mac[0] & 0x01)) {
+    ftest_eth_buf_learn(src_mac, src_port);
+  }
+
+  /* Group addresses, the broadcast one included, are always flooded */
+  if (dst_mac[0] & 0x01) {
+    return FTEST_ETH_BUF_FLOOD;
+  }
+
+  struct ftest_eth_mac_entry *entry =
+      ftest_eth_buf_find_mac(ftest_eth_ports[src_port].segment, dst_mac);
+
+  if (entry == NULL || !entry->used) {
+    return FTEST_ETH_BUF_FLOOD;
+  }
+
+  /* A switch never sends a frame back through the port it came from */
+  return entry->port == src_port ? FTEST_ETH_BUF_DROP : entry->port;
+}
+
+int ftest_eth_buf_notify(int port, uint64_t sent_time) {
+  if (!ftest_eth_buf_is_port(port)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (ftest_eth_ports[port].entity == NULL) {
+    return 0;
+  }
+
+  /* Without any declared latency, entities are never run in parallel */
+  uint64_t lookahead = ftest_shed_get_lookahead();
+
+  return ftest_shed_ring_doorbell(ftest_eth_ports[port].entity,
+                                  lookahead == UINT64_MAX
+                                      ? sent_time
+                                      : sent_time + lookahead);
+}
+
+void ftest_eth_buf_detach_entity(const struct ftest_shed_entity_entry *entity) {
+  for (int port = 0; port < ftest_eth_port_count; port++) {
+    if (ftest_eth_ports[port].entity == entity) {
+      ftest_eth_ports[port].entity = NULL;
+    }
+  }
+}
+
+void ftest_eth_buf_capture(const void *frame) {
+#if CONFIG_FTEST_ETH_OUTPUT_PCAP
+  const struct ftest_eth_hdr *hdr = frame;
+
+  if (!ftest_eth_buf_is_port(hdr->src_port)) {
+    return;
+  }
+
+  ftest_pcap_write_frame(ftest_eth_ports[hdr->src_port].pcap_interface,
+                         FTEST_PCAP_OUTBOUND, hdr->payload, hdr->len,
+                         hdr->sent_time);
+#else
+  (void)frame;
+#endif
+}
+
+int ftest_eth_buf_commit(const void *frame, uint32_t len) {
+  const struct ftest_eth_hdr *hdr = frame;
+
+  if (len < sizeof(*hdr) + 2 * FTEST_ETH_BUF_MAC_LEN) {
+    return RB_INVALID_PARAM;
+  }
+
+  /* Captured once as it leaves the sender, not once per receiver */
+  ftest_eth_buf_capture(hdr);
+
+  int dst_port = ftest_eth_buf_route(hdr->src_port, hdr->payload,
+                                     hdr->payload + FTEST_ETH_BUF_MAC_LEN);
+
+  if (dst_port == FTEST_ETH_BUF_DROP) {
+    return RB_OK;
+  }
+
+  if (dst_port != FTEST_ETH_BUF_FLOOD) {
+    return ftest_eth_buf_forward(dst_port, hdr, len);
+  }
+
+  /* A port which cannot take the frame does not keep the others from
+   * receiving it */
+  int res = RB_OK;
+  int segment = ftest_eth_ports[hdr->src_port].segment;
+
+  for (int port = ftest_eth_segments[segment].first_port; port >= 0;
+       port = ftest_eth_ports[port].next_port) {
+    if (port == hdr->src_port) {
+      continue;
+    }
+
+    int port_res = ftest_eth_buf_forward(port, hdr, len);
+
+    if (port_res < 0) {
+      res = port_res;
+    }
+  }
+
+  return res;
+}
+
+/******************************************************************************
+ Statistics
+ ******************************************************************************/
+
+#if CONFIG_FTEST_ETH_INPROC_STATS
+static void ftest_eth_buf_print_port_stats(int port) {
+  const struct ftest_eth_port *eth_port = &ftest_eth_ports[port];
+  const struct ftest_eth_port_stats *stats = eth_port->stats;
+  const uint8_t *mac = eth_port->mac;
+  rb_stats_t rb_stats;
+
+  rb_get_stats(&eth_port->rb, &rb_stats);
+
+  nsi_print_trace("FTEST eth port %d (%02x:%02x:%02x:%02x:%02x:%02x on %s): "
+                  "ring %u, lossless stalls %u, saved %u\n",
+                  port, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
+                  ftest_eth_segments[eth_port->segment].name,
+                  rb_get_capacity(&eth_port->rb), rb_stats.stalls,
+                  rb_stats.saved);
+
+  if (stats == NULL) {
+    return;
+  }
+
+  nsi_print_trace("  tx %llu frames %llu bytes, dropped %llu, lost on link "
+                  "%llu\n",
+                  (unsigned long long)stats->tx_frames,
+                  (unsigned long long)stats->tx_bytes,
+                  (unsigned long long)stats->tx_dropped,
+                  (unsigned long long)stats->link_lost);
+  nsi_print_trace("  rx %llu frames %llu bytes, overruns %llu, no net_pkt "
+                  "%llu, no net_buf %llu, refused by stack %llu\n",
+                  (unsigned long long)stats->rx_frames,
+                  (unsigned long long)stats->rx_bytes,
+                  (unsigned long long)stats->rx_overruns,
+                  (unsigned long long)stats->rx_no_pkt,
+                  (unsigned long long)stats->rx_no_buf,
+                  (unsigned long long)stats->rx_errors);
+
+  nsi_print_trace("  ring occupancy:");
+  for (int i = 0; i < FTEST_ETH_BUF_OCCUPANCY_BUCKETS; i++) {
+    nsi_print_trace(" <=%d%% %llu",
+                    (i + 1) * 100 / FTEST_ETH_BUF_OCCUPANCY_BUCKETS,
+                    (unsigned long long)stats->occupancy[i]);
+  }
+  nsi_print_trace("\n");
+}
+
+static void ftest_eth_buf_print_stats(void) {
+  for (int port = 0; port < ftest_eth_port_count; port++) {
+    ftest_eth_buf_print_port_stats(port);
+  }
+}
+
+NSI_TASK(ftest_eth_buf_print_stats, ON_EXIT_PRE, 102);
+#endif
@@ -0,0 +1,219 @@
+#include "ftest_jobs.h"
+#include "nsi_cmdline.h"
+#include "nsi_tasks.h"
+#include "nsi_tracing.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#define FTEST_JOBS_OPTION "-ftest_jobs="
+#define FTEST_JOBS_MAX 256
+#define FTEST_JOBS_LOG_FORMAT "ftest_job_%u.log"
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static unsigned ftest_jobs_count = 1;
+static unsigned ftest_jobs_index = 0;
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+static unsigned ftest_jobs_parse(int argc, char *argv[]) {
+  const size_t option_len = strlen(FTEST_JOBS_OPTION);
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], FTEST_JOBS_OPTION, option_len) != 0) {
+      continue;
+    }
+
+    char *end;
+    unsigned long jobs = strtoul(argv[i] + option_len, &end, 10);
+
+    if (*end != '\0' || jobs == 0 || jobs > FTEST_JOBS_MAX) {
+      nsi_print_error_and_exit("Invalid %s value: %s (expected 1..%d)\n",
+                               FTEST_JOBS_OPTION, argv[i] + option_len,
+                               FTEST_JOBS_MAX);
+    }
+
+    return (unsigned)jobs;
+  }
+
+  return 1;
+}
+
+static void ftest_jobs_redirect_output(unsigned index) {
+  char log_name[64];
+  snprintf(log_name, sizeof(log_name), FTEST_JOBS_LOG_FORMAT, index);
+
+  int fd = open(log_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    nsi_print_error_and_exit("Failed to create %s: %s\n", log_name,
+                             strerror(errno));
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  dup2(fd, STDOUT_FILENO);
+  dup2(fd, STDERR_FILENO);
+  close(fd);
+}
+
+static void ftest_jobs_print_log(unsigned index) {
+  char log_name[64];
+  snprintf(log_name, sizeof(log_name), FTEST_JOBS_LOG_FORMAT, index);
+
+  FILE *log = fopen(log_name, "r");
+  if (!log) {
+    printf("FTEST job %u: no log (%s)\n", index, strerror(errno));
+    return;
+  }
+
+  printf("===== FTEST job %u/%u =====\n", index + 1, ftest_jobs_count);
+
+  char buffer[4096];
+  size_t len;
+  while ((len = fread(buffer, 1, sizeof(buffer), log)) > 0) {
+    fwrite(buffer, 1, len, stdout);
+  }
+
+  fclose(log);
+}
+
+static void ftest_jobs_collect(pid_t *children) {
+  int result = EXIT_SUCCESS;
+
+  for (unsigned i = 0; i < ftest_jobs_count; i++) {
+    int status;
+
+    while (waitpid(children[i], &status, 0) < 0) {
+      if (errno != EINTR) {
+        nsi_print_error_and_exit("Failed to wait for FTEST job %u: %s\n", i,
+                                 strerror(errno));
+      }
+    }
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+      continue;
+    }
+
+    if (WIFSIGNALED(status)) {
+      printf("FTEST job %u killed by signal %d\n", i, WTERMSIG(status));
+    } else {
+      printf("FTEST job %u exited with %d\n", i, WEXITSTATUS(status));
+    }
+
+    result = EXIT_FAILURE;
+  }
+
+  for (unsigned i = 0; i < ftest_jobs_count; i++) {
+    ftest_jobs_print_log(i);
+  }
+
+  printf("===== FTEST %u jobs %s =====\n", ftest_jobs_count,
+         result == EXIT_SUCCESS ? "PASSED" : "FAILED");
+  fflush(stdout);
+
+  exit(result);
+}
+
+/******************************************************************************
+ API
+ ******************************************************************************/
+
+void ftest_jobs_fork(int argc, char *argv[]) {
+  ftest_jobs_count = ftest_jobs_parse(argc, argv);
+
+  if (ftest_jobs_count == 1) {
+    return;
+  }
+
+  pid_t children[FTEST_JOBS_MAX];
+
+  fflush(stdout);
+  fflush(stderr);
+
+  for (unsigned i = 0; i < ftest_jobs_count; i++) {
+    pid_t pid = fork();
+
+    if (pid < 0) {
+      nsi_print_error_and_exit("Failed to fork FTEST job %u: %s\n", i,
+                               strerror(errno));
+    }
+
+    if (pid == 0) {
+      ftest_jobs_index = i;
+      ftest_jobs_redirect_output(i);
+      return;
+    }
+
+    children[i] = pid;
+  }
+
+  ftest_jobs_collect(children);
+}
+
+bool ftest_jobs_owns_test(unsigned test_index) {
+  return test_index % ftest_jobs_count == ftest_jobs_index;
+}
+
+const char *ftest_jobs_file_name(const char *name, char *buf, size_t size) {
+  if (ftest_jobs_count == 1) {
+    return name;
+  }
+
+  const char *base = strrchr(name, '/');
+  const char *ext = strrchr(name, '.');
+
+  base = base ? base + 1 : name;
+
+  /* A leading dot starts the name of a hidden file, not an extension */
+  if (ext == NULL || ext <= base) {
+    ext = name + strlen(name);
+  }
+
+  snprintf(buf, size, "%.*s_%u%s", (int)(ext - name), name, ftest_jobs_index,
+           ext);
+
+  return buf;
+}
+
+/******************************************************************************
+ Command line
+ ******************************************************************************/
+
+static unsigned ftest_jobs_option_value;
+
+/**
+ * The option is consumed by ftest_jobs_fork() before the simulation starts,
+ * it is only registered so the command line parser accepts it.
+ */
+static void ftest_jobs_register_options(void) {
+  static struct args_struct_t ftest_jobs_options[] = {
+      {
+          .option = "ftest_jobs",
+          .name = "n",
+          .type = 'u',
+          .dest = &ftest_jobs_option_value,
+          .descript = "Split the tests between <n> processes running in "
+                      "parallel. The output of every process is stored in "
+                      "ftest_job_<i>.log and printed once all are done.",
+      },
+      ARG_TABLE_ENDMARKER,
+  };
+
+  nsi_add_command_line_opts(ftest_jobs_options);
+}
+
+NSI_TASK(ftest_jobs_register_options, PRE_BOOT_1, 10);
@@ -0,0 +1,795 @@
+#include "ftest_pcap.h"
+#include "ftest_bpf.h"
+#include "ftest_jobs.h"
+#include "nsi_cmdline.h"
+#include "nsi_tasks.h"
+#include "nsi_tracing.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#ifndef CONFIG_FTEST_ETH_OUTPUT_PCAP_BUFFER_SIZE
+#define CONFIG_FTEST_ETH_OUTPUT_PCAP_BUFFER_SIZE (1024 * 1024)
+#endif
+
+#ifndef CONFIG_FTEST_ETH_OUTPUT_PCAP_RECORDER_SIZE_MB
+#define CONFIG_FTEST_ETH_OUTPUT_PCAP_RECORDER_SIZE_MB 16
+#endif
+
+#ifndef CONFIG_FTEST_ETH_OUTPUT_PCAP_SNAPLEN
+#define CONFIG_FTEST_ETH_OUTPUT_PCAP_SNAPLEN 65535
+#endif
+
+#ifndef CONFIG_FTEST_ETH_OUTPUT_PCAP_FILE
+#define CONFIG_FTEST_ETH_OUTPUT_PCAP_FILE "capture.pcapng"
+#endif
+
+#define PCAPNG_BLOCK_SHB 0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB 0x00000001
+#define PCAPNG_BLOCK_EPB 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_DESCRIPTION 3
+#define PCAPNG_OPT_IF_MACADDR 6
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+
+/* Timestamps in nanoseconds */
+#define PCAPNG_TSRESOL_NS 9
+
+#define LINKTYPE_ETHERNET 1
+
+#define FTEST_PCAP_BUF_COUNT 2
+#define FTEST_PCAP_RECORDER_SIZE                                               \
+  ((uint64_t)CONFIG_FTEST_ETH_OUTPUT_PCAP_RECORDER_SIZE_MB * 1024 * 1024)
+#define FTEST_PCAP_MAC_LEN 6
+#define FTEST_PCAP_ALIGN(len) (((len) + 3u) & ~3u)
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+struct pcapng_block_header {
+  uint32_t type;
+  uint32_t total_len;
+};
+
+struct pcapng_section_header {
+  uint32_t byte_order_magic;
+  uint16_t version_major;
+  uint16_t version_minor;
+  int64_t section_len;
+};
+
+struct pcapng_interface_description {
+  uint16_t link_type;
+  uint16_t reserved;
+  uint32_t snaplen;
+};
+
+struct pcapng_enhanced_packet {
+  uint32_t interface;
+  uint32_t ts_high;
+  uint32_t ts_low;
+  uint32_t captured_len;
+  uint32_t orig_len;
+};
+
+struct pcapng_option_header {
+  uint16_t code;
+  uint16_t len;
+};
+
+/**
+ * Blocks collected in memory, and the place in the file they go to. As every
+ * buffer is written at its own offset, writing it again only rewrites the same
+ * bytes, so the signal handlers may flush a buffer the writer thread is
+ * working on.
+ */
+struct ftest_pcap_buf {
+  uint8_t *data;
+  size_t len;
+  off_t offset;
+};
+
+/**
+ * The most recent blocks of the flight recorder, between two positions which
+ * only grow and wrap around the buffer. Blocks are evicted from the start
+ * before they are overwritten, so what lies between start and end is always
+ * complete.
+ */
+struct ftest_pcap_ring {
+  uint8_t *data;
+  uint64_t start;
+  uint64_t end;
+};
+
+/** The header of an Enhanced Packet Block, up to the frame */
+struct ftest_pcap_epb_head {
+  struct pcapng_block_header header;
+  struct pcapng_enhanced_packet epb;
+};
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static bool ftest_pcap_opened = false;
+static bool ftest_pcap_failed = false;
+
+/* The capture file of this job, resolved up front for the signal handlers */
+static char ftest_pcap_file_buf[256];
+static const char *ftest_pcap_file = CONFIG_FTEST_ETH_OUTPUT_PCAP_FILE;
+static int ftest_pcap_interface_count = 0;
+
+static pthread_mutex_t ftest_pcap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t ftest_pcap_snaplen = CONFIG_FTEST_ETH_OUTPUT_PCAP_SNAPLEN;
+static char *ftest_pcap_filter_file = NULL;
+static struct ftest_bpf_prog ftest_pcap_filter;
+
+#ifdef CONFIG_FTEST_ETH_OUTPUT_PCAP_RECORDER
+
+static struct ftest_pcap_ring ftest_pcap_ring;
+
+/* The section and interface blocks, which are never evicted */
+static uint8_t *volatile ftest_pcap_prelude = NULL;
+static volatile size_t ftest_pcap_prelude_len = 0;
+
+static bool ftest_pcap_dumped = false;
+
+#else
+
+static int ftest_pcap_fd = -1;
+
+static struct ftest_pcap_buf ftest_pcap_bufs[FTEST_PCAP_BUF_COUNT];
+
+/* The buffer blocks are added to. The other one is written out by the writer
+ * thread while ftest_pcap_pending is set */
+static volatile int ftest_pcap_active = 0;
+static volatile bool ftest_pcap_pending = false;
+static bool ftest_pcap_stopping = false;
+
+static pthread_t ftest_pcap_writer;
+static pthread_cond_t ftest_pcap_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t ftest_pcap_done = PTHREAD_COND_INITIALIZER;
+
+#endif
+
+/* Signals after which the process is gone, and the handlers they replaced */
+static const int ftest_pcap_signals[] = {SIGINT,  SIGTERM, SIGHUP, SIGSEGV,
+                                         SIGBUS,  SIGABRT, SIGFPE, SIGILL};
+static struct sigaction ftest_pcap_old_actions[sizeof(ftest_pcap_signals) /
+                                               sizeof(ftest_pcap_signals[0])];
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+#ifdef CONFIG_FTEST_ETH_OUTPUT_PCAP_RECORDER
+
+/**
+ * Write all of the data to a file. Only uses async-signal-safe calls.
+ */
+static void ftest_pcap_write_all(int fd, const uint8_t *data, size_t len) {
+  size_t written = 0;
+
+  while (written < len) {
+    ssize_t res = write(fd, data + written, len - written);
+
+    if (res <= 0) {
+      return;
+    }
+
+    written += res;
+  }
+}
+
+/**
+ * Write the recorded blocks to the capture file, once. Only uses
+ * async-signal-safe calls, so it may run in the signal handlers.
+ */
+static void ftest_pcap_dump(void) {
+  if (!ftest_pcap_opened ||
+      __atomic_exchange_n(&ftest_pcap_dumped, true, __ATOMIC_ACQ_REL)) {
+    return;
+  }
+
+  int fd = open(ftest_pcap_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return;
+  }
+
+  struct ftest_pcap_ring *ring = &ftest_pcap_ring;
+  uint64_t start = __atomic_load_n(&ring->start, __ATOMIC_ACQUIRE);
+  uint64_t end = __atomic_load_n(&ring->end, __ATOMIC_ACQUIRE);
+  uint64_t offset = start % FTEST_PCAP_RECORDER_SIZE;
+  uint64_t len = end - start;
+  uint64_t first_len = FTEST_PCAP_RECORDER_SIZE - offset;
+
+  if (first_len > len) {
+    first_len = len;
+  }
+
+  ftest_pcap_write_all(fd, ftest_pcap_prelude, ftest_pcap_prelude_len);
+  ftest_pcap_write_all(fd, ring->data + offset, first_len);
+  ftest_pcap_write_all(fd, ring->data, len - first_len);
+
+  close(fd);
+}
+
+static void ftest_pcap_on_exit(int status, void *arg) {
+  (void)arg;
+
+  /* A failed ztest assertion ends the runner with a non-zero status */
+  if (status != 0) {
+    ftest_pcap_dump();
+  }
+}
+
+/**
+ * Copy data to a position of the ring, wrapping around its end.
+ */
+static void ftest_pcap_ring_copy(uint64_t pos, const void *data, uint32_t len) {
+  uint64_t offset = pos % FTEST_PCAP_RECORDER_SIZE;
+  uint64_t first_len = FTEST_PCAP_RECORDER_SIZE - offset;
+
+  if (first_len >= len) {
+    memcpy(ftest_pcap_ring.data + offset, data, len);
+  } else {
+    memcpy(ftest_pcap_ring.data + offset, data, first_len);
+    memcpy(ftest_pcap_ring.data, (const uint8_t *)data + first_len,
+           len - first_len);
+  }
+}
+
+/**
+ * Add a block, given in pieces so the frame of a packet is copied only once,
+ * to the ring, evicting the oldest blocks it does not fit next to. Called
+ * with the lock held.
+ */
+static void ftest_pcap_put_packet(const void *head, uint32_t head_len,
+                                  const void *body, uint32_t body_len,
+                                  const void *tail, uint32_t tail_len) {
+  struct ftest_pcap_ring *ring = &ftest_pcap_ring;
+  uint32_t total_len = head_len + body_len + tail_len;
+  uint64_t start = ring->start;
+  uint64_t end = ring->end;
+
+  if (total_len > FTEST_PCAP_RECORDER_SIZE) {
+    return;
+  }
+
+  /* Blocks are 32-bit aligned, so their length never wraps */
+  while (end + total_len - start > FTEST_PCAP_RECORDER_SIZE) {
+    uint32_t evicted_len;
+
+    memcpy(&evicted_len,
+           ring->data + (start + offsetof(struct pcapng_block_header,
+                                          total_len)) %
+                            FTEST_PCAP_RECORDER_SIZE,
+           sizeof(evicted_len));
+    start += evicted_len;
+  }
+
+  /* Released before the evicted blocks are overwritten, and the new block
+   * only once complete, for the signal handlers */
+  __atomic_store_n(&ring->start, start, __ATOMIC_RELEASE);
+
+  ftest_pcap_ring_copy(end, head, head_len);
+  ftest_pcap_ring_copy(end + head_len, body, body_len);
+  ftest_pcap_ring_copy(end + head_len + body_len, tail, tail_len);
+
+  __atomic_store_n(&ring->end, end + total_len, __ATOMIC_RELEASE);
+}
+
+/**
+ * Add a section or interface block to the prelude. The grown prelude is only
+ * published once complete, for the signal handlers. Called with the lock
+ * held.
+ */
+static void ftest_pcap_put_meta(const uint8_t *block, uint32_t len) {
+  uint8_t *old = ftest_pcap_prelude;
+  size_t old_len = ftest_pcap_prelude_len;
+  uint8_t *prelude = malloc(old_len + len);
+
+  if (prelude == NULL) {
+    nsi_print_warning("FTEST capture block could not be recorded\n");
+    return;
+  }
+
+  if (old_len > 0) {
+    memcpy(prelude, old, old_len);
+  }
+  memcpy(prelude + old_len, block, len);
+
+  ftest_pcap_prelude_len = 0;
+  ftest_pcap_prelude = prelude;
+  ftest_pcap_prelude_len = old_len + len;
+  free(old);
+}
+
+#else
+/**
+ * Write a buffer out. Only uses async-signal-safe calls.
+ */
+static void ftest_pcap_write_buf(const struct ftest_pcap_buf *buf) {
+  size_t written = 0;
+
+  while (written < buf->len) {
+    ssize_t res = pwrite(ftest_pcap_fd, buf->data + written, buf->len - written,
+                         buf->offset + (off_t)written);
+
+    if (res <= 0) {
+      return;
+    }
+
+    written += res;
+  }
+}
+
+static void *ftest_pcap_writer_task(void *arg) {
+  (void)arg;
+
+  pthread_mutex_lock(&ftest_pcap_lock);
+
+  while (true) {
+    while (!ftest_pcap_pending && !ftest_pcap_stopping) {
+      pthread_cond_wait(&ftest_pcap_work, &ftest_pcap_lock);
+    }
+
+    if (!ftest_pcap_pending) {
+      break;
+    }
+
+    /* The producers only touch the active buffer meanwhile */
+    struct ftest_pcap_buf *buf = &ftest_pcap_bufs[1 - ftest_pcap_active];
+
+    pthread_mutex_unlock(&ftest_pcap_lock);
+    ftest_pcap_write_buf(buf);
+    pthread_mutex_lock(&ftest_pcap_lock);
+
+    ftest_pcap_pending = false;
+    pthread_cond_broadcast(&ftest_pcap_done);
+  }
+
+  pthread_mutex_unlock(&ftest_pcap_lock);
+
+  return NULL;
+}
+
+/**
+ * Hand the active buffer over to the writer thread, and continue in the other
+ * one. Called with the lock held.
+ */
+static void ftest_pcap_swap(void) {
+  while (ftest_pcap_pending) {
+    pthread_cond_wait(&ftest_pcap_done, &ftest_pcap_lock);
+  }
+
+  struct ftest_pcap_buf *full = &ftest_pcap_bufs[ftest_pcap_active];
+  struct ftest_pcap_buf *next = &ftest_pcap_bufs[1 - ftest_pcap_active];
+
+  next->offset = full->offset + (off_t)full->len;
+  next->len = 0;
+
+  ftest_pcap_active = 1 - ftest_pcap_active;
+  ftest_pcap_pending = true;
+  pthread_cond_signal(&ftest_pcap_work);
+}
+
+/**
+ * Add a block, given in pieces so the frame of a packet is copied only once,
+ * to the active buffer. Called with the lock held.
+ */
+static void ftest_pcap_put_packet(const void *head, uint32_t head_len,
+                                  const void *body, uint32_t body_len,
+                                  const void *tail, uint32_t tail_len) {
+  uint32_t total_len = head_len + body_len + tail_len;
+
+  if (ftest_pcap_bufs[ftest_pcap_active].len + total_len >
+      CONFIG_FTEST_ETH_OUTPUT_PCAP_BUFFER_SIZE) {
+    ftest_pcap_swap();
+  }
+
+  struct ftest_pcap_buf *buf = &ftest_pcap_bufs[ftest_pcap_active];
+  uint8_t *pos = buf->data + buf->len;
+
+  memcpy(pos, head, head_len);
+  memcpy(pos + head_len, body, body_len);
+  memcpy(pos + head_len + body_len, tail, tail_len);
+
+  /* Only counted once complete, for the signal handlers */
+  __atomic_store_n(&buf->len, buf->len + total_len, __ATOMIC_RELEASE);
+}
+
+/**
+ * Add a section or interface block to the active buffer. Called with the
+ * lock held.
+ */
+static void ftest_pcap_put_meta(const uint8_t *block, uint32_t len) {
+  /* Nothing in the other pieces */
+  ftest_pcap_put_packet(block, len, block + len, 0, block + len, 0);
+}
+
+#endif
+
+/**
+ * Add an option, padded to 32 bits.
+ *
+ * @return Where the next option goes
+ */
+static uint8_t *ftest_pcap_put_option(uint8_t *pos, uint16_t code,
+                                      const void *value, uint16_t len) {
+  struct pcapng_option_header header = {.code = code, .len = len};
+
+  memcpy(pos, &header, sizeof(header));
+  if (len > 0) {
+    memcpy(pos + sizeof(header), value, len);
+  }
+  memset(pos + sizeof(header) + len, 0, FTEST_PCAP_ALIGN(len) - len);
+
+  return pos + sizeof(header) + FTEST_PCAP_ALIGN(len);
+}
+
+static uint32_t ftest_pcap_option_len(uint32_t len) {
+  return sizeof(struct pcapng_option_header) + FTEST_PCAP_ALIGN(len);
+}
+
+/**
+ * Put the header of a block at its start, and its length at its end.
+ *
+ * @return Where the body of the block goes
+ */
+static uint8_t *ftest_pcap_frame_block(uint8_t *block, uint32_t type,
+                                       uint32_t total_len) {
+  struct pcapng_block_header header = {.type = type, .total_len = total_len};
+
+  memcpy(block, &header, sizeof(header));
+  memcpy(block + total_len - sizeof(uint32_t), &total_len, sizeof(uint32_t));
+
+  return block + sizeof(header);
+}
+
+static void ftest_pcap_signal_handler(int sig, siginfo_t *info, void *ctx) {
+  size_t i = 0;
+
+#ifdef CONFIG_FTEST_ETH_OUTPUT_PCAP_RECORDER
+  ftest_pcap_dump();
+#else
+  /* Whatever was captured so far, in file order */
+  if (ftest_pcap_fd >= 0) {
+    if (ftest_pcap_pending) {
+      ftest_pcap_write_buf(&ftest_pcap_bufs[1 - ftest_pcap_active]);
+    }
+
+    ftest_pcap_write_buf(&ftest_pcap_bufs[ftest_pcap_active]);
+  }
+#endif
+
+  while (ftest_pcap_signals[i] != sig) {
+    i++;
+  }
+
+  const struct sigaction *old = &ftest_pcap_old_actions[i];
+
+  if (old->sa_flags & SA_SIGINFO) {
+    old->sa_sigaction(sig, info, ctx);
+  } else if (old->sa_handler == SIG_DFL) {
+    signal(sig, SIG_DFL);
+    raise(sig);
+  } else if (old->sa_handler != SIG_IGN) {
+    old->sa_handler(sig);
+  }
+}
+
+static void ftest_pcap_install_signal_handlers(void) {
+  struct sigaction action = {
+      .sa_sigaction = ftest_pcap_signal_handler,
+      .sa_flags = SA_SIGINFO,
+  };
+
+  sigemptyset(&action.sa_mask);
+
+  for (size_t i = 0; i < sizeof(ftest_pcap_signals) / sizeof(int); i++) {
+    sigaction(ftest_pcap_signals[i], &action, &ftest_pcap_old_actions[i]);
+  }
+}
+
+#ifdef CONFIG_FTEST_ETH_OUTPUT_PCAP_RECORDER
+
+/**
+ * Allocate the ring, touching all of it so recording never faults in new
+ * pages, and dump it if the runner exits with a failure.
+ */
+static bool ftest_pcap_start(void) {
+  ftest_pcap_ring.data = malloc(FTEST_PCAP_RECORDER_SIZE);
+
+  if (ftest_pcap_ring.data == NULL) {
+    nsi_print_warning("FTEST capture recorder could not be allocated\n");
+    return false;
+  }
+
+  memset(ftest_pcap_ring.data, 0, FTEST_PCAP_RECORDER_SIZE);
+
+  if (on_exit(ftest_pcap_on_exit, NULL) != 0) {
+    nsi_print_warning("FTEST capture recorder could not be registered\n");
+    free(ftest_pcap_ring.data);
+    ftest_pcap_ring.data = NULL;
+    return false;
+  }
+
+  return true;
+}
+
+static void ftest_pcap_close(void) {
+  /* Written by ftest_pcap_on_exit() once the exit status is known */
+}
+
+#else
+
+/**
+ * Create the capture file and start the writer thread.
+ */
+static bool ftest_pcap_start(void) {
+  for (int i = 0; i < FTEST_PCAP_BUF_COUNT; i++) {
+    ftest_pcap_bufs[i].data = malloc(CONFIG_FTEST_ETH_OUTPUT_PCAP_BUFFER_SIZE);
+
+    if (ftest_pcap_bufs[i].data == NULL) {
+      nsi_print_warning("FTEST capture buffers could not be allocated\n");
+      return false;
+    }
+  }
+
+  ftest_pcap_fd = open(ftest_pcap_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (ftest_pcap_fd < 0) {
+    nsi_print_warning("FTEST capture file %s could not be created\n",
+                      ftest_pcap_file);
+    return false;
+  }
+
+  if (pthread_create(&ftest_pcap_writer, NULL, ftest_pcap_writer_task,
+                     NULL) != 0) {
+    nsi_print_warning("FTEST capture writer could not be started\n");
+    close(ftest_pcap_fd);
+    ftest_pcap_fd = -1;
+    return false;
+  }
+
+  return true;
+}
+
+static void ftest_pcap_close(void) {
+  if (ftest_pcap_fd < 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&ftest_pcap_lock);
+  ftest_pcap_stopping = true;
+  pthread_cond_signal(&ftest_pcap_work);
+  pthread_mutex_unlock(&ftest_pcap_lock);
+
+  pthread_join(ftest_pcap_writer, NULL);
+
+  ftest_pcap_write_buf(&ftest_pcap_bufs[ftest_pcap_active]);
+  close(ftest_pcap_fd);
+  ftest_pcap_fd = -1;
+}
+
+#endif
+
+NSI_TASK(ftest_pcap_close, ON_EXIT_POST, 100);
+
+/**
+ * Start the capture with its section header, once the first interface is
+ * added. Called with the lock held.
+ */
+static bool ftest_pcap_open(void) {
+  if (ftest_pcap_opened || ftest_pcap_failed) {
+    return ftest_pcap_opened;
+  }
+
+  if (ftest_pcap_filter_file != NULL &&
+      ftest_bpf_load(&ftest_pcap_filter, ftest_pcap_filter_file) < 0) {
+    nsi_print_error_and_exit("FTEST capture filter %s could not be loaded: "
+                             "%s\n",
+                             ftest_pcap_filter_file, strerror(errno));
+  }
+
+  ftest_pcap_file =
+      ftest_jobs_file_name(CONFIG_FTEST_ETH_OUTPUT_PCAP_FILE,
+                           ftest_pcap_file_buf, sizeof(ftest_pcap_file_buf));
+
+  if (!ftest_pcap_start()) {
+    ftest_pcap_failed = true;
+    return false;
+  }
+
+  struct pcapng_section_header shb = {
+      .byte_order_magic = PCAPNG_BYTE_ORDER_MAGIC,
+      .version_major = 1,
+      .version_minor = 0,
+      .section_len = -1,
+  };
+  uint8_t block[sizeof(struct pcapng_block_header) + sizeof(shb) +
+                sizeof(uint32_t)];
+
+  memcpy(ftest_pcap_frame_block(block, PCAPNG_BLOCK_SHB, sizeof(block)), &shb,
+         sizeof(shb));
+  ftest_pcap_put_meta(block, sizeof(block));
+
+  ftest_pcap_opened = true;
+  ftest_pcap_install_signal_handlers();
+
+  return true;
+}
+
+/******************************************************************************
+ API
+ ******************************************************************************/
+
+int ftest_pcap_add_interface(const char *name, const char *description,
+                             const uint8_t *mac) {
+  pthread_mutex_lock(&ftest_pcap_lock);
+
+  if (!ftest_pcap_open()) {
+    pthread_mutex_unlock(&ftest_pcap_lock);
+    return -1;
+  }
+
+  struct pcapng_interface_description idb = {
+      .link_type = LINKTYPE_ETHERNET,
+      .snaplen = ftest_pcap_snaplen,
+  };
+  uint8_t tsresol = PCAPNG_TSRESOL_NS;
+  uint32_t name_len = strlen(name);
+  uint32_t description_len = description ? strlen(description) : 0;
+
+  uint32_t options_len = ftest_pcap_option_len(name_len) +
+                         ftest_pcap_option_len(FTEST_PCAP_MAC_LEN) +
+                         ftest_pcap_option_len(sizeof(tsresol)) +
+                         ftest_pcap_option_len(0);
+  if (description_len > 0) {
+    options_len += ftest_pcap_option_len(description_len);
+  }
+
+  uint32_t total_len = sizeof(struct pcapng_block_header) + sizeof(idb) +
+                       options_len + sizeof(uint32_t);
+  uint8_t *block = malloc(total_len);
+
+  if (block == NULL) {
+    pthread_mutex_unlock(&ftest_pcap_lock);
+    return -1;
+  }
+
+  uint8_t *pos = ftest_pcap_frame_block(block, PCAPNG_BLOCK_IDB, total_len);
+
+  memcpy(pos, &idb, sizeof(idb));
+  pos += sizeof(idb);
+  pos = ftest_pcap_put_option(pos, PCAPNG_OPT_IF_NAME, name, name_len);
+  if (description_len > 0) {
+    pos = ftest_pcap_put_option(pos, PCAPNG_OPT_IF_DESCRIPTION, description,
+                                description_len);
+  }
+  pos = ftest_pcap_put_option(pos, PCAPNG_OPT_IF_MACADDR, mac,
+                              FTEST_PCAP_MAC_LEN);
+  pos = ftest_pcap_put_option(pos, PCAPNG_OPT_IF_TSRESOL, &tsresol,
+                              sizeof(tsresol));
+  ftest_pcap_put_option(pos, PCAPNG_OPT_END, NULL, 0);
+
+  ftest_pcap_put_meta(block, total_len);
+  free(block);
+
+  int interface = ftest_pcap_interface_count++;
+
+  pthread_mutex_unlock(&ftest_pcap_lock);
+
+  return interface;
+}
+
+void ftest_pcap_write_frame(int interface, enum ftest_pcap_direction direction,
+                            const uint8_t *frame, uint32_t len, uint64_t time) {
+  if (interface < 0 || !ftest_pcap_opened) {
+    return;
+  }
+
+  /* As in the interface block, a snaplen of 0 does not limit the capture */
+  uint32_t captured_len = ftest_pcap_snaplen == 0 || len < ftest_pcap_snaplen
+                              ? len
+                              : ftest_pcap_snaplen;
+
+  /* Decided on the frame of the caller, before anything is copied */
+  if (ftest_pcap_filter.len > 0) {
+    uint32_t keep_len = ftest_bpf_run(&ftest_pcap_filter, frame, len);
+
+    if (keep_len == 0) {
+      return;
+    }
+
+    if (keep_len < captured_len) {
+      captured_len = keep_len;
+    }
+  }
+
+  uint64_t time_ns = time * 1000;
+  uint32_t flags = direction;
+  uint32_t padding_len = FTEST_PCAP_ALIGN(captured_len) - captured_len;
+
+  /* The frame is copied straight from the caller, between the header and
+   * the padding, options and length which follow it */
+  uint8_t tail[3 + sizeof(struct pcapng_option_header) + sizeof(flags) +
+               sizeof(struct pcapng_option_header) + sizeof(uint32_t)];
+  uint32_t tail_len = padding_len + ftest_pcap_option_len(sizeof(flags)) +
+                      ftest_pcap_option_len(0) + sizeof(uint32_t);
+  uint32_t total_len =
+      sizeof(struct ftest_pcap_epb_head) + captured_len + tail_len;
+
+  struct ftest_pcap_epb_head head = {
+      .header = {.type = PCAPNG_BLOCK_EPB, .total_len = total_len},
+      .epb =
+          {
+              .interface = interface,
+              .ts_high = time_ns >> 32,
+              .ts_low = (uint32_t)time_ns,
+              .captured_len = captured_len,
+              .orig_len = len,
+          },
+  };
+
+  memset(tail, 0, padding_len);
+  uint8_t *pos = ftest_pcap_put_option(tail + padding_len,
+                                       PCAPNG_OPT_EPB_FLAGS, &flags,
+                                       sizeof(flags));
+  pos = ftest_pcap_put_option(pos, PCAPNG_OPT_END, NULL, 0);
+  memcpy(pos, &total_len, sizeof(total_len));
+
+  pthread_mutex_lock(&ftest_pcap_lock);
+  ftest_pcap_put_packet(&head, sizeof(head), frame, captured_len, tail,
+                        tail_len);
+  pthread_mutex_unlock(&ftest_pcap_lock);
+}
+
+/******************************************************************************
+ Command line
+ ******************************************************************************/
+
+static void ftest_pcap_register_options(void) {
+  static struct args_struct_t ftest_pcap_options[] = {
+      {
+          .option = "ftest_pcap_filter",
+          .name = "file",
+          .type = 's',
+          .dest = &ftest_pcap_filter_file,
+          .descript = "Capture only the frames accepted by the classic BPF "
+                      "program in this file, as printed by "
+                      "`tcpdump -ddd <expression>`.",
+      },
+      {
+          .option = "ftest_pcap_snaplen",
+          .name = "bytes",
+          .type = 'u',
+          .dest = &ftest_pcap_snaplen,
+          .descript = "Capture at most this many bytes of every frame, 0 "
+                      "captures whole frames.",
+      },
+      ARG_TABLE_ENDMARKER,
+  };
+
+  nsi_add_command_line_opts(ftest_pcap_options);
+}
+
+NSI_TASK(ftest_pcap_register_options, PRE_BOOT_1, 10);
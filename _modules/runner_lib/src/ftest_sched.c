@@ -1,36 +1,185 @@
 #include "ftest_sched.h"
+#include "ftest_checkpoint.h"
+#include "ftest_eth_buf.h"
+#include "ftest_jobs.h"
+#include "ftest_sched_entity.h"
+#include "ftest_sock_chan.h"
 #include "nsi_hw_scheduler.h"
 #include "nsi_main_semipublic.h"
+#include "nsi_tasks.h"
 #include "nsi_tracing.h"
 #include "nsi_utils.h"
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if CONFIG_FTEST_SHED_PARALLEL
+#include <pthread.h>
+#endif
+
+#ifndef CONFIG_FTEST_SHED_TRACE_FILE
+#define CONFIG_FTEST_SHED_TRACE_FILE "ftest_trace.json"
+#endif
 
 /******************************************************************************
  Structures
  ******************************************************************************/
 
+struct ftest_shed_trace_record {
+  const char *name;
+  uint64_t order;
+  uint64_t start_time;
+  uint64_t end_time;
+  uint64_t wall_start_ns;
+  uint64_t wall_ns;
+  uint64_t event_count;
+};
+
+struct ftest_shed_deferred {
+  uint64_t time;
+  ftest_shed_deferred_func_t func;
+  uint32_t len;
+  size_t offset;
+};
+
+enum ftest_shed_entity_state {
+  FTEST_SHED_ENTITY_FREE,
+  FTEST_SHED_ENTITY_PENDING,
+  FTEST_SHED_ENTITY_SCHEDULED,
+  FTEST_SHED_ENTITY_SUSPENDED,
+};
+
 struct ftest_shed_entity_entry {
   struct ftest_shed_entity_config *entity_config;
+  enum ftest_shed_entity_state state;
+  uint64_t order;
   uint64_t init_time;
-  bool initialized;
+  uint64_t suspend_time;
+  uint64_t next_event_time;
+  uint64_t horizon;
+  size_t heap_index;
+  bool touched;
+
+  /* Raises an event in the entity when another one has something for it */
+  ftest_shed_doorbell_func_t doorbell;
+
+  /* Earliest ring of the doorbell while suspended, in global time */
+  bool doorbell_pending;
+  uint64_t doorbell_time;
+
+  /* Link in either the free list or the list of entities pending init */
+  struct ftest_shed_entity_entry *next;
+
+#if CONFIG_FTEST_SHED_BOOT_PROFILE
+  uint64_t init_ns;
+  bool dispatched;
+#endif
+
+#if CONFIG_FTEST_SHED_PARALLEL
+  /* Effects on other entities, staged while executing in a parallel window */
+  bool staging;
+  struct ftest_shed_deferred *deferred;
+  size_t deferred_count;
+  size_t deferred_capacity;
+  size_t deferred_head;
+  uint8_t *deferred_data;
+  size_t deferred_data_size;
+  size_t deferred_data_capacity;
+#endif
 };
 
 /******************************************************************************
  Data
  ******************************************************************************/
 
+/**
+ * Every entry ever allocated. Entries are never moved, as entities keep
+ * pointers to them, and removed entries are recycled through the free list.
+ * The tables below all grow together with this one.
+ */
+static size_t ftest_shed_capacity = 0;
 static size_t ftest_shed_entity_count = 0;
-static struct ftest_shed_entity_entry entities[CONFIG_FTEST_SHED_MAX_ENTITIES];
+static size_t ftest_shed_allocated_count = 0;
+static struct ftest_shed_entity_entry **entities = NULL;
+static struct ftest_shed_entity_entry *ftest_shed_free_list = NULL;
+
+static uint64_t ftest_shed_next_order = 0;
+static struct ftest_shed_entity_entry *ftest_shed_runner = NULL;
+
+static struct ftest_shed_entity_entry *ftest_shed_pending_head = NULL;
+static struct ftest_shed_entity_entry *ftest_shed_pending_tail = NULL;
+
+/**
+ * Min-heap of scheduled entities, keyed by their cached next event time.
+ * Ties are broken by the registration order, so the dispatch order is the
+ * same as the one of a linear scan over the entities.
+ */
+static size_t ftest_shed_heap_size = 0;
+static struct ftest_shed_entity_entry **heap = NULL;
+
+/**
+ * Entities whose timeline was changed from outside of their own execution,
+ * and whose heap key has to be refreshed before the next selection.
+ */
+static size_t ftest_shed_touched_count = 0;
+static struct ftest_shed_entity_entry **touched = NULL;
+
+/**
+ * The entity being initialized or dispatched from the scheduler thread.
+ */
+static struct ftest_shed_entity_entry *ftest_shed_current = NULL;
+
+/**
+ * The smallest virtual latency of any interaction between entities, as
+ * declared by the entities themselves. NSI_NEVER if they do not interact.
+ */
+static uint64_t ftest_shed_lookahead = NSI_NEVER;
+
+static uint64_t ftest_shed_start_ns;
 
 static struct ftest_shed_entity_config runner_entity = {
+    .name = "runner",
     .init_func = nsi_init,
     .exec_func = nsi_hws_one_event,
     .find_next_event = nsi_hws_find_next_event,
     .get_next_event_time = nsi_hws_get_next_event_time,
+    .get_time = nsi_hws_get_time,
 };
 
+#if CONFIG_FTEST_SHED_PARALLEL
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static bool pool_started = false;
+static unsigned pool_generation = 0;
+static uint64_t pool_window_end;
+static size_t pool_job_count = 0;
+static size_t pool_next_job = 0;
+static size_t pool_finished_jobs = 0;
+static struct ftest_shed_entity_entry **pool_jobs = NULL;
+static size_t *pool_collect_stack = NULL;
+
+/* End of the parallel window whose deferred effects are being applied */
+static uint64_t pool_flush_end = 0;
+#endif
+
+#if CONFIG_FTEST_SHED_STATS
+static uint64_t ftest_shed_dispatch_count = 0;
+#endif
+
+#if CONFIG_FTEST_SHED_TRACE
+static struct ftest_shed_trace_record *trace_records = NULL;
+static size_t trace_record_count = 0;
+static size_t trace_record_capacity = 0;
+static size_t trace_dropped_count = 0;
+#if CONFIG_FTEST_SHED_PARALLEL
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+#endif
+
 /******************************************************************************
  Utils
  ******************************************************************************/
@@ -38,67 +187,1133 @@ static struct ftest_shed_entity_config runner_entity = {
 bool ftest_shed_is_valid_entity(struct ftest_shed_entity_config *entity) {
   return entity != NULL && entity->init_func != NULL &&
          entity->exec_func != NULL && entity->find_next_event != NULL &&
-         entity->get_next_event_time != NULL;
+         entity->get_next_event_time != NULL && entity->get_time != NULL;
+}
+
+static struct ftest_shed_entity_entry *
+ftest_shed_find_entry(const struct ftest_shed_entity_config *entity_config) {
+  struct ftest_shed_entity_entry *entry = entity_config->entry;
+
+  if (entry == NULL || entry->state == FTEST_SHED_ENTITY_FREE ||
+      entry->entity_config != entity_config) {
+    return NULL;
+  }
+
+  return entry;
+}
+
+static void *ftest_shed_grow_table(void *table, size_t capacity,
+                                   size_t entry_size) {
+  void *grown = realloc(table, capacity * entry_size);
+
+  if (grown == NULL) {
+    nsi_print_error_and_exit("FTEST scheduler out of memory\n");
+  }
+
+  return grown;
+}
+
+static void ftest_shed_reserve(size_t count) {
+  if (count <= ftest_shed_capacity) {
+    return;
+  }
+
+  size_t capacity = ftest_shed_capacity ? ftest_shed_capacity
+                                        : CONFIG_FTEST_SHED_INITIAL_ENTITIES;
+
+  while (capacity < count) {
+    capacity *= 2;
+  }
+
+  entities = ftest_shed_grow_table(entities, capacity, sizeof(*entities));
+  heap = ftest_shed_grow_table(heap, capacity, sizeof(*heap));
+  touched = ftest_shed_grow_table(touched, capacity, sizeof(*touched));
+
+#if CONFIG_FTEST_SHED_PARALLEL
+  pool_jobs = ftest_shed_grow_table(pool_jobs, capacity, sizeof(*pool_jobs));
+  pool_collect_stack = ftest_shed_grow_table(
+      pool_collect_stack, 2 * capacity + 1, sizeof(*pool_collect_stack));
+#endif
+
+  ftest_shed_capacity = capacity;
+}
+
+static struct ftest_shed_entity_entry *ftest_shed_alloc_entry(void) {
+  struct ftest_shed_entity_entry *entry = ftest_shed_free_list;
+
+  if (entry != NULL) {
+    ftest_shed_free_list = entry->next;
+    return entry;
+  }
+
+  ftest_shed_reserve(ftest_shed_allocated_count + 1);
+
+  entry = calloc(1, sizeof(*entry));
+
+  if (entry == NULL) {
+    nsi_print_error_and_exit("FTEST scheduler out of memory\n");
+  }
+
+  entities[ftest_shed_allocated_count++] = entry;
+
+  return entry;
+}
+
+static void ftest_shed_free_entry(struct ftest_shed_entity_entry *entry) {
+  if (entry->touched) {
+    for (size_t i = 0; i < ftest_shed_touched_count; i++) {
+      if (touched[i] == entry) {
+        touched[i] = touched[--ftest_shed_touched_count];
+        break;
+      }
+    }
+
+    entry->touched = false;
+  }
+
+  entry->entity_config->entry = NULL;
+  entry->state = FTEST_SHED_ENTITY_FREE;
+  entry->entity_config = NULL;
+  entry->next = ftest_shed_free_list;
+  ftest_shed_free_list = entry;
+}
+
+static void ftest_shed_unlink_pending(struct ftest_shed_entity_entry *entry) {
+  struct ftest_shed_entity_entry **link = &ftest_shed_pending_head;
+  struct ftest_shed_entity_entry *previous = NULL;
+
+  while (*link != NULL && *link != entry) {
+    previous = *link;
+    link = &(*link)->next;
+  }
+
+  if (*link == NULL) {
+    return;
+  }
+
+  *link = entry->next;
+
+  if (ftest_shed_pending_tail == entry) {
+    ftest_shed_pending_tail = previous;
+  }
+}
+
+static uint64_t
+ftest_shed_query_next_event_time(const struct ftest_shed_entity_entry *entity) {
+  uint64_t event_time = entity->entity_config->get_next_event_time();
+
+  if (event_time == NSI_NEVER) {
+    return NSI_NEVER;
+  }
+
+  return entity->init_time + event_time;
+}
+
+/**
+ * Convert a global virtual time into the local time of the entity.
+ */
+static uint64_t ftest_shed_to_entity_time(struct ftest_shed_entity_entry *entity,
+                                          uint64_t time) {
+  if (time == NSI_NEVER) {
+    return NSI_NEVER;
+  }
+
+  return time - entity->init_time;
+}
+
+static void ftest_shed_mark_touched(struct ftest_shed_entity_entry *entity) {
+  if (entity->state != FTEST_SHED_ENTITY_SCHEDULED || entity->touched) {
+    return;
+  }
+
+  entity->touched = true;
+  touched[ftest_shed_touched_count++] = entity;
+}
+
+/******************************************************************************
+ Heap
+ ******************************************************************************/
+
+static bool heap_less(const struct ftest_shed_entity_entry *a,
+                      const struct ftest_shed_entity_entry *b) {
+  if (a->next_event_time != b->next_event_time) {
+    return a->next_event_time < b->next_event_time;
+  }
+
+  return a->order < b->order;
+}
+
+static void heap_place(size_t index, struct ftest_shed_entity_entry *entity) {
+  heap[index] = entity;
+  entity->heap_index = index;
+}
+
+static void heap_sift_up(size_t index) {
+  struct ftest_shed_entity_entry *entity = heap[index];
+
+  while (index > 0) {
+    size_t parent = (index - 1) / 2;
+
+    if (!heap_less(entity, heap[parent])) {
+      break;
+    }
+
+    heap_place(index, heap[parent]);
+    index = parent;
+  }
+
+  heap_place(index, entity);
+}
+
+static void heap_sift_down(size_t index) {
+  struct ftest_shed_entity_entry *entity = heap[index];
+
+  while (true) {
+    size_t child = 2 * index + 1;
+
+    if (child >= ftest_shed_heap_size) {
+      break;
+    }
+
+    if (child + 1 < ftest_shed_heap_size &&
+        heap_less(heap[child + 1], heap[child])) {
+      child++;
+    }
+
+    if (!heap_less(heap[child], entity)) {
+      break;
+    }
+
+    heap_place(index, heap[child]);
+    index = child;
+  }
+
+  heap_place(index, entity);
+}
+
+static void heap_push(struct ftest_shed_entity_entry *entity) {
+  heap_place(ftest_shed_heap_size++, entity);
+  heap_sift_up(entity->heap_index);
+}
+
+static void heap_remove(struct ftest_shed_entity_entry *entity) {
+  size_t index = entity->heap_index;
+  struct ftest_shed_entity_entry *last = heap[--ftest_shed_heap_size];
+
+  if (last == entity) {
+    return;
+  }
+
+  heap_place(index, last);
+  heap_sift_up(index);
+  heap_sift_down(last->heap_index);
+}
+
+static void heap_update(struct ftest_shed_entity_entry *entity) {
+  uint64_t event_time = ftest_shed_query_next_event_time(entity);
+
+  if (event_time == entity->next_event_time) {
+    return;
+  }
+
+  bool earlier = event_time < entity->next_event_time;
+  entity->next_event_time = event_time;
+
+  if (earlier) {
+    heap_sift_up(entity->heap_index);
+  } else {
+    heap_sift_down(entity->heap_index);
+  }
 }
 
 /******************************************************************************
  API
  ******************************************************************************/
 
+uint64_t ftest_shed_get_wall_time_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
 int ftest_add_entity_to_schedule(
     struct ftest_shed_entity_config *entity_config) {
 
-  if (ftest_shed_entity_count >= CONFIG_FTEST_SHED_MAX_ENTITIES) {
-    errno = ENOMEM;
-    return -1;
+  if (!ftest_shed_is_valid_entity(entity_config)) {
+    return -EINVAL;
   }
 
-  if (!ftest_shed_is_valid_entity(entity_config)) {
-    errno = EINVAL;
-    return -1;
+  if (ftest_shed_find_entry(entity_config) != NULL) {
+    return -EEXIST;
   }
 
-  struct ftest_shed_entity_entry *new_entry =
-      &entities[ftest_shed_entity_count++];
+  struct ftest_shed_entity_entry *new_entry = ftest_shed_alloc_entry();
 
   new_entry->entity_config = entity_config;
-  new_entry->initialized = false;
+  entity_config->entry = new_entry;
+  new_entry->state = FTEST_SHED_ENTITY_PENDING;
+  new_entry->order = ftest_shed_next_order++;
+  new_entry->touched = false;
+  new_entry->doorbell = NULL;
+  new_entry->doorbell_pending = false;
+  new_entry->next = NULL;
+  ftest_shed_entity_count++;
+
+  if (ftest_shed_pending_tail != NULL) {
+    ftest_shed_pending_tail->next = new_entry;
+  } else {
+    ftest_shed_pending_head = new_entry;
+  }
+  ftest_shed_pending_tail = new_entry;
+
+  if (ftest_shed_runner == NULL) {
+    ftest_shed_runner = new_entry;
+  }
+
+  return 0;
+}
+
+int ftest_remove_entity_from_schedule(
+    const struct ftest_shed_entity_config *entity_config) {
+  struct ftest_shed_entity_entry *entity = ftest_shed_find_entry(entity_config);
+
+  if (entity == NULL) {
+    return -ENOENT;
+  }
+
+  if (entity == ftest_shed_runner) {
+    return -EPERM;
+  }
+
+  switch (entity->state) {
+  case FTEST_SHED_ENTITY_PENDING:
+    ftest_shed_unlink_pending(entity);
+    break;
+  case FTEST_SHED_ENTITY_SCHEDULED:
+    heap_remove(entity);
+    break;
+  default:
+    break;
+  }
+
+  /* The entry is reused by the next entity added, which the network must not
+   * wake up in place of this one */
+  ftest_eth_buf_detach_entity(entity);
+  ftest_sock_chan_detach_entity(entity);
+
+  ftest_shed_free_entry(entity);
+  ftest_shed_entity_count--;
+
+  return 0;
+}
+
+int ftest_shed_suspend_entity(
+    const struct ftest_shed_entity_config *entity_config) {
+  struct ftest_shed_entity_entry *entity = ftest_shed_find_entry(entity_config);
+
+  if (entity == NULL) {
+    return -ENOENT;
+  }
+
+  if (entity == ftest_shed_runner) {
+    return -EPERM;
+  }
+
+  if (entity->state == FTEST_SHED_ENTITY_SUSPENDED) {
+    return 0;
+  }
+
+  if (entity->state != FTEST_SHED_ENTITY_SCHEDULED) {
+    return -EAGAIN;
+  }
+
+  heap_remove(entity);
+  entity->state = FTEST_SHED_ENTITY_SUSPENDED;
+  entity->suspend_time = ftest_shed_get_time(ftest_shed_runner);
+
+  return 0;
+}
+
+int ftest_shed_resume_entity(
+    const struct ftest_shed_entity_config *entity_config) {
+  struct ftest_shed_entity_entry *entity = ftest_shed_find_entry(entity_config);
+
+  if (entity == NULL) {
+    return -ENOENT;
+  }
+
+  if (entity->state != FTEST_SHED_ENTITY_SUSPENDED) {
+    return 0;
+  }
+
+  /* The entity's clock stood still while it was suspended, so its timeline is
+   * shifted by the time it spent out of the schedule */
+  entity->init_time +=
+      ftest_shed_get_time(ftest_shed_runner) - entity->suspend_time;
+  entity->state = FTEST_SHED_ENTITY_SCHEDULED;
+
+  /* What arrived while the entity was suspended is seen when it resumes */
+  if (entity->doorbell_pending && entity->doorbell != NULL) {
+    uint64_t time = ftest_shed_get_time(ftest_shed_runner);
+
+    if (entity->doorbell_time > time) {
+      time = entity->doorbell_time;
+    }
+
+    entity->doorbell_pending = false;
+    entity->doorbell(ftest_shed_to_entity_time(entity, time));
+  }
+
+  entity->next_event_time = ftest_shed_query_next_event_time(entity);
+
+  heap_push(entity);
+
+  return 0;
+}
+
+int ftest_shed_entity_touched(
+    const struct ftest_shed_entity_config *entity_config) {
+  struct ftest_shed_entity_entry *entity = ftest_shed_find_entry(entity_config);
+
+  if (entity == NULL) {
+    return -ENOENT;
+  }
+
+  ftest_shed_mark_touched(entity);
+
+  return 0;
+}
+
+struct ftest_shed_entity_entry *ftest_shed_get_current_entity(void) {
+  return ftest_shed_current;
+}
+
+uint64_t ftest_shed_get_time(const struct ftest_shed_entity_entry *entity) {
+  if (entity == NULL) {
+    return 0;
+  }
+
+  return entity->init_time + entity->entity_config->get_time();
+}
+
+const char *
+ftest_shed_get_entity_name(const struct ftest_shed_entity_entry *entity) {
+  if (entity == NULL) {
+    return NULL;
+  }
+
+  return entity->entity_config->name;
+}
+
+uint32_t ftest_shed_get_instance(const struct ftest_shed_entity_entry *entity) {
+  if (entity == NULL) {
+    return 0;
+  }
+
+  return entity->entity_config->instance;
+}
+
+void ftest_shed_declare_lookahead(uint64_t lookahead) {
+  if (lookahead < ftest_shed_lookahead) {
+    ftest_shed_lookahead = lookahead;
+  }
+}
+
+uint64_t ftest_shed_get_lookahead(void) { return ftest_shed_lookahead; }
+
+#if CONFIG_FTEST_SHED_PARALLEL
+static int ftest_shed_stage(struct ftest_shed_entity_entry *entity,
+                            ftest_shed_deferred_func_t func, const void *data,
+                            uint32_t len) {
+  if (entity->deferred_count == entity->deferred_capacity) {
+    size_t capacity =
+        entity->deferred_capacity ? 2 * entity->deferred_capacity : 16;
+    void *deferred =
+        realloc(entity->deferred, capacity * sizeof(*entity->deferred));
+
+    if (deferred == NULL) {
+      return -ENOMEM;
+    }
+
+    entity->deferred = deferred;
+    entity->deferred_capacity = capacity;
+  }
+
+  if (entity->deferred_data_size + len > entity->deferred_data_capacity) {
+    size_t capacity = entity->deferred_data_capacity
+                          ? 2 * entity->deferred_data_capacity
+                          : 4096;
+
+    while (capacity < entity->deferred_data_size + len) {
+      capacity *= 2;
+    }
+
+    void *deferred_data = realloc(entity->deferred_data, capacity);
+
+    if (deferred_data == NULL) {
+      return -ENOMEM;
+    }
+
+    entity->deferred_data = deferred_data;
+    entity->deferred_data_capacity = capacity;
+  }
+
+  entity->deferred[entity->deferred_count++] = (struct ftest_shed_deferred){
+      .time = ftest_shed_get_time(entity),
+      .func = func,
+      .len = len,
+      .offset = entity->deferred_data_size,
+  };
+
+  memcpy(entity->deferred_data + entity->deferred_data_size, data, len);
+  entity->deferred_data_size += len;
 
   return 0;
 }
+#endif
+
+bool ftest_shed_is_deferring(const struct ftest_shed_entity_entry *entity) {
+#if CONFIG_FTEST_SHED_PARALLEL
+  return entity != NULL && entity->staging;
+#else
+  NSI_ARG_UNUSED(entity);
+  return false;
+#endif
+}
+
+int ftest_shed_defer(struct ftest_shed_entity_entry *entity,
+                     ftest_shed_deferred_func_t func, const void *data,
+                     uint32_t len) {
+  if (func == NULL || (data == NULL && len > 0)) {
+    return -EINVAL;
+  }
+
+#if CONFIG_FTEST_SHED_PARALLEL
+  if (entity != NULL && entity->staging) {
+    return ftest_shed_stage(entity, func, data, len);
+  }
+#else
+  NSI_ARG_UNUSED(entity);
+#endif
+
+  return func(data, len);
+}
+
+int ftest_shed_set_doorbell(struct ftest_shed_entity_entry *entity,
+                            ftest_shed_doorbell_func_t doorbell) {
+  if (entity == NULL) {
+    return -EINVAL;
+  }
+
+  entity->doorbell = doorbell;
+
+  return 0;
+}
+
+#if CONFIG_FTEST_SHED_BATCH
+/**
+ * Keep the entity executing a batch from running past the time at which
+ * another entity was woken up.
+ */
+static void ftest_shed_limit_horizon(struct ftest_shed_entity_entry *woken,
+                                     uint64_t time) {
+  struct ftest_shed_entity_entry *current = ftest_shed_current;
+
+  if (current == NULL || current == woken) {
+    return;
+  }
+
+  uint64_t horizon = ftest_shed_to_entity_time(
+      current, time + (current->order < woken->order ? 1 : 0));
+
+  if (horizon < current->horizon) {
+    current->horizon = horizon;
+  }
+}
+#endif
+
+int ftest_shed_ring_doorbell(struct ftest_shed_entity_entry *entity,
+                             uint64_t time) {
+  if (entity == NULL) {
+    return -EINVAL;
+  }
+
+  if (entity->state == FTEST_SHED_ENTITY_FREE || entity->doorbell == NULL) {
+    return 0;
+  }
+
+#if CONFIG_FTEST_SHED_PARALLEL
+  /* The entity may have run up to the end of the window already, and would
+   * only see the ring later than the serial scheduler would have rung it */
+  if (time < pool_flush_end) {
+    nsi_print_error_and_exit(
+        "FTEST scheduler: doorbell of %s rung for %llu, within the parallel "
+        "window ending at %llu. The latency between entities is shorter "
+        "than the lookahead they declared\n",
+        entity->entity_config->name, (unsigned long long)time,
+        (unsigned long long)pool_flush_end);
+  }
+#endif
+
+  /* The timeline of a suspended entity is only known once it resumes */
+  if (entity->state == FTEST_SHED_ENTITY_SUSPENDED) {
+    if (!entity->doorbell_pending || time < entity->doorbell_time) {
+      entity->doorbell_pending = true;
+      entity->doorbell_time = time;
+    }
+
+    return 0;
+  }
+
+  entity->doorbell(ftest_shed_to_entity_time(entity, time));
+  ftest_shed_mark_touched(entity);
+
+#if CONFIG_FTEST_SHED_BATCH
+  ftest_shed_limit_horizon(entity, time);
+#endif
+
+  return 0;
+}
+
+/******************************************************************************
+ Scheduling
+ ******************************************************************************/
+
+static void ftest_shed_init_pending_entities(int argc, char *argv[]) {
+  /* Initializing an entity may register new ones (the runner loads the
+   * entity libraries during its own boot), which are appended to the pending
+   * list and initialized by this same loop */
+  while (ftest_shed_pending_head != NULL) {
+    struct ftest_shed_entity_entry *entity = ftest_shed_pending_head;
+
+    ftest_shed_pending_head = entity->next;
+    if (ftest_shed_pending_head == NULL) {
+      ftest_shed_pending_tail = NULL;
+    }
+
+    entity->init_time = nsi_hws_get_time();
+
+#if CONFIG_FTEST_SHED_BOOT_PROFILE
+    uint64_t init_start_ns = ftest_shed_get_wall_time_ns();
+#endif
+
+    ftest_shed_current = entity;
+    entity->entity_config->init_func(argc, argv);
+    ftest_shed_current = NULL;
+
+#if CONFIG_FTEST_SHED_BOOT_PROFILE
+    entity->init_ns = ftest_shed_get_wall_time_ns() - init_start_ns;
+    entity->dispatched = false;
+#endif
+
+    entity->state = FTEST_SHED_ENTITY_SCHEDULED;
+    entity->next_event_time = ftest_shed_query_next_event_time(entity);
+
+    heap_push(entity);
+  }
+}
+
+static void ftest_shed_refresh_touched_entities(void) {
+  for (size_t i = 0; i < ftest_shed_touched_count; i++) {
+    touched[i]->touched = false;
+
+    if (touched[i]->state == FTEST_SHED_ENTITY_SCHEDULED) {
+      heap_update(touched[i]);
+    }
+  }
+
+  ftest_shed_touched_count = 0;
+}
 
 static struct ftest_shed_entity_entry *
 get_next_scheduled_entity_init_if_needed(int argc, char *argv[]) {
-  uint64_t next_event_time = NSI_NEVER;
-  struct ftest_shed_entity_entry *next_entity = NULL;
+  ftest_shed_init_pending_entities(argc, argv);
+
+  return heap[0];
+}
+
+#if CONFIG_FTEST_SHED_BOOT_PROFILE
+static void
+ftest_shed_profile_dispatch(struct ftest_shed_entity_entry *entity) {
+  if (entity->dispatched) {
+    return;
+  }
+
+  entity->dispatched = true;
+
+  const struct ftest_shed_entity_config *config = entity->entity_config;
+  uint64_t first_event_ns =
+      ftest_shed_get_wall_time_ns() - ftest_shed_start_ns;
+
+  nsi_print_trace("FTEST boot: %s: dlopen %.3f ms, symbols %.3f ms, "
+                  "nsi_init %.3f ms, first event after %.3f ms\n",
+                  config->name ? config->name : "<unnamed>",
+                  config->load_profile.dlopen_ns / 1e6,
+                  config->load_profile.resolve_ns / 1e6, entity->init_ns / 1e6,
+                  first_event_ns / 1e6);
+}
+#endif
+
+#if CONFIG_FTEST_SHED_TRACE
+/**
+ * Record one dispatch of the entity, which started executing at the given
+ * virtual and wall-clock times.
+ */
+static void ftest_shed_trace(struct ftest_shed_entity_entry *entity,
+                             uint64_t start_time, uint64_t wall_start_ns,
+                             uint64_t event_count) {
+  struct ftest_shed_trace_record record = {
+      .name = entity->entity_config->name,
+      .order = entity->order,
+      .start_time = start_time,
+      .end_time = ftest_shed_get_time(entity),
+      .wall_start_ns = wall_start_ns - ftest_shed_start_ns,
+      .wall_ns = ftest_shed_get_wall_time_ns() - wall_start_ns,
+      .event_count = event_count,
+  };
+
+#if CONFIG_FTEST_SHED_PARALLEL
+  pthread_mutex_lock(&trace_lock);
+#endif
+
+  if (trace_record_count == trace_record_capacity) {
+    size_t capacity = trace_record_capacity ? trace_record_capacity * 2 : 4096;
+    void *grown = realloc(trace_records, capacity * sizeof(*trace_records));
+
+    if (grown != NULL) {
+      trace_records = grown;
+      trace_record_capacity = capacity;
+    }
+  }
+
+  if (trace_record_count < trace_record_capacity) {
+    trace_records[trace_record_count++] = record;
+  } else {
+    trace_dropped_count++;
+  }
+
+#if CONFIG_FTEST_SHED_PARALLEL
+  pthread_mutex_unlock(&trace_lock);
+#endif
+}
+#endif
+
+#if CONFIG_FTEST_SHED_BATCH
+/**
+ * Get the time up to which the entity at the top of the heap may execute its
+ * events without any other entity becoming due. Events at the same time as
+ * the ones of another entity are only included if the entity was registered
+ * earlier, as the serial dispatch order would run them first.
+ */
+static uint64_t ftest_shed_get_horizon(struct ftest_shed_entity_entry *entity) {
+  struct ftest_shed_entity_entry *second = NULL;
+
+  for (size_t i = 1; i <= 2 && i < ftest_shed_heap_size; i++) {
+    if (second == NULL || heap_less(heap[i], second)) {
+      second = heap[i];
+    }
+  }
+
+  if (second == NULL || second->next_event_time == NSI_NEVER) {
+    return NSI_NEVER;
+  }
+
+  return second->next_event_time + (entity->order < second->order ? 1 : 0);
+}
+
+static bool ftest_shed_can_batch(struct ftest_shed_entity_entry *entity) {
+  /* The runner may touch any entity, so it never runs ahead of the others */
+  return entity != ftest_shed_runner &&
+         entity->entity_config->exec_until_func != NULL;
+}
+#endif
+
+static void ftest_shed_dispatch(struct ftest_shed_entity_entry *entity) {
+  uint64_t event_count = 1;
+
+#if CONFIG_FTEST_SHED_BOOT_PROFILE
+  ftest_shed_profile_dispatch(entity);
+#endif
+
+#if CONFIG_FTEST_SHED_TRACE
+  uint64_t trace_start_time = entity->next_event_time;
+  uint64_t trace_start_ns = ftest_shed_get_wall_time_ns();
+#endif
+
+  ftest_shed_current = entity;
+
+#if CONFIG_FTEST_SHED_BATCH
+  if (ftest_shed_can_batch(entity)) {
+    entity->horizon =
+        ftest_shed_to_entity_time(entity, ftest_shed_get_horizon(entity));
+    event_count = entity->entity_config->exec_until_func(&entity->horizon);
+  } else {
+    entity->entity_config->exec_func();
+  }
+#else
+  entity->entity_config->exec_func();
+#endif
+
+  ftest_shed_current = NULL;
+
+#if CONFIG_FTEST_SHED_TRACE
+  ftest_shed_trace(entity, trace_start_time, trace_start_ns, event_count);
+#endif
+
+#if CONFIG_FTEST_SHED_STATS
+  ftest_shed_dispatch_count += event_count;
+#else
+  (void)event_count;
+#endif
+
+  heap_update(entity);
+  ftest_shed_refresh_touched_entities();
+}
+
+/******************************************************************************
+ Parallel execution
+
+ Entities which are not the runner only affect each other through functions
+ passed to ftest_shed_defer(), and no such effect becomes visible earlier than
+ the declared lookahead after it was caused. Every entity whose next event
+ falls into [T, T + lookahead), where T is the earliest pending event, can
+ therefore run all of its events in that window independently of the others.
+ The window is also cut at the runner's next event, as the runner may touch
+ any entity. The deferred effects are then applied in (time, entity) order,
+ which is the order the serial scheduler would have produced.
 
-  for (size_t i = 0; i < ftest_shed_entity_count; i++) {
-    struct ftest_shed_entity_entry *entity = &entities[i];
+ This is only exact if the effects are not observed earlier than the
+ lookahead either. Doorbells rung by the deferred effects are checked to be
+ at or after the end of the window, as every entity of the window has run up
+ to it already. Data published by them, such as the frames written to the
+ rings of the network, is visible earlier with the serial scheduler, so the
+ receivers leave it alone until the lookahead after it was sent.
+ ******************************************************************************/
+
+#if CONFIG_FTEST_SHED_PARALLEL
+static void ftest_shed_run_until(struct ftest_shed_entity_entry *entity,
+                                 uint64_t window_end) {
+  uint64_t event_count = 0;
+
+#if CONFIG_FTEST_SHED_BOOT_PROFILE
+  ftest_shed_profile_dispatch(entity);
+#endif
+
+#if CONFIG_FTEST_SHED_TRACE
+  uint64_t trace_start_time = entity->next_event_time;
+  uint64_t trace_start_ns = ftest_shed_get_wall_time_ns();
+#endif
+
+  if (entity->entity_config->exec_until_func != NULL) {
+    entity->horizon = ftest_shed_to_entity_time(entity, window_end);
+    event_count = entity->entity_config->exec_until_func(&entity->horizon);
+  } else {
+    uint64_t event_time = entity->next_event_time;
+
+    while (event_time < window_end) {
+      entity->entity_config->exec_func();
+      event_count++;
+      event_time = ftest_shed_query_next_event_time(entity);
+    }
+  }
+
+#if CONFIG_FTEST_SHED_TRACE
+  ftest_shed_trace(entity, trace_start_time, trace_start_ns, event_count);
+#endif
+
+#if CONFIG_FTEST_SHED_STATS
+  __atomic_fetch_add(&ftest_shed_dispatch_count, event_count, __ATOMIC_RELAXED);
+#else
+  (void)event_count;
+#endif
+}
+
+static void ftest_shed_pool_work(void) {
+  while (true) {
+    pthread_mutex_lock(&pool_lock);
+
+    if (pool_next_job >= pool_job_count) {
+      pthread_mutex_unlock(&pool_lock);
+      return;
+    }
+
+    struct ftest_shed_entity_entry *entity = pool_jobs[pool_next_job++];
+    uint64_t window_end = pool_window_end;
+    pthread_mutex_unlock(&pool_lock);
+
+    ftest_shed_run_until(entity, window_end);
+
+    pthread_mutex_lock(&pool_lock);
+    if (++pool_finished_jobs == pool_job_count) {
+      pthread_cond_signal(&pool_done);
+    }
+    pthread_mutex_unlock(&pool_lock);
+  }
+}
+
+static void *ftest_shed_pool_worker(void *arg) {
+  NSI_ARG_UNUSED(arg);
+  unsigned seen_generation = 0;
+
+  while (true) {
+    pthread_mutex_lock(&pool_lock);
+    while (pool_generation == seen_generation) {
+      pthread_cond_wait(&pool_start, &pool_lock);
+    }
+    seen_generation = pool_generation;
+    pthread_mutex_unlock(&pool_lock);
+
+    ftest_shed_pool_work();
+  }
+
+  return NULL;
+}
+
+static void ftest_shed_pool_start(void) {
+  /* The scheduler thread is a worker as well */
+  for (int i = 0; i < CONFIG_FTEST_SHED_WORKERS - 1; i++) {
+    pthread_t thread;
+
+    if (pthread_create(&thread, NULL, ftest_shed_pool_worker, NULL) != 0) {
+      nsi_print_error_and_exit("Unable to start FTEST scheduler worker %d\n",
+                               i);
+    }
+
+    pthread_detach(thread);
+  }
+
+  pool_started = true;
+}
+
+static void ftest_shed_pool_run(size_t job_count, uint64_t window_end) {
+  if (!pool_started) {
+    ftest_shed_pool_start();
+  }
+
+  pthread_mutex_lock(&pool_lock);
+  pool_job_count = job_count;
+  pool_next_job = 0;
+  pool_finished_jobs = 0;
+  pool_window_end = window_end;
+  pool_generation++;
+  pthread_cond_broadcast(&pool_start);
+  pthread_mutex_unlock(&pool_lock);
+
+  ftest_shed_pool_work();
+
+  pthread_mutex_lock(&pool_lock);
+  while (pool_finished_jobs < pool_job_count) {
+    pthread_cond_wait(&pool_done, &pool_lock);
+  }
+  pthread_mutex_unlock(&pool_lock);
+}
+
+static size_t ftest_shed_collect_window(uint64_t window_end) {
+  size_t job_count = 0;
+  size_t *stack = pool_collect_stack;
+  size_t stack_size = 0;
+
+  stack[stack_size++] = 0;
+
+  while (stack_size > 0) {
+    size_t index = stack[--stack_size];
+
+    if (index >= ftest_shed_heap_size ||
+        heap[index]->next_event_time >= window_end) {
+      continue;
+    }
+
+    pool_jobs[job_count++] = heap[index];
+    stack[stack_size++] = 2 * index + 1;
+    stack[stack_size++] = 2 * index + 2;
+  }
+
+  return job_count;
+}
+
+static void ftest_shed_flush_deferred(size_t job_count) {
+  /* Effects applied here take place right away, including the ones they
+   * cause themselves */
+  for (size_t i = 0; i < job_count; i++) {
+    pool_jobs[i]->staging = false;
+  }
+
+  while (true) {
+    struct ftest_shed_entity_entry *next = NULL;
+    const struct ftest_shed_deferred *next_deferred = NULL;
+
+    for (size_t i = 0; i < job_count; i++) {
+      struct ftest_shed_entity_entry *entity = pool_jobs[i];
+
+      if (entity->deferred_head >= entity->deferred_count) {
+        continue;
+      }
+
+      const struct ftest_shed_deferred *deferred =
+          &entity->deferred[entity->deferred_head];
+
+      if (next == NULL || deferred->time < next_deferred->time ||
+          (deferred->time == next_deferred->time &&
+           entity->order < next->order)) {
+        next = entity;
+        next_deferred = deferred;
+      }
+    }
 
-    if (!entity->initialized) {
-      entity->entity_config->init_func(argc, argv);
-      entity->init_time = nsi_hws_get_time();
-      entity->initialized = true;
+    if (next == NULL) {
+      break;
     }
 
-    uint64_t event_time =
-        entity->init_time + entity->entity_config->get_next_event_time();
+    next_deferred->func(next->deferred_data + next_deferred->offset,
+                        next_deferred->len);
+    next->deferred_head++;
+  }
+
+  for (size_t i = 0; i < job_count; i++) {
+    struct ftest_shed_entity_entry *entity = pool_jobs[i];
+
+    entity->deferred_count = 0;
+    entity->deferred_head = 0;
+    entity->deferred_data_size = 0;
+  }
+}
+
+/**
+ * Run every entity with an event in the current lookahead window on the
+ * worker pool. Returns false if the next event has to be dispatched serially.
+ */
+static bool ftest_shed_run_parallel_window(void) {
+  struct ftest_shed_entity_entry *first = heap[0];
+  struct ftest_shed_entity_entry *runner = ftest_shed_runner;
 
-    if (next_entity == NULL || event_time < next_event_time) {
-      next_entity = entity;
-      next_event_time = event_time;
+  if (first == runner || ftest_shed_lookahead == 0) {
+    return false;
+  }
+
+  uint64_t window_end = runner->next_event_time;
+
+  if (ftest_shed_lookahead != NSI_NEVER &&
+      first->next_event_time + ftest_shed_lookahead < window_end) {
+    window_end = first->next_event_time + ftest_shed_lookahead;
+  }
+
+  size_t job_count = ftest_shed_collect_window(window_end);
+
+  if (job_count < 2) {
+    return false;
+  }
+
+  for (size_t i = 0; i < job_count; i++) {
+    pool_jobs[i]->staging = true;
+  }
+
+  ftest_shed_pool_run(job_count, window_end);
+
+  pool_flush_end = window_end;
+  ftest_shed_flush_deferred(job_count);
+  pool_flush_end = 0;
+
+  for (size_t i = 0; i < job_count; i++) {
+    heap_update(pool_jobs[i]);
+  }
+
+  /* The deferred effects may have woken up entities outside of the window */
+  ftest_shed_refresh_touched_entities();
+
+  return true;
+}
+#endif
+
+/******************************************************************************
+ Statistics
+ ******************************************************************************/
+
+#if CONFIG_FTEST_SHED_STATS
+static void ftest_shed_print_stats(void) {
+  double elapsed =
+      (double)(ftest_shed_get_wall_time_ns() - ftest_shed_start_ns) / 1e9;
+
+  nsi_print_trace("FTEST scheduler: %zu entities, %llu events in %.3f s "
+                  "(%.0f events/s)\n",
+                  ftest_shed_entity_count,
+                  (unsigned long long)ftest_shed_dispatch_count, elapsed,
+                  elapsed > 0 ? (double)ftest_shed_dispatch_count / elapsed
+                              : 0.0);
+}
+
+NSI_TASK(ftest_shed_print_stats, ON_EXIT_PRE, 100);
+#endif
+
+#if CONFIG_FTEST_SHED_TRACE
+/**
+ * Write the recorded dispatches as a Chrome trace-event file, which can be
+ * opened in Perfetto or chrome://tracing. Every entity gets its own track, and
+ * the timeline is in virtual time - the wall-clock cost of every dispatch is
+ * attached to it as an argument.
+ */
+static void ftest_shed_write_trace(void) {
+  char name_buf[256];
+  const char *name = ftest_jobs_file_name(CONFIG_FTEST_SHED_TRACE_FILE,
+                                          name_buf, sizeof(name_buf));
+  FILE *file = fopen(name, "w");
+
+  if (file == NULL) {
+    nsi_print_warning("FTEST scheduler: cannot write %s: %s\n", name,
+                      strerror(errno));
+    return;
+  }
+
+  bool *named = calloc(ftest_shed_next_order ? ftest_shed_next_order : 1,
+                       sizeof(*named));
+
+  fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+  for (size_t i = 0; i < trace_record_count; i++) {
+    const struct ftest_shed_trace_record *record = &trace_records[i];
+
+    if (named != NULL && !named[record->order]) {
+      named[record->order] = true;
+      fprintf(file,
+              "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+              "\"tid\":%llu,\"args\":{\"name\":\"%s\"}},\n",
+              (unsigned long long)record->order,
+              record->name ? record->name : "<unnamed>");
     }
+
+    fprintf(file,
+            "{\"name\":\"dispatch\",\"ph\":\"X\",\"pid\":1,"
+            "\"tid\":%llu,\"ts\":%llu,\"dur\":%llu,\"args\":{"
+            "\"events\":%llu,\"wall_start_us\":%.3f,\"wall_us\":%.3f}},\n",
+            (unsigned long long)record->order,
+            (unsigned long long)record->start_time,
+            (unsigned long long)(record->end_time - record->start_time),
+            (unsigned long long)record->event_count,
+            record->wall_start_ns / 1e3, record->wall_ns / 1e3);
   }
 
-  return next_entity;
+  /* Closes the list without a trailing comma after the last record */
+  fprintf(file,
+          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+          "\"args\":{\"name\":\"FTEST (%zu dispatches dropped)\"}}\n]}\n",
+          trace_dropped_count);
+
+  fclose(file);
+  free(named);
 }
 
+NSI_TASK(ftest_shed_write_trace, ON_EXIT_PRE, 101);
+#endif
+
 /******************************************************************************
  Sheduler loop
  ******************************************************************************/
 
 int main(int argc, char *argv[]) {
 
+  /* Before anything else - the process must still be single threaded */
+  ftest_jobs_fork(argc, argv);
+
   int result = ftest_add_entity_to_schedule(&runner_entity);
 
   if (result < 0) {
@@ -106,12 +1321,24 @@ int main(int argc, char *argv[]) {
         "Catastrophic init failure - unable to shedule the runner.");
   }
 
+  ftest_shed_start_ns = ftest_shed_get_wall_time_ns();
+
   while (true) {
     struct ftest_shed_entity_entry *next_scheduled_entity =
         get_next_scheduled_entity_init_if_needed(argc, argv);
 
-    next_scheduled_entity->entity_config->exec_func();
+#if CONFIG_FTEST_CHECKPOINT
+    ftest_checkpoint_poll(next_scheduled_entity->next_event_time);
+#endif
+
+#if CONFIG_FTEST_SHED_PARALLEL
+    if (ftest_shed_run_parallel_window()) {
+      continue;
+    }
+#endif
+
+    ftest_shed_dispatch(next_scheduled_entity);
   }
 
   NSI_CODE_UNREACHABLE; /* LCOV_EXCL_LINE */
-}
\ No newline at end of file
+}
@@ -0,0 +1,598 @@
+#include "ftest_sock_chan.h"
+#include "ftest_sched_entity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#ifndef CONFIG_FTEST_SOCK_CHAN_RCVBUF
+#define CONFIG_FTEST_SOCK_CHAN_RCVBUF 65536
+#endif
+
+#define FTEST_SOCK_CHAN_EPHEMERAL_FIRST 49152
+#define FTEST_SOCK_CHAN_EPHEMERAL_LAST 65535
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+struct ftest_sock_msg {
+  struct ftest_sock_msg *next;
+  struct ftest_sock_chan_addr src;
+  uint32_t len;
+  /* Bytes of a stream chunk already received */
+  uint32_t offset;
+  uint8_t data[];
+};
+
+struct ftest_sock_chan {
+  enum ftest_sock_chan_type type;
+  struct ftest_shed_entity_entry *entity;
+  struct ftest_sock_chan_addr local;
+  bool bound;
+
+  /* The other end of a stream connection, NULL once it is closed. For a
+   * datagram endpoint, the default destination */
+  struct ftest_sock_chan *peer;
+  struct ftest_sock_chan_addr peer_addr;
+  bool connected;
+  bool peer_closed;
+
+  /* Connections waiting to be accepted by a listening endpoint */
+  bool listening;
+  int backlog;
+  int pending_count;
+  struct ftest_sock_chan *pending_head;
+  struct ftest_sock_chan *pending_tail;
+  struct ftest_sock_chan *next_pending;
+
+  struct ftest_sock_msg *rx_head;
+  struct ftest_sock_msg *rx_tail;
+  uint32_t rx_bytes;
+
+  /* Link in the list of all open endpoints */
+  struct ftest_sock_chan *next;
+};
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static struct ftest_sock_chan *ftest_sock_chans = NULL;
+static uint16_t ftest_sock_chan_next_port = FTEST_SOCK_CHAN_EPHEMERAL_FIRST;
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+static void ftest_sock_chan_wake(struct ftest_sock_chan *chan,
+                                 const struct ftest_sock_chan *cause) {
+  if (chan == NULL || chan->entity == NULL) {
+    return;
+  }
+
+  ftest_shed_ring_doorbell(chan->entity, ftest_shed_get_time(cause->entity));
+}
+
+static struct ftest_sock_chan *
+ftest_sock_chan_find(enum ftest_sock_chan_type type,
+                     const struct ftest_sock_chan_addr *addr,
+                     bool listening) {
+  for (struct ftest_sock_chan *chan = ftest_sock_chans; chan != NULL;
+       chan = chan->next) {
+    if (chan->type == type && chan->bound &&
+        chan->local.port == addr->port &&
+        (chan->local.ip == addr->ip || chan->local.ip == 0 || addr->ip == 0) &&
+        (!listening || chan->listening)) {
+      return chan;
+    }
+  }
+
+  return NULL;
+}
+
+static bool ftest_sock_chan_port_is_free(enum ftest_sock_chan_type type,
+                                         uint32_t ip, uint16_t port) {
+  for (struct ftest_sock_chan *chan = ftest_sock_chans; chan != NULL;
+       chan = chan->next) {
+    /* Connected streams share the port of their listener */
+    if (chan->type == type && chan->bound && chan->local.port == port &&
+        (chan->local.ip == ip || chan->local.ip == 0 || ip == 0) &&
+        (type == FTEST_SOCK_CHAN_DGRAM || !chan->connected)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static ftest_sock_chan_result_t
+ftest_sock_chan_bind_ephemeral(struct ftest_sock_chan *chan) {
+  for (uint32_t i = 0;
+       i <= FTEST_SOCK_CHAN_EPHEMERAL_LAST - FTEST_SOCK_CHAN_EPHEMERAL_FIRST;
+       i++) {
+    uint16_t port = ftest_sock_chan_next_port;
+
+    ftest_sock_chan_next_port =
+        port == FTEST_SOCK_CHAN_EPHEMERAL_LAST
+            ? FTEST_SOCK_CHAN_EPHEMERAL_FIRST
+            : port + 1;
+
+    if (ftest_sock_chan_port_is_free(chan->type, chan->local.ip, port)) {
+      chan->local.port = port;
+      chan->bound = true;
+      return FTEST_SOCK_CHAN_OK;
+    }
+  }
+
+  return FTEST_SOCK_CHAN_ADDRINUSE;
+}
+
+static struct ftest_sock_chan *
+ftest_sock_chan_alloc(enum ftest_sock_chan_type type,
+                      struct ftest_shed_entity_entry *entity) {
+  struct ftest_sock_chan *chan = calloc(1, sizeof(*chan));
+
+  if (chan == NULL) {
+    return NULL;
+  }
+
+  chan->type = type;
+  chan->entity = entity;
+  chan->next = ftest_sock_chans;
+  ftest_sock_chans = chan;
+
+  return chan;
+}
+
+static void ftest_sock_chan_unlink(struct ftest_sock_chan *chan) {
+  struct ftest_sock_chan **link = &ftest_sock_chans;
+
+  while (*link != NULL && *link != chan) {
+    link = &(*link)->next;
+  }
+
+  if (*link != NULL) {
+    *link = chan->next;
+  }
+}
+
+static ftest_sock_chan_result_t
+ftest_sock_chan_enqueue(struct ftest_sock_chan *chan,
+                        const struct ftest_sock_chan_addr *src,
+                        const void *data, uint32_t len) {
+  struct ftest_sock_msg *msg = malloc(sizeof(*msg) + len);
+
+  if (msg == NULL) {
+    return FTEST_SOCK_CHAN_NOMEM;
+  }
+
+  msg->next = NULL;
+  msg->src = *src;
+  msg->len = len;
+  msg->offset = 0;
+  memcpy(msg->data, data, len);
+
+  if (chan->rx_tail != NULL) {
+    chan->rx_tail->next = msg;
+  } else {
+    chan->rx_head = msg;
+  }
+  chan->rx_tail = msg;
+  chan->rx_bytes += len;
+
+  return FTEST_SOCK_CHAN_OK;
+}
+
+static void ftest_sock_chan_drop_head(struct ftest_sock_chan *chan) {
+  struct ftest_sock_msg *msg = chan->rx_head;
+
+  chan->rx_head = msg->next;
+  if (chan->rx_head == NULL) {
+    chan->rx_tail = NULL;
+  }
+
+  chan->rx_bytes -= msg->len - msg->offset;
+  free(msg);
+}
+
+/******************************************************************************
+ API
+ ******************************************************************************/
+
+struct ftest_sock_chan *ftest_sock_chan_open(enum ftest_sock_chan_type type,
+                                             uint32_t ip,
+                                             struct ftest_shed_entity_entry
+                                                 *entity) {
+  struct ftest_sock_chan *chan = ftest_sock_chan_alloc(type, entity);
+
+  if (chan != NULL) {
+    chan->local.ip = ip;
+  }
+
+  return chan;
+}
+
+void ftest_sock_chan_close(struct ftest_sock_chan *chan) {
+  if (chan == NULL) {
+    return;
+  }
+
+  while (chan->pending_head != NULL) {
+    struct ftest_sock_chan *conn = chan->pending_head;
+
+    chan->pending_head = conn->next_pending;
+    ftest_sock_chan_close(conn);
+  }
+
+  if (chan->type == FTEST_SOCK_CHAN_STREAM && chan->peer != NULL) {
+    chan->peer->peer = NULL;
+    chan->peer->peer_closed = true;
+    ftest_sock_chan_wake(chan->peer, chan);
+  }
+
+  while (chan->rx_head != NULL) {
+    ftest_sock_chan_drop_head(chan);
+  }
+
+  ftest_sock_chan_unlink(chan);
+  free(chan);
+}
+
+ftest_sock_chan_result_t
+ftest_sock_chan_bind(struct ftest_sock_chan *chan,
+                     const struct ftest_sock_chan_addr *addr) {
+  if (chan == NULL || addr == NULL || chan->bound) {
+    return FTEST_SOCK_CHAN_INVAL;
+  }
+
+  if (addr->port == 0) {
+    chan->local.ip = addr->ip;
+    return ftest_sock_chan_bind_ephemeral(chan);
+  }
+
+  if (!ftest_sock_chan_port_is_free(chan->type, addr->ip, addr->port)) {
+    return FTEST_SOCK_CHAN_ADDRINUSE;
+  }
+
+  chan->local = *addr;
+  chan->bound = true;
+
+  return FTEST_SOCK_CHAN_OK;
+}
+
+ftest_sock_chan_result_t
+ftest_sock_chan_listen(struct ftest_sock_chan *chan, int backlog) {
+  if (chan == NULL || chan->type != FTEST_SOCK_CHAN_STREAM ||
+      chan->connected) {
+    return FTEST_SOCK_CHAN_INVAL;
+  }
+
+  if (!chan->bound) {
+    ftest_sock_chan_result_t res = ftest_sock_chan_bind_ephemeral(chan);
+
+    if (res != FTEST_SOCK_CHAN_OK) {
+      return res;
+    }
+  }
+
+  chan->listening = true;
+  chan->backlog = backlog > 0 ? backlog : 1;
+
+  return FTEST_SOCK_CHAN_OK;
+}
+
+ftest_sock_chan_result_t
+ftest_sock_chan_accept(struct ftest_sock_chan *chan,
+                       struct ftest_sock_chan **conn,
+                       struct ftest_sock_chan_addr *peer) {
+  if (chan == NULL || conn == NULL || !chan->listening) {
+    return FTEST_SOCK_CHAN_INVAL;
+  }
+
+  if (chan->pending_head == NULL) {
+    return FTEST_SOCK_CHAN_AGAIN;
+  }
+
+  *conn = chan->pending_head;
+  chan->pending_head = (*conn)->next_pending;
+  if (chan->pending_head == NULL) {
+    chan->pending_tail = NULL;
+  }
+  chan->pending_count--;
+
+  (*conn)->next_pending = NULL;
+
+  if (peer != NULL) {
+    *peer = (*conn)->peer_addr;
+  }
+
+  return FTEST_SOCK_CHAN_OK;
+}
+
+ftest_sock_chan_result_t
+ftest_sock_chan_connect(struct ftest_sock_chan *chan,
+                        const struct ftest_sock_chan_addr *peer) {
+  if (chan == NULL || peer == NULL || chan->listening) {
+    return FTEST_SOCK_CHAN_INVAL;
+  }
+
+  if (chan->type == FTEST_SOCK_CHAN_STREAM && chan->connected) {
+    return FTEST_SOCK_CHAN_ISCONN;
+  }
+
+  if (!chan->bound) {
+    ftest_sock_chan_result_t res = ftest_sock_chan_bind_ephemeral(chan);
+
+    if (res != FTEST_SOCK_CHAN_OK) {
+      return res;
+    }
+  }
+
+  if (chan->type == FTEST_SOCK_CHAN_DGRAM) {
+    chan->peer_addr = *peer;
+    chan->connected = true;
+    return FTEST_SOCK_CHAN_OK;
+  }
+
+  struct ftest_sock_chan *listener =
+      ftest_sock_chan_find(FTEST_SOCK_CHAN_STREAM, peer, true);
+
+  if (listener == NULL || listener->pending_count >= listener->backlog) {
+    return FTEST_SOCK_CHAN_CONNREFUSED;
+  }
+
+  /* The listener's end of the connection, owned by the listener's entity
+   * until it is accepted */
+  struct ftest_sock_chan *conn =
+      ftest_sock_chan_alloc(FTEST_SOCK_CHAN_STREAM, listener->entity);
+
+  if (conn == NULL) {
+    return FTEST_SOCK_CHAN_NOMEM;
+  }
+
+  conn->local = listener->local;
+  conn->local.ip = peer->ip;
+  conn->bound = true;
+  conn->peer = chan;
+  conn->peer_addr = chan->local;
+  conn->connected = true;
+
+  chan->peer = conn;
+  chan->peer_addr = conn->local;
+  chan->connected = true;
+
+  if (listener->pending_tail != NULL) {
+    listener->pending_tail->next_pending = conn;
+  } else {
+    listener->pending_head = conn;
+  }
+  listener->pending_tail = conn;
+  listener->pending_count++;
+
+  ftest_sock_chan_wake(listener, chan);
+
+  return FTEST_SOCK_CHAN_OK;
+}
+
+int32_t ftest_sock_chan_send(struct ftest_sock_chan *chan, const void *data,
+                             uint32_t len,
+                             const struct ftest_sock_chan_addr *dest) {
+  if (chan == NULL || (data == NULL && len > 0)) {
+    return FTEST_SOCK_CHAN_INVAL;
+  }
+
+  if (chan->type == FTEST_SOCK_CHAN_STREAM) {
+    if (chan->peer_closed) {
+      return FTEST_SOCK_CHAN_PIPE;
+    }
+
+    if (chan->peer == NULL) {
+      return FTEST_SOCK_CHAN_NOTCONN;
+    }
+
+    /* An empty message in the queue would read as the end of the stream */
+    if (len == 0) {
+      return 0;
+    }
+
+    uint32_t room = CONFIG_FTEST_SOCK_CHAN_RCVBUF - chan->peer->rx_bytes;
+
+    if (room == 0) {
+      return FTEST_SOCK_CHAN_AGAIN;
+    }
+
+    len = len < room ? len : room;
+
+    ftest_sock_chan_result_t res =
+        ftest_sock_chan_enqueue(chan->peer, &chan->local, data, len);
+
+    if (res != FTEST_SOCK_CHAN_OK) {
+      return res;
+    }
+
+    ftest_sock_chan_wake(chan->peer, chan);
+
+    return (int32_t)len;
+  }
+
+  if (dest == NULL) {
+    if (!chan->connected) {
+      return FTEST_SOCK_CHAN_NOTCONN;
+    }
+
+    dest = &chan->peer_addr;
+  }
+
+  if (!chan->bound) {
+    ftest_sock_chan_result_t res = ftest_sock_chan_bind_ephemeral(chan);
+
+    if (res != FTEST_SOCK_CHAN_OK) {
+      return res;
+    }
+  }
+
+  /* Datagrams to nobody, or to a full endpoint, are lost */
+  struct ftest_sock_chan *receiver =
+      ftest_sock_chan_find(FTEST_SOCK_CHAN_DGRAM, dest, false);
+
+  if (receiver != NULL &&
+      receiver->rx_bytes + len <= CONFIG_FTEST_SOCK_CHAN_RCVBUF) {
+    ftest_sock_chan_result_t res =
+        ftest_sock_chan_enqueue(receiver, &chan->local, data, len);
+
+    if (res != FTEST_SOCK_CHAN_OK) {
+      return res;
+    }
+
+    ftest_sock_chan_wake(receiver, chan);
+  }
+
+  return (int32_t)len;
+}
+
+int32_t ftest_sock_chan_recv(struct ftest_sock_chan *chan, void *buf,
+                             uint32_t len, struct ftest_sock_chan_addr *src,
+                             bool peek) {
+  if (chan == NULL || (buf == NULL && len > 0) || chan->listening) {
+    return FTEST_SOCK_CHAN_INVAL;
+  }
+
+  if (chan->rx_head == NULL) {
+    if (chan->type == FTEST_SOCK_CHAN_STREAM) {
+      if (chan->peer_closed) {
+        return 0;
+      }
+
+      if (!chan->connected) {
+        return FTEST_SOCK_CHAN_NOTCONN;
+      }
+    }
+
+    return FTEST_SOCK_CHAN_AGAIN;
+  }
+
+  struct ftest_sock_msg *msg = chan->rx_head;
+
+  if (src != NULL) {
+    *src = msg->src;
+  }
+
+  if (chan->type == FTEST_SOCK_CHAN_DGRAM) {
+    uint32_t copied = msg->len < len ? msg->len : len;
+
+    memcpy(buf, msg->data, copied);
+
+    if (!peek) {
+      ftest_sock_chan_drop_head(chan);
+    }
+
+    return (int32_t)copied;
+  }
+
+  /* A stream is received across the chunks it was sent in */
+  uint32_t copied = 0;
+  uint32_t offset = msg->offset;
+
+  while (msg != NULL && copied < len) {
+    uint32_t available = msg->len - offset;
+    uint32_t chunk = available < len - copied ? available : len - copied;
+
+    memcpy((uint8_t *)buf + copied, msg->data + offset, chunk);
+    copied += chunk;
+
+    if (peek) {
+      msg = msg->next;
+      offset = 0;
+      continue;
+    }
+
+    msg->offset += chunk;
+    chan->rx_bytes -= chunk;
+
+    if (msg->offset == msg->len) {
+      ftest_sock_chan_drop_head(chan);
+    }
+
+    msg = chan->rx_head;
+    offset = msg != NULL ? msg->offset : 0;
+  }
+
+  /* The sender may have been waiting for room */
+  if (!peek && copied > 0) {
+    ftest_sock_chan_wake(chan->peer, chan);
+  }
+
+  return (int32_t)copied;
+}
+
+bool ftest_sock_chan_is_readable(const struct ftest_sock_chan *chan) {
+  if (chan == NULL) {
+    return false;
+  }
+
+  if (chan->listening) {
+    return chan->pending_head != NULL;
+  }
+
+  /* A stream which was never connected fails a receive right away */
+  return chan->rx_head != NULL || chan->peer_closed ||
+         (chan->type == FTEST_SOCK_CHAN_STREAM && !chan->connected);
+}
+
+bool ftest_sock_chan_is_writable(const struct ftest_sock_chan *chan) {
+  if (chan == NULL) {
+    return false;
+  }
+
+  if (chan->type == FTEST_SOCK_CHAN_DGRAM) {
+    return true;
+  }
+
+  /* A closed or missing peer makes the send fail right away */
+  return chan->peer_closed || !chan->connected ||
+         (chan->peer != NULL &&
+          chan->peer->rx_bytes < CONFIG_FTEST_SOCK_CHAN_RCVBUF);
+}
+
+void ftest_sock_chan_detach_entity(
+    const struct ftest_shed_entity_entry *entity) {
+  for (struct ftest_sock_chan *chan = ftest_sock_chans; chan != NULL;
+       chan = chan->next) {
+    if (chan->entity == entity) {
+      chan->entity = NULL;
+    }
+  }
+}
+
+ftest_sock_chan_result_t
+ftest_sock_chan_get_local(const struct ftest_sock_chan *chan,
+                          struct ftest_sock_chan_addr *addr) {
+  if (chan == NULL || addr == NULL) {
+    return FTEST_SOCK_CHAN_INVAL;
+  }
+
+  *addr = chan->local;
+
+  return FTEST_SOCK_CHAN_OK;
+}
+
+ftest_sock_chan_result_t
+ftest_sock_chan_get_peer(const struct ftest_sock_chan *chan,
+                         struct ftest_sock_chan_addr *addr) {
+  if (chan == NULL || addr == NULL) {
+    return FTEST_SOCK_CHAN_INVAL;
+  }
+
+  if (!chan->connected) {
+    return FTEST_SOCK_CHAN_NOTCONN;
+  }
+
+  *addr = chan->peer_addr;
+
+  return FTEST_SOCK_CHAN_OK;
+}
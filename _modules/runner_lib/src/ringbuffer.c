@@ -2,6 +2,195 @@
 // Implementation
 #include "ringbuffer.h"
 
+static rb_entry_t *rb_entry_at(const ringbuffer_t *rb, uint32_t index) {
+  if (rb->index_mask) {
+    return (rb_entry_t *)(rb->buffer +
+                          ((index & rb->index_mask) << rb->entry_shift));
+  }
+
+  return (rb_entry_t *)(rb->buffer +
+                        (index % rb->num_entries) * rb->entry_size);
+}
+
+static uint32_t rb_var_align(uint32_t size) {
+  return (size + RB_VAR_ALIGN - 1) & ~(uint32_t)(RB_VAR_ALIGN - 1);
+}
+
+static void rb_var_get_header(const ringbuffer_t *rb, uint32_t index,
+                              rb_var_entry_t *header) {
+  memcpy(header, rb->buffer + (index & (rb->size - 1)), sizeof(*header));
+}
+
+static void rb_var_put_header(ringbuffer_t *rb, uint32_t index, uint32_t len) {
+  rb_var_entry_t header = {.write_index = index, .len = len};
+  memcpy(rb->buffer + (index & (rb->size - 1)), &header, sizeof(header));
+}
+
+// Stamp a header no reader matches, as readers only stand at aligned indices
+static void rb_var_invalidate_header(ringbuffer_t *rb, uint32_t index) {
+  rb_var_entry_t header = {.write_index = index + 1, .len = 0};
+  memcpy(rb->buffer + (index & (rb->size - 1)), &header, sizeof(header));
+}
+
+// Whether the bytes from index up to the write index were not overwritten yet
+static bool rb_var_in_window(const ringbuffer_t *rb, uint32_t index) {
+  return rb->write_index + rb->reserved - index <= rb->size;
+}
+
+/*
+ * Locate the record at the reader index, skipping a wrap marker. On success
+ * the index is moved to the record header.
+ */
+static rb_result_t rb_var_locate(const ringbuffer_t *rb, uint32_t *index,
+                                 rb_var_entry_t *header) {
+  if (!rb_var_in_window(rb, *index)) {
+    return RB_OVERRUN;
+  }
+
+  rb_var_get_header(rb, *index, header);
+
+  if (header->write_index == *index && header->len == RB_VAR_WRAP_MARKER) {
+    *index += rb->size - (*index & (rb->size - 1));
+
+    if (!rb_var_in_window(rb, *index)) {
+      return RB_OVERRUN;
+    }
+
+    rb_var_get_header(rb, *index, header);
+  }
+
+  if (header->write_index != *index) {
+    return RB_OVERRUN;
+  }
+
+  return RB_OK;
+}
+
+/*
+ * Make room for a record at the write index, and store the index of the
+ * record (past a wrap marker, if any). The header is stamped right away, so
+ * readers of the data being overwritten see the overrun. The write index is
+ * left for the caller to advance once the record is complete.
+ */
+static uint8_t *rb_var_place(ringbuffer_t *rb, uint32_t data_size,
+                             uint32_t *index) {
+  uint32_t record_size = rb_var_align(sizeof(rb_var_entry_t) + data_size);
+
+  if (record_size > rb->size) {
+    return NULL;
+  }
+
+  uint32_t offset = rb->write_index & (rb->size - 1);
+  *index = rb->write_index;
+
+  // Records are never split, the tail of the buffer is skipped instead
+  if (offset + record_size > rb->size) {
+    rb_var_put_header(rb, rb->write_index, RB_VAR_WRAP_MARKER);
+    *index += rb->size - offset;
+    offset = 0;
+  }
+
+  rb_var_put_header(rb, *index, data_size);
+
+  return rb->buffer + offset + sizeof(rb_var_entry_t);
+}
+
+/*
+ * Distance of the slowest registered reader from the write index, ignoring
+ * readers which were already overrun.
+ */
+static uint32_t rb_slowest_reader(const ringbuffer_t *rb, uint32_t capacity) {
+  uint32_t slowest = 0;
+
+  for (size_t i = 0; i < RB_MAX_READERS; i++) {
+    if (!rb->readers[i]) {
+      continue;
+    }
+
+    uint32_t distance = rb->write_index - *rb->readers[i];
+
+    if (distance <= capacity && distance > slowest) {
+      slowest = distance;
+    }
+  }
+
+  return slowest;
+}
+
+/*
+ * Drop a reservation. The data it overwrote stays lost, but the headers it
+ * stamped are invalidated, so readers do not take the dropped space for a
+ * record once they catch up with the write index.
+ */
+static void rb_cancel_reservation(ringbuffer_t *rb) {
+  if (rb->var_length) {
+    rb_var_invalidate_header(rb, rb->reserved_index);
+
+    // Along with the wrap marker, if the record was moved to the start
+    rb_var_invalidate_header(rb, rb->write_index);
+  } else {
+    // The slot is stamped again before a reader can reach this index
+    rb_entry_at(rb, rb->write_index)->write_index =
+        rb->write_index + rb->num_entries;
+  }
+
+  rb->reserved = 0;
+}
+
+static void rb_reset_readers(ringbuffer_t *rb) {
+  rb->lossless = false;
+  memset(&rb->stats, 0, sizeof(rb->stats));
+  memset(rb->readers, 0, sizeof(rb->readers));
+}
+
+static rb_result_t rb_var_write(ringbuffer_t *rb, const void *data,
+                                uint32_t data_size) {
+  uint32_t index;
+  uint8_t *record_data = rb_var_place(rb, data_size, &index);
+
+  if (!record_data) {
+    return RB_INVALID_PARAM;
+  }
+
+  memcpy(record_data, data, data_size);
+
+  rb->write_index = index + rb_var_align(sizeof(rb_var_entry_t) + data_size);
+
+  return RB_OK;
+}
+
+static rb_result_t rb_var_read(ringbuffer_t *rb, uint32_t *reader_index,
+                               void *data, uint32_t data_size,
+                               uint32_t *read_size) {
+  rb_var_entry_t header;
+  uint32_t index = *reader_index;
+
+  rb_result_t res = rb_var_locate(rb, &index, &header);
+  if (res != RB_OK) {
+    return res;
+  }
+
+  if (header.len > data_size) {
+    return RB_INVALID_PARAM;
+  }
+
+  memcpy(data, rb->buffer + (index & (rb->size - 1)) + sizeof(header),
+         header.len);
+
+  // The writer might have lapped the reader while copying
+  if (!rb_var_in_window(rb, index)) {
+    return RB_OVERRUN;
+  }
+
+  if (read_size) {
+    *read_size = header.len;
+  }
+
+  *reader_index = index;
+
+  return RB_OK;
+}
+
 rb_result_t rb_init(ringbuffer_t *rb, uint8_t *buffer, uint32_t buffer_size,
                     uint32_t data_size) {
   if (!rb || !buffer || buffer_size == 0 || data_size == 0) {
@@ -13,6 +202,10 @@ rb_result_t rb_init(ringbuffer_t *rb, uint8_t *buffer, uint32_t buffer_size,
   rb->entry_size = sizeof(rb_entry_t) + data_size;
   rb->num_entries = buffer_size / rb->entry_size;
   rb->write_index = 0;
+  rb->reserved = 0;
+  rb->reserved_index = 0;
+  rb->index_mask = 0;
+  rb->entry_shift = 0;
 
   // Check if we have at least one entry
   if (rb->num_entries == 0) {
@@ -21,6 +214,73 @@ rb_result_t rb_init(ringbuffer_t *rb, uint8_t *buffer, uint32_t buffer_size,
 
   // Clear the buffer
   memset(buffer, 0, buffer_size);
+  rb->var_length = false;
+  rb_reset_readers(rb);
+
+  return RB_OK;
+}
+
+rb_result_t rb_init_pow2(ringbuffer_t *rb, uint8_t *buffer,
+                         uint32_t buffer_size, uint32_t data_size) {
+  if (!rb || !buffer || buffer_size == 0 || data_size == 0 ||
+      data_size > UINT32_MAX / 2 - sizeof(rb_entry_t)) {
+    return RB_INVALID_PARAM;
+  }
+
+  uint8_t entry_shift = 0;
+  while ((1u << entry_shift) < sizeof(rb_entry_t) + data_size) {
+    entry_shift++;
+  }
+
+  uint32_t num_entries = buffer_size >> entry_shift;
+  if (num_entries == 0) {
+    return RB_INVALID_PARAM;
+  }
+
+  // Round down, so the entry index is a mask away from the slot
+  while (num_entries & (num_entries - 1)) {
+    num_entries &= num_entries - 1;
+  }
+
+  rb_result_t res = rb_init(rb, buffer, buffer_size,
+                            (1u << entry_shift) - sizeof(rb_entry_t));
+  if (res != RB_OK) {
+    return res;
+  }
+
+  // With a single entry the mask is empty, and the modulo is just as cheap
+  rb->num_entries = num_entries;
+  rb->index_mask = num_entries - 1;
+  rb->entry_shift = entry_shift;
+
+  return RB_OK;
+}
+
+rb_result_t rb_init_var(ringbuffer_t *rb, uint8_t *buffer,
+                        uint32_t buffer_size) {
+  if (!rb || !buffer || buffer_size < 2 * RB_VAR_ALIGN) {
+    return RB_INVALID_PARAM;
+  }
+
+  // Byte positions wrap around at 2^32, which has to be a multiple of the size
+  if ((buffer_size & (buffer_size - 1)) != 0) {
+    return RB_INVALID_PARAM;
+  }
+
+  rb->buffer = buffer;
+  rb->size = buffer_size;
+  rb->entry_size = 0;
+  rb->num_entries = 0;
+  rb->write_index = 0;
+  rb->reserved = 0;
+  rb->reserved_index = 0;
+  rb->index_mask = 0;
+  rb->entry_shift = 0;
+  rb->var_length = true;
+  rb_reset_readers(rb);
+
+  // Stamps of zero would match a reader at index 0, invalidate them
+  memset(buffer, 0xFF, buffer_size);
 
   return RB_OK;
 }
@@ -30,14 +290,25 @@ rb_result_t rb_write(ringbuffer_t *rb, const void *data, uint32_t data_size) {
     return RB_INVALID_PARAM;
   }
 
+  if (rb->reserved) {
+    return RB_ERROR;
+  }
+
+  if (rb->lossless && !rb_has_room(rb, data_size)) {
+    return RB_FULL;
+  }
+
+  if (rb->var_length) {
+    return rb_var_write(rb, data, data_size);
+  }
+
   // Check if data fits in entry
   if (data_size > (rb->entry_size - sizeof(rb_entry_t))) {
     return RB_INVALID_PARAM;
   }
 
   // Calculate buffer position
-  uint32_t pos = (rb->write_index % rb->num_entries) * rb->entry_size;
-  rb_entry_t *entry = (rb_entry_t *)(rb->buffer + pos);
+  rb_entry_t *entry = rb_entry_at(rb, rb->write_index);
 
   // Write entry header
   entry->write_index = rb->write_index;
@@ -57,14 +328,25 @@ rb_result_t rb_read(ringbuffer_t *rb, uint32_t reader_index, void *data,
     return RB_INVALID_PARAM;
   }
 
+  if (rb->var_length) {
+    rb_result_t res = rb_var_read(rb, &reader_index, data, data_size, NULL);
+
+    if (actual_index) {
+      rb_var_entry_t header;
+      rb_var_get_header(rb, reader_index, &header);
+      *actual_index = header.write_index;
+    }
+
+    return res;
+  }
+
   // Check if data buffer is large enough
   if (data_size > (rb->entry_size - sizeof(rb_entry_t))) {
     return RB_INVALID_PARAM;
   }
 
   // Calculate buffer position
-  uint32_t pos = (reader_index % rb->num_entries) * rb->entry_size;
-  rb_entry_t *entry = (rb_entry_t *)(rb->buffer + pos);
+  rb_entry_t *entry = rb_entry_at(rb, reader_index);
 
   // Store actual index if requested
   if (actual_index) {
@@ -84,6 +366,277 @@ rb_result_t rb_read(ringbuffer_t *rb, uint32_t reader_index, void *data,
   return RB_OK;
 }
 
+rb_result_t rb_read_next(ringbuffer_t *rb, uint32_t *reader_index, void *data,
+                         uint32_t data_size, uint32_t *read_size) {
+  if (!rb || !reader_index || !data || data_size == 0) {
+    return RB_INVALID_PARAM;
+  }
+
+  if (!rb->var_length) {
+    rb_result_t res = rb_read(rb, *reader_index, data, data_size, NULL);
+
+    if (res == RB_OK || res == RB_OVERRUN) {
+      (*reader_index)++;
+    }
+
+    if (read_size) {
+      *read_size = data_size;
+    }
+
+    return res;
+  }
+
+  uint32_t index = *reader_index;
+  uint32_t len = 0;
+  rb_result_t res = rb_var_read(rb, &index, data, data_size, &len);
+
+  if (read_size) {
+    *read_size = len;
+  }
+
+  if (res == RB_OK) {
+    *reader_index = index + rb_var_align(sizeof(rb_var_entry_t) + len);
+  } else if (res == RB_OVERRUN) {
+    // Record boundaries are lost, so resume with the next record written
+    *reader_index = rb->write_index;
+  }
+
+  return res;
+}
+
+void rb_set_lossless(ringbuffer_t *rb, bool lossless) {
+  if (rb) {
+    rb->lossless = lossless;
+  }
+}
+
+int rb_register_reader(ringbuffer_t *rb, const uint32_t *reader_index) {
+  if (!rb || !reader_index) {
+    return RB_INVALID_PARAM;
+  }
+
+  for (int i = 0; i < RB_MAX_READERS; i++) {
+    if (!rb->readers[i]) {
+      rb->readers[i] = reader_index;
+      return i;
+    }
+  }
+
+  return RB_ERROR;
+}
+
+void rb_unregister_reader(ringbuffer_t *rb, int reader) {
+  if (rb && reader >= 0 && reader < RB_MAX_READERS) {
+    rb->readers[reader] = NULL;
+  }
+}
+
+bool rb_has_room(const ringbuffer_t *rb, uint32_t data_size) {
+  if (!rb) {
+    return false;
+  }
+
+  if (!rb->var_length) {
+    return rb_slowest_reader(rb, rb->num_entries) < rb->num_entries;
+  }
+
+  uint32_t needed = rb_var_align(sizeof(rb_var_entry_t) + data_size);
+  uint32_t offset = rb->write_index & (rb->size - 1);
+
+  // A record which does not fit before the end also uses up the tail
+  if (offset + needed > rb->size) {
+    needed += rb->size - offset;
+  }
+
+  return rb_slowest_reader(rb, rb->size) + needed <= rb->size;
+}
+
+void *rb_reserve(ringbuffer_t *rb, uint32_t max_size) {
+  if (!rb || max_size == 0 || rb->reserved) {
+    return NULL;
+  }
+
+  if (rb->lossless && !rb_has_room(rb, max_size)) {
+    return NULL;
+  }
+
+  if (rb->var_length) {
+    uint8_t *record_data = rb_var_place(rb, max_size, &rb->reserved_index);
+
+    if (record_data) {
+      rb->reserved = rb->reserved_index - rb->write_index +
+                     rb_var_align(sizeof(rb_var_entry_t) + max_size);
+    }
+
+    return record_data;
+  }
+
+  if (max_size > (rb->entry_size - sizeof(rb_entry_t))) {
+    return NULL;
+  }
+
+  rb_entry_t *entry = rb_entry_at(rb, rb->write_index);
+
+  // Readers still expecting the old entry see it as overrun from now on
+  entry->write_index = rb->write_index;
+  rb->reserved = rb->entry_size;
+
+  return entry->data;
+}
+
+void *rb_reserve_wait(ringbuffer_t *rb, uint32_t max_size,
+                      bool (*wait)(void *arg), void *arg) {
+  void *entry_data = rb_reserve(rb, max_size);
+
+  // Only a lack of room is worth waiting for
+  if (entry_data || !rb || !rb->lossless || !wait ||
+      rb_has_room(rb, max_size)) {
+    return entry_data;
+  }
+
+  rb->stats.stalls++;
+
+  while (!rb_has_room(rb, max_size)) {
+    if (!wait(arg)) {
+      return NULL;
+    }
+  }
+
+  entry_data = rb_reserve(rb, max_size);
+
+  if (entry_data) {
+    rb->stats.saved++;
+  }
+
+  return entry_data;
+}
+
+rb_result_t rb_commit(ringbuffer_t *rb, uint32_t data_size) {
+  if (!rb || !rb->reserved) {
+    return RB_INVALID_PARAM;
+  }
+
+  if (data_size == 0) {
+    rb_cancel_reservation(rb);
+    return RB_OK;
+  }
+
+  if (!rb->var_length) {
+    rb->reserved = 0;
+    rb->write_index++;
+    return RB_OK;
+  }
+
+  uint32_t record_end = rb->reserved_index +
+                        rb_var_align(sizeof(rb_var_entry_t) + data_size);
+
+  if (record_end - rb->write_index > rb->reserved) {
+    return RB_INVALID_PARAM;
+  }
+
+  rb_var_put_header(rb, rb->reserved_index, data_size);
+  rb->reserved = 0;
+  rb->write_index = record_end;
+
+  return RB_OK;
+}
+
+rb_result_t rb_peek(const ringbuffer_t *rb, uint32_t reader_index,
+                    const void **data, uint32_t *data_size) {
+  if (!rb || !data || !data_size) {
+    return RB_INVALID_PARAM;
+  }
+
+  if (rb->var_length) {
+    rb_var_entry_t header;
+
+    rb_result_t res = rb_var_locate(rb, &reader_index, &header);
+    if (res != RB_OK) {
+      return res;
+    }
+
+    *data = rb->buffer + (reader_index & (rb->size - 1)) + sizeof(header);
+    *data_size = header.len;
+
+    return RB_OK;
+  }
+
+  if (rb_is_overrun(rb, reader_index)) {
+    return RB_OVERRUN;
+  }
+
+  rb_entry_t *entry = rb_entry_at(rb, reader_index);
+
+  *data = entry->data;
+  *data_size = rb->entry_size - sizeof(rb_entry_t);
+
+  return RB_OK;
+}
+
+rb_result_t rb_release(const ringbuffer_t *rb, uint32_t *reader_index) {
+  if (!rb || !reader_index) {
+    return RB_INVALID_PARAM;
+  }
+
+  if (!rb->var_length) {
+    bool overrun = rb_is_overrun(rb, *reader_index);
+    (*reader_index)++;
+    return overrun ? RB_OVERRUN : RB_OK;
+  }
+
+  rb_var_entry_t header;
+  uint32_t index = *reader_index;
+
+  if (rb_var_locate(rb, &index, &header) != RB_OK) {
+    // Record boundaries are lost, so resume with the next record written
+    *reader_index = rb->write_index;
+    return RB_OVERRUN;
+  }
+
+  *reader_index = index + rb_var_align(sizeof(rb_var_entry_t) + header.len);
+
+  return RB_OK;
+}
+
+rb_result_t rb_read_batch(const ringbuffer_t *rb, uint32_t reader_index,
+                          rb_iovec_t *iov, uint32_t max_count,
+                          uint32_t *count) {
+  if (!rb || !iov || !count) {
+    return RB_INVALID_PARAM;
+  }
+
+  *count = 0;
+
+  while (*count < max_count && reader_index != rb->write_index) {
+    const void *data;
+    uint32_t data_size;
+
+    rb_result_t res = rb_peek(rb, reader_index, &data, &data_size);
+
+    if (res != RB_OK) {
+      // Entries before the overrun one are still valid
+      return *count ? RB_OK : res;
+    }
+
+    if (rb->var_length) {
+      // rb_peek() may have skipped a wrap marker, continue after the record
+      uint32_t record_offset = (uint32_t)((const uint8_t *)data - rb->buffer) -
+                               sizeof(rb_var_entry_t);
+      reader_index += (record_offset - reader_index) & (rb->size - 1);
+      reader_index += rb_var_align(sizeof(rb_var_entry_t) + data_size);
+    } else {
+      reader_index++;
+    }
+
+    iov[*count].base = data;
+    iov[*count].len = data_size;
+    iov[*count].next_index = reader_index;
+    (*count)++;
+  }
+
+  return RB_OK;
+}
+
 uint32_t rb_get_write_index(const ringbuffer_t *rb) {
   if (!rb) {
     return 0;
@@ -96,6 +649,11 @@ uint32_t rb_available(const ringbuffer_t *rb, uint32_t reader_index) {
     return 0;
   }
 
+  if (rb->var_length) {
+    uint32_t available = rb->write_index - reader_index;
+    return (available > rb->size) ? rb->size : available;
+  }
+
   if (rb->write_index >= reader_index) {
     uint32_t available = rb->write_index - reader_index;
     // Limit to buffer capacity
@@ -105,13 +663,32 @@ uint32_t rb_available(const ringbuffer_t *rb, uint32_t reader_index) {
   return 0;
 }
 
+uint32_t rb_get_capacity(const ringbuffer_t *rb) {
+  if (!rb) {
+    return 0;
+  }
+
+  return rb->var_length ? rb->size : rb->num_entries;
+}
+
+void rb_get_stats(const ringbuffer_t *rb, rb_stats_t *stats) {
+  if (!rb || !stats) {
+    return;
+  }
+
+  *stats = rb->stats;
+}
+
 bool rb_is_valid(const ringbuffer_t *rb) {
   if (!rb) {
     return false;
   }
 
-  if (rb->buffer == NULL || rb->size == 0 || rb->entry_size == 0 ||
-      rb->num_entries == 0) {
+  if (rb->buffer == NULL || rb->size == 0) {
+    return false;
+  }
+
+  if (!rb->var_length && (rb->entry_size == 0 || rb->num_entries == 0)) {
     return false;
   }
 
@@ -123,14 +700,18 @@ bool rb_is_overrun(const ringbuffer_t *rb, uint32_t reader_index) {
     return false;
   }
 
+  if (rb->var_length) {
+    rb_var_entry_t header;
+    return rb_var_locate(rb, &reader_index, &header) == RB_OVERRUN;
+  }
+
   // If reader is too far behind, it's definitely overrun
-  if (rb->write_index >= reader_index + rb->num_entries) {
+  if (rb->write_index - reader_index > rb->num_entries) {
     return true;
   }
 
   // Check the actual entry at that position
-  uint32_t pos = (reader_index % rb->num_entries) * rb->entry_size;
-  rb_entry_t *entry = (rb_entry_t *)(rb->buffer + pos);
+  rb_entry_t *entry = rb_entry_at(rb, reader_index);
 
   return (entry->write_index != reader_index);
 }
\ No newline at end of file
@@ -0,0 +1,199 @@
+/*
+ * Consumption rate of ring buffer readers, reading one entry at a time as the
+ * RX loop used to (rb_available() and rb_read() per frame) against batches of
+ * rb_read_batch(), for 1, 4 and 16 readers.
+ *
+ * The writer fills the ring in rounds, and every reader catches up after each
+ * of them, as the entities sharing a port do between two dispatches.
+ *
+ * Usage: bench_ringbuffer [rounds]
+ */
+
+#include "ringbuffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+/* A power of two, as the variable-length layout needs */
+#define BENCH_RING_SIZE (1u << 20)
+#define BENCH_SLOT_SIZE 1536
+/* Fewer than fit in the ring in any layout, so no reader is overrun */
+#define BENCH_ROUND_ENTRIES 128
+#define BENCH_FRAME_LEN 128
+#define BENCH_BATCH 16
+#define BENCH_DEFAULT_ROUNDS 20000
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+enum bench_layout {
+  BENCH_LAYOUT_MODULO,
+  BENCH_LAYOUT_POW2,
+  BENCH_LAYOUT_VAR,
+};
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static const char *const bench_layout_names[] = {
+    [BENCH_LAYOUT_MODULO] = "modulo",
+    [BENCH_LAYOUT_POW2] = "pow2",
+    [BENCH_LAYOUT_VAR] = "var",
+};
+
+/* Keeps the compiler from dropping reads of the frames */
+static volatile uint32_t bench_checksum;
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+static uint64_t bench_now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+static void bench_init_ring(ringbuffer_t *rb, uint8_t *buffer, uint32_t size,
+                            enum bench_layout layout) {
+  rb_result_t res;
+
+  switch (layout) {
+  case BENCH_LAYOUT_MODULO:
+    /* Entries of the slot size itself are not a power of two */
+    res = rb_init(rb, buffer, size, BENCH_SLOT_SIZE);
+    break;
+  case BENCH_LAYOUT_POW2:
+    res = rb_init_pow2(rb, buffer, size, BENCH_SLOT_SIZE);
+    break;
+  default:
+    res = rb_init_var(rb, buffer, size);
+    break;
+  }
+
+  if (res != RB_OK) {
+    fprintf(stderr, "Cannot initialize the ring: %d\n", res);
+    exit(1);
+  }
+}
+
+static void bench_write_round(ringbuffer_t *rb, const uint8_t *frame) {
+  for (uint32_t i = 0; i < BENCH_ROUND_ENTRIES; i++) {
+    uint32_t len = rb->var_length ? BENCH_FRAME_LEN : BENCH_SLOT_SIZE;
+
+    if (rb_write(rb, frame, len) != RB_OK) {
+      fprintf(stderr, "Cannot write to the ring\n");
+      exit(1);
+    }
+  }
+}
+
+static uint64_t bench_read_single(ringbuffer_t *rb, uint32_t *reader_index,
+                                  uint8_t *copy) {
+  uint64_t count = 0;
+
+  while (rb_available(rb, *reader_index) > 0) {
+    uint32_t len;
+
+    if (rb_read_next(rb, reader_index, copy, BENCH_SLOT_SIZE, &len) !=
+        RB_OK) {
+      fprintf(stderr, "Reader overrun\n");
+      exit(1);
+    }
+
+    bench_checksum += copy[0];
+    count++;
+  }
+
+  return count;
+}
+
+static uint64_t bench_read_batched(ringbuffer_t *rb, uint32_t *reader_index) {
+  rb_iovec_t iov[BENCH_BATCH];
+  uint64_t count = 0;
+  uint32_t batch;
+
+  do {
+    if (rb_read_batch(rb, *reader_index, iov, BENCH_BATCH, &batch) != RB_OK) {
+      fprintf(stderr, "Reader overrun\n");
+      exit(1);
+    }
+
+    for (uint32_t i = 0; i < batch; i++) {
+      bench_checksum += ((const uint8_t *)iov[i].base)[0];
+    }
+
+    if (batch > 0) {
+      *reader_index = iov[batch - 1].next_index;
+    }
+
+    count += batch;
+  } while (batch == BENCH_BATCH);
+
+  return count;
+}
+
+static void bench_run(enum bench_layout layout, unsigned reader_count,
+                      bool batched, unsigned rounds) {
+  uint8_t *buffer = malloc(BENCH_RING_SIZE);
+  uint8_t frame[BENCH_SLOT_SIZE] = {1};
+  uint8_t copy[BENCH_SLOT_SIZE];
+  uint32_t readers[16] = {0};
+  ringbuffer_t rb;
+  uint64_t count = 0;
+
+  if (buffer == NULL) {
+    fprintf(stderr, "Out of memory\n");
+    exit(1);
+  }
+
+  bench_init_ring(&rb, buffer, BENCH_RING_SIZE, layout);
+
+  uint64_t start_ns = bench_now_ns();
+
+  for (unsigned round = 0; round < rounds; round++) {
+    bench_write_round(&rb, frame);
+
+    for (unsigned i = 0; i < reader_count; i++) {
+      count += batched ? bench_read_batched(&rb, &readers[i])
+                       : bench_read_single(&rb, &readers[i], copy);
+    }
+  }
+
+  double elapsed = (bench_now_ns() - start_ns) / 1e9;
+
+  printf("%-7s %2u readers %-8s %14.0f entries/s\n", bench_layout_names[layout],
+         reader_count, batched ? "batched" : "single", count / elapsed);
+
+  free(buffer);
+}
+
+/******************************************************************************
+ Benchmark
+ ******************************************************************************/
+
+int main(int argc, char *argv[]) {
+  static const unsigned reader_counts[] = {1, 4, 16};
+  unsigned rounds = BENCH_DEFAULT_ROUNDS;
+
+  if (argc > 1) {
+    rounds = strtoul(argv[1], NULL, 10);
+  }
+
+  for (int layout = 0; layout <= BENCH_LAYOUT_VAR; layout++) {
+    for (size_t i = 0; i < sizeof(reader_counts) / sizeof(reader_counts[0]);
+         i++) {
+      bench_run(layout, reader_counts[i], false, rounds);
+      bench_run(layout, reader_counts[i], true, rounds);
+    }
+  }
+
+  return 0;
+}
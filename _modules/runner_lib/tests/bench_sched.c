@@ -0,0 +1,196 @@
+/*
+ * Throughput of the scheduler against the number of entities.
+ *
+ * Every count given on the command line is run in a process of its own, in
+ * which the runner registers that many synthetic entities from its nsi_init()
+ * and then only wakes up once more to end the run. A synthetic event does no
+ * work, so the measured rate is the cost of the scheduler itself.
+ *
+ * Usage: bench_sched [entity count]...
+ */
+
+#define main ftest_shed_main
+#include "../src/ftest_sched.c"
+#undef main
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+/* Roughly as many events are dispatched whatever the number of entities */
+#define BENCH_EVENTS 4000000ull
+#define BENCH_PERIOD 1000ull
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+struct bench_entity {
+  struct ftest_shed_entity_config config;
+  uint64_t time;
+  uint64_t period;
+};
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static struct bench_entity *bench_entities;
+static unsigned bench_entity_count;
+
+/**
+ * The scheduler only queries the timeline of an entity right after it
+ * initialized or executed it, so the entity that last ran answers them.
+ */
+static struct bench_entity *bench_active;
+
+static uint64_t bench_end_time;
+static uint64_t bench_runner_time;
+static uint64_t bench_event_count;
+static uint64_t bench_start_ns;
+
+/******************************************************************************
+ Synthetic entities
+ ******************************************************************************/
+
+static void bench_activate(void) {
+  uint32_t instance = ftest_shed_get_instance(ftest_shed_get_current_entity());
+
+  bench_active = &bench_entities[instance];
+}
+
+static void bench_init(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  bench_activate();
+}
+
+static void bench_exec(void) {
+  bench_activate();
+  bench_active->time += bench_active->period;
+  bench_event_count++;
+}
+
+static void bench_find_next_event(void) {}
+
+static uint64_t bench_get_next_event_time(void) {
+  return bench_active->time + bench_active->period;
+}
+
+static uint64_t bench_get_time(void) { return bench_active->time; }
+
+/******************************************************************************
+ Runner
+ ******************************************************************************/
+
+void nsi_init(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  bench_entities = calloc(bench_entity_count, sizeof(*bench_entities));
+  if (bench_entities == NULL) {
+    nsi_print_error_and_exit("Out of memory\n");
+  }
+
+  for (unsigned i = 0; i < bench_entity_count; i++) {
+    struct bench_entity *entity = &bench_entities[i];
+
+    /* Periods differ, so the order of the entities keeps changing */
+    entity->period = BENCH_PERIOD + i % 7 * 100;
+    entity->config = (struct ftest_shed_entity_config){
+        .name = "synthetic",
+        .instance = i,
+        .init_func = bench_init,
+        .exec_func = bench_exec,
+        .find_next_event = bench_find_next_event,
+        .get_next_event_time = bench_get_next_event_time,
+        .get_time = bench_get_time,
+    };
+
+    if (ftest_add_entity_to_schedule(&entity->config) < 0) {
+      nsi_print_error_and_exit("Cannot schedule entity %u\n", i);
+    }
+  }
+
+  bench_start_ns = ftest_shed_get_wall_time_ns();
+}
+
+void nsi_hws_one_event(void) {
+  double elapsed = (ftest_shed_get_wall_time_ns() - bench_start_ns) / 1e9;
+
+  printf("%10u entities %12llu events %8.3f s %14.0f events/s\n",
+         bench_entity_count, (unsigned long long)bench_event_count, elapsed,
+         bench_event_count / elapsed);
+
+  exit(0);
+}
+
+void nsi_hws_find_next_event(void) {}
+
+uint64_t nsi_hws_get_next_event_time(void) { return bench_end_time; }
+
+uint64_t nsi_hws_get_time(void) { return bench_runner_time; }
+
+void ftest_jobs_fork(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+}
+
+/******************************************************************************
+ Benchmark
+ ******************************************************************************/
+
+static int bench_run(unsigned entity_count) {
+  pid_t pid = fork();
+
+  if (pid < 0) {
+    return -1;
+  }
+
+  if (pid == 0) {
+    bench_entity_count = entity_count;
+    bench_end_time = BENCH_EVENTS * BENCH_PERIOD / entity_count;
+
+    char *argv[] = {"bench_sched", NULL};
+    ftest_shed_main(1, argv);
+  }
+
+  int status;
+
+  if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  static const unsigned default_counts[] = {1, 10, 100, 1000, 10000};
+  size_t default_count_len = sizeof(default_counts) / sizeof(default_counts[0]);
+
+  if (argc < 2) {
+    for (size_t i = 0; i < default_count_len; i++) {
+      if (bench_run(default_counts[i]) < 0) {
+        return 1;
+      }
+    }
+
+    return 0;
+  }
+
+  for (int i = 1; i < argc; i++) {
+    unsigned long count = strtoul(argv[i], NULL, 10);
+
+    if (count == 0 || bench_run(count) < 0) {
+      fprintf(stderr, "Benchmark with %s entities failed\n", argv[i]);
+      return 1;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdbool.h>
+
+struct args_struct_t {
+  bool is_mandatory;
+  bool is_switch;
+  char *option;
+  char *name;
+  char type;
+  void *dest;
+  void (*call_when_found)(char *argv, int offset);
+  char *descript;
+};
+
+#define ARG_TABLE_ENDMARKER {false, false, NULL, NULL, 0, NULL, NULL, NULL}
+
+void nsi_add_command_line_opts(struct args_struct_t *args);
@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+
+#define NSI_NEVER UINT64_MAX
+
+uint64_t nsi_hws_get_time(void);
+void nsi_hws_one_event(void);
+void nsi_hws_find_next_event(void);
+uint64_t nsi_hws_get_next_event_time(void);
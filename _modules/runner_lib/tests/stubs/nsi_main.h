@@ -0,0 +1,3 @@
+#pragma once
+
+void nsi_exit(int exit_code);
@@ -0,0 +1,3 @@
+#pragma once
+
+void nsi_init(int argc, char *argv[]);
@@ -0,0 +1,40 @@
+#include "nsi_cmdline.h"
+#include "nsi_main.h"
+#include "nsi_tracing.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/******************************************************************************
+ Stand-ins for the native simulator, for the host tests
+ ******************************************************************************/
+
+void nsi_print_error_and_exit(const char *format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+
+  exit(1);
+}
+
+void nsi_print_warning(const char *format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+}
+
+void nsi_print_trace(const char *format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  vfprintf(stdout, format, args);
+  va_end(args);
+}
+
+void nsi_exit(int exit_code) { exit(exit_code); }
+
+void nsi_add_command_line_opts(struct args_struct_t *args) { (void)args; }
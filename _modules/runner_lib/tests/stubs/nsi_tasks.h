@@ -0,0 +1,5 @@
+#pragma once
+
+/* Tasks are not run by the host tests, which call what they need directly */
+#define NSI_TASK(fn, level, prio)                                              \
+  static void (*const fn##_task)(void) __attribute__((unused)) = fn
@@ -0,0 +1,4 @@
+#pragma once
+
+#define NSI_CODE_UNREACHABLE __builtin_unreachable()
+#define NSI_ARG_UNUSED(x) (void)(x)
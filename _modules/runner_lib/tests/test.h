@@ -0,0 +1,45 @@
+#pragma once
+#include <stdio.h>
+#include <stdlib.h>
+
+/******************************************************************************
+ Checks of the host tests, which stay enabled whatever the build type
+ ******************************************************************************/
+
+#define CHECK(cond)                                                            \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      exit(1);                                                                 \
+    }                                                                          \
+  } while (0)
+
+#define CHECK_EQ(actual, expected)                                             \
+  do {                                                                         \
+    long long actual_value = (long long)(actual);                              \
+    long long expected_value = (long long)(expected);                          \
+    if (actual_value != expected_value) {                                      \
+      fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__,          \
+              __LINE__, #actual, actual_value, expected_value);                \
+      exit(1);                                                                 \
+    }                                                                          \
+  } while (0)
+
+struct test_case {
+  const char *name;
+  void (*func)(void);
+};
+
+#define TEST_CASE(func) {#func, func}
+
+/**
+ * Run the test cases in order, as a failed check ends the process.
+ */
+static inline int test_run(const struct test_case *cases, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    cases[i].func();
+    printf("%s: ok\n", cases[i].name);
+  }
+
+  return 0;
+}
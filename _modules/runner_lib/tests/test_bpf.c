@@ -0,0 +1,335 @@
+/*
+ * Validation and interpretation of classic BPF capture filters. The programs
+ * in bpf/ were compiled with `tcpdump -ddd` for Ethernet:
+ *
+ *   not_arp.bpf      not arp
+ *   tcp_port_80.bpf  tcp port 80
+ *   greater_100.bpf  greater 100
+ */
+
+#include "ftest_bpf.h"
+#include "test.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#define BPF_LD_W_ABS 0x20
+#define BPF_LD_H_ABS 0x28
+#define BPF_LD_MEM 0x60
+#define BPF_LDX_MEM 0x61
+#define BPF_ST 0x02
+#define BPF_STX 0x03
+#define BPF_ALU_DIV_K 0x34
+#define BPF_ALU_DIV_X 0x3c
+#define BPF_ALU_MOD_K 0x94
+#define BPF_JMP_JA 0x05
+#define BPF_JMP_JEQ_K 0x15
+#define BPF_RET_K 0x06
+#define BPF_RET_A 0x16
+
+#define ACCEPT 262144
+
+#define ETH_TYPE_IPV4 0x0800
+#define ETH_TYPE_ARP 0x0806
+#define ETH_TYPE_IPV6 0x86dd
+
+#define IP_PROTO_TCP 6
+#define IP_PROTO_UDP 17
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+static void put16(uint8_t *at, uint16_t value) {
+  at[0] = value >> 8;
+  at[1] = value & 0xff;
+}
+
+static struct ftest_bpf_prog load(const char *name) {
+  struct ftest_bpf_prog prog;
+  char path[512];
+
+  snprintf(path, sizeof(path), "%s/%s", TEST_BPF_DIR, name);
+  CHECK_EQ(ftest_bpf_load(&prog, path), 0);
+
+  return prog;
+}
+
+static bool valid(const struct ftest_bpf_insn *insns, uint32_t len) {
+  errno = 0;
+  int res = ftest_bpf_validate(insns, len);
+
+  CHECK(res == 0 || errno == EINVAL);
+
+  return res == 0;
+}
+
+/**
+ * Build an Ethernet frame of the given type, with an IPv4 header of ihl
+ * 32-bit words or a fixed IPv6 header, followed by ports.
+ *
+ * @return The length of the frame
+ */
+static uint32_t build_frame(uint8_t *frame, uint16_t eth_type, uint8_t proto,
+                            uint8_t ihl, uint16_t frag, uint16_t src_port,
+                            uint16_t dst_port) {
+  memset(frame, 0, 128);
+  put16(frame + 12, eth_type);
+
+  uint32_t l4 = 14;
+
+  if (eth_type == ETH_TYPE_IPV4) {
+    frame[14] = 0x40 | ihl;
+    put16(frame + 20, frag);
+    frame[23] = proto;
+    l4 += ihl * 4;
+  } else if (eth_type == ETH_TYPE_IPV6) {
+    frame[14] = 0x60;
+    frame[20] = proto;
+    l4 += 40;
+  } else {
+    return 42;
+  }
+
+  put16(frame + l4, src_port);
+  put16(frame + l4 + 2, dst_port);
+
+  return l4 + 20;
+}
+
+/******************************************************************************
+ Validation
+ ******************************************************************************/
+
+static void test_validate_return(void) {
+  const struct ftest_bpf_insn ret = {BPF_RET_K, 0, 0, 1};
+  const struct ftest_bpf_insn ld = {BPF_LD_H_ABS, 0, 0, 12};
+  const struct ftest_bpf_insn no_ret[] = {ret, ld};
+
+  CHECK(valid(&ret, 1));
+  CHECK(!valid(&ret, 0));
+  CHECK(!valid(no_ret, 2));
+  CHECK(!valid(&ret, FTEST_BPF_MAX_INSNS + 1));
+}
+
+static void test_validate_jump_bounds(void) {
+  /* A jump may target the last instruction, not past it */
+  struct ftest_bpf_insn prog[] = {
+      {BPF_JMP_JEQ_K, 1, 0, 1},
+      {BPF_RET_K, 0, 0, 0},
+      {BPF_RET_K, 0, 0, 1},
+  };
+
+  CHECK(valid(prog, 3));
+
+  prog[0].jt = 2;
+  CHECK(!valid(prog, 3));
+
+  prog[0].jt = 0;
+  prog[0].jf = 2;
+  CHECK(!valid(prog, 3));
+
+  prog[0] = (struct ftest_bpf_insn){BPF_JMP_JA, 0, 0, 1};
+  CHECK(valid(prog, 3));
+
+  prog[0].k = 2;
+  CHECK(!valid(prog, 3));
+
+  /* Large enough to loop back if it were added as a signed offset */
+  prog[0].k = UINT32_MAX;
+  CHECK(!valid(prog, 3));
+}
+
+static void test_validate_division(void) {
+  struct ftest_bpf_insn prog[] = {
+      {BPF_ALU_DIV_K, 0, 0, 2},
+      {BPF_RET_A, 0, 0, 0},
+  };
+
+  CHECK(valid(prog, 2));
+
+  prog[0].k = 0;
+  CHECK(!valid(prog, 2));
+
+  prog[0].code = BPF_ALU_MOD_K;
+  CHECK(!valid(prog, 2));
+
+  /* Division by X is checked when it runs */
+  prog[0].code = BPF_ALU_DIV_X;
+  CHECK(valid(prog, 2));
+}
+
+static void test_validate_memory(void) {
+  const uint16_t codes[] = {BPF_LD_MEM, BPF_LDX_MEM, BPF_ST, BPF_STX};
+
+  for (size_t i = 0; i < sizeof(codes) / sizeof(codes[0]); i++) {
+    struct ftest_bpf_insn prog[] = {
+        {codes[i], 0, 0, 15},
+        {BPF_RET_K, 0, 0, 0},
+    };
+
+    CHECK(valid(prog, 2));
+
+    prog[0].k = 16;
+    CHECK(!valid(prog, 2));
+  }
+}
+
+static void test_validate_unknown_code(void) {
+  /* Classic BPF has no double-word loads */
+  const struct ftest_bpf_insn prog[] = {
+      {BPF_LD_W_ABS | 0x18, 0, 0, 0},
+      {BPF_RET_K, 0, 0, 0},
+  };
+
+  CHECK(!valid(prog, 2));
+}
+
+/******************************************************************************
+ Loading
+ ******************************************************************************/
+
+static void test_load_errors(void) {
+  struct ftest_bpf_prog prog;
+  char path[512];
+
+  snprintf(path, sizeof(path), "%s/missing.bpf", TEST_BPF_DIR);
+  CHECK_EQ(ftest_bpf_load(&prog, path), -1);
+  CHECK_EQ(errno, ENOENT);
+
+  const char *bad[] = {
+      "",
+      "0\n",
+      "2\n6 0 0 0\n",
+      "1\n40 0 0 12\n",
+      "2\n21 0 5 1\n6 0 0 0\n",
+      "2\n52 0 0 0\n6 0 0 1\n",
+      "1\n6 0 300 0\n",
+  };
+
+  snprintf(path, sizeof(path), "test_bpf_bad.bpf");
+
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    FILE *file = fopen(path, "w");
+    CHECK(file != NULL);
+    fputs(bad[i], file);
+    fclose(file);
+
+    CHECK_EQ(ftest_bpf_load(&prog, path), -1);
+    CHECK_EQ(errno, EINVAL);
+  }
+
+  remove(path);
+}
+
+/******************************************************************************
+ Running tcpdump programs
+ ******************************************************************************/
+
+static void test_run_not_arp(void) {
+  struct ftest_bpf_prog prog = load("not_arp.bpf");
+  uint8_t frame[128];
+
+  CHECK_EQ(prog.len, 4);
+
+  uint32_t len = build_frame(frame, ETH_TYPE_ARP, 0, 0, 0, 0, 0);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, len), 0);
+
+  len = build_frame(frame, ETH_TYPE_IPV4, IP_PROTO_UDP, 5, 0, 1, 2);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, len), ACCEPT);
+
+  /* Too short to hold the type, which drops it */
+  CHECK_EQ(ftest_bpf_run(&prog, frame, 13), 0);
+
+  ftest_bpf_free(&prog);
+  CHECK(prog.insns == NULL);
+}
+
+static void test_run_tcp_port_80(void) {
+  struct ftest_bpf_prog prog = load("tcp_port_80.bpf");
+  uint8_t frame[128];
+  uint32_t len;
+
+  CHECK_EQ(prog.len, 20);
+
+  len = build_frame(frame, ETH_TYPE_IPV4, IP_PROTO_TCP, 5, 0, 1234, 80);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, len), ACCEPT);
+
+  len = build_frame(frame, ETH_TYPE_IPV4, IP_PROTO_TCP, 5, 0, 80, 1234);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, len), ACCEPT);
+
+  /* IP options move the ports, which the program finds with the X register */
+  len = build_frame(frame, ETH_TYPE_IPV4, IP_PROTO_TCP, 7, 0, 1234, 80);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, len), ACCEPT);
+
+  len = build_frame(frame, ETH_TYPE_IPV4, IP_PROTO_TCP, 5, 0, 1234, 8080);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, len), 0);
+
+  len = build_frame(frame, ETH_TYPE_IPV4, IP_PROTO_UDP, 5, 0, 1234, 80);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, len), 0);
+
+  /* A later fragment has no ports */
+  len = build_frame(frame, ETH_TYPE_IPV4, IP_PROTO_TCP, 5, 100, 1234, 80);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, len), 0);
+
+  len = build_frame(frame, ETH_TYPE_IPV6, IP_PROTO_TCP, 0, 0, 1234, 80);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, len), ACCEPT);
+
+  len = build_frame(frame, ETH_TYPE_IPV6, IP_PROTO_UDP, 0, 0, 1234, 80);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, len), 0);
+
+  /* Cut before the destination port, so reading it fails */
+  len = build_frame(frame, ETH_TYPE_IPV4, IP_PROTO_TCP, 5, 0, 1234, 80);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, 14 + 20 + 2), 0);
+
+  ftest_bpf_free(&prog);
+}
+
+static void test_run_greater_100(void) {
+  struct ftest_bpf_prog prog = load("greater_100.bpf");
+  uint8_t frame[128] = {0};
+
+  CHECK_EQ(ftest_bpf_run(&prog, frame, 99), 0);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, 100), ACCEPT);
+  CHECK_EQ(ftest_bpf_run(&prog, frame, 128), ACCEPT);
+
+  ftest_bpf_free(&prog);
+}
+
+static void test_run_division_by_x(void) {
+  /* X is zero when the program starts */
+  struct ftest_bpf_insn insns[] = {
+      {BPF_ALU_DIV_X, 0, 0, 0},
+      {BPF_RET_K, 0, 0, 1},
+  };
+  struct ftest_bpf_prog prog = {insns, 2};
+  uint8_t frame[1] = {0};
+
+  CHECK(valid(insns, 2));
+  CHECK_EQ(ftest_bpf_run(&prog, frame, sizeof(frame)), 0);
+}
+
+/******************************************************************************
+ Test cases
+ ******************************************************************************/
+
+int main(void) {
+  static const struct test_case cases[] = {
+      TEST_CASE(test_validate_return),
+      TEST_CASE(test_validate_jump_bounds),
+      TEST_CASE(test_validate_division),
+      TEST_CASE(test_validate_memory),
+      TEST_CASE(test_validate_unknown_code),
+      TEST_CASE(test_load_errors),
+      TEST_CASE(test_run_not_arp),
+      TEST_CASE(test_run_tcp_port_80),
+      TEST_CASE(test_run_greater_100),
+      TEST_CASE(test_run_division_by_x),
+  };
+
+  return test_run(cases, sizeof(cases) / sizeof(cases[0]));
+}
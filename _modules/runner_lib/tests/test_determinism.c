@@ -0,0 +1,582 @@
+/*
+ * Determinism of the scheduler: nodes exchanging frames through the
+ * in-process network switch, over links with jitter, loss and reordering,
+ * leave the same log of their events and of the frames they received, and
+ * the same capture, however they are scheduled.
+ *
+ * Built once as is, once with CONFIG_FTEST_SHED_BATCH and once with
+ * CONFIG_FTEST_SHED_PARALLEL, each build writing the log and the capture to
+ * files of its own, which CTest compares byte for byte with the ones of the
+ * serial build. The trace of the scheduler groups the events by dispatch,
+ * batch or window, so the nodes log their events themselves. The parallel
+ * build also checks that a deferred doorbell rung within its own window is
+ * fatal.
+ */
+
+#define main ftest_shed_main
+#include "../src/ftest_sched.c"
+#undef main
+
+#include "../src/ftest_pcap.c"
+
+#include "ftest_eth_buf.h"
+#include "ftest_eth_link.h"
+#include "test.h"
+#include <inttypes.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#define TEST_NODE_COUNT 6
+#define TEST_END_TIME 100000
+#define TEST_MAX_SEND_INTERVAL 200
+#define TEST_RING_SIZE 65536
+#define TEST_DELAY_LINE_SIZE 16
+#define TEST_ETHERTYPE 0x88b5
+#define TEST_PAYLOAD_LEN 64
+#define TEST_FRAME_LEN (2 * FTEST_ETH_BUF_MAC_LEN + 2 + TEST_PAYLOAD_LEN)
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+struct test_delayed {
+  uint64_t deliver_time;
+  uint32_t src;
+  uint32_t seq;
+};
+
+struct test_node {
+  struct ftest_shed_entity_config config;
+  struct ftest_shed_entity_entry *entry;
+  struct ftest_eth_link link;
+  uint8_t mac[FTEST_ETH_BUF_MAC_LEN];
+  int port;
+  uint32_t reader_index;
+  uint64_t rng;
+  uint32_t seq;
+
+  uint64_t time;
+  uint64_t send_time;
+  uint64_t doorbell_time;
+
+  /* Frames taken from the ring before they are due, sorted as the interface
+   * sorts them */
+  struct test_delayed delay_line[TEST_DELAY_LINE_SIZE];
+  size_t delayed_count;
+
+  char *log;
+  size_t log_len;
+  FILE *log_file;
+  size_t receive_count;
+
+  /* Rings the doorbell of another node at its own time with every frame */
+  struct test_node *ring_target;
+};
+
+struct test_ring {
+  struct test_node *target;
+  uint64_t time;
+};
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static const struct ftest_eth_link_config test_link = {
+    .latency_us = 100,
+    .jitter_us = 50,
+    .loss_ppm = 10000,
+    .reorder_ppm = 20000,
+    .seed = 7,
+};
+
+static const uint8_t test_broadcast[FTEST_ETH_BUF_MAC_LEN] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+static struct test_node test_nodes[TEST_NODE_COUNT];
+
+/******************************************************************************
+ Runner
+ ******************************************************************************/
+
+void nsi_init(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+}
+
+void nsi_hws_one_event(void) { CHECK(false); }
+
+void nsi_hws_find_next_event(void) {}
+
+uint64_t nsi_hws_get_next_event_time(void) { return NSI_NEVER; }
+
+uint64_t nsi_hws_get_time(void) { return 0; }
+
+void ftest_jobs_fork(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+}
+
+const char *ftest_jobs_file_name(const char *name, char *buf, size_t size) {
+  (void)buf;
+  (void)size;
+
+  return name;
+}
+
+/******************************************************************************
+ Receiving
+ ******************************************************************************/
+
+static void test_node_deliver(struct test_node *node,
+                              const struct test_delayed *delayed) {
+  /* Never late, whichever frame the node was woken up for */
+  CHECK_EQ(node->time, delayed->deliver_time);
+
+  fprintf(node->log_file, "%" PRIu64 " receive %" PRIu32 ":%" PRIu32 "\n",
+          node->time, delayed->src, delayed->seq);
+  node->receive_count++;
+}
+
+static void test_node_delay(struct test_node *node,
+                            const struct test_delayed *delayed) {
+  size_t i = node->delayed_count;
+
+  while (i > 0 &&
+         node->delay_line[i - 1].deliver_time > delayed->deliver_time) {
+    node->delay_line[i] = node->delay_line[i - 1];
+    i--;
+  }
+
+  node->delay_line[i] = *delayed;
+  node->delayed_count++;
+}
+
+/**
+ * Receive the frames as the interfaces do: due frames are delivered, the
+ * others held back on the delay line, and the ones sent less than the
+ * lookahead ago left in the ring.
+ *
+ * @return The earliest delivery time of a frame still on the link, NSI_NEVER
+ * if there is none
+ */
+static uint64_t test_node_receive(struct test_node *node) {
+  ringbuffer_t *rb = ftest_eth_buf_get_ring(node->port);
+  uint64_t lookahead = ftest_shed_get_lookahead();
+  uint64_t blocked_time = NSI_NEVER;
+  size_t due = 0;
+
+  while (due < node->delayed_count &&
+         node->delay_line[due].deliver_time <= node->time) {
+    test_node_deliver(node, &node->delay_line[due]);
+    due++;
+  }
+
+  node->delayed_count -= due;
+  memmove(node->delay_line, node->delay_line + due,
+          node->delayed_count * sizeof(node->delay_line[0]));
+
+  while (true) {
+    rb_iovec_t frame;
+    uint32_t count;
+
+    CHECK_EQ(rb_read_batch(rb, node->reader_index, &frame, 1, &count), RB_OK);
+
+    if (count == 0) {
+      break;
+    }
+
+    const struct ftest_eth_hdr *hdr = frame.base;
+    const uint8_t *payload = hdr->payload + 2 * FTEST_ETH_BUF_MAC_LEN + 2;
+    struct test_delayed delayed = {.deliver_time = hdr->deliver_time};
+
+    CHECK_EQ(hdr->len, TEST_FRAME_LEN);
+    memcpy(&delayed.src, payload, sizeof(delayed.src));
+    memcpy(&delayed.seq, payload + sizeof(delayed.src), sizeof(delayed.seq));
+
+    if (hdr->sent_time + lookahead > node->time) {
+      blocked_time = hdr->sent_time + lookahead;
+      break;
+    }
+
+    if (hdr->deliver_time > node->time &&
+        node->delayed_count == TEST_DELAY_LINE_SIZE) {
+      blocked_time = hdr->deliver_time;
+      break;
+    }
+
+    node->reader_index = frame.next_index;
+
+    if (hdr->deliver_time <= node->time) {
+      test_node_deliver(node, &delayed);
+    } else {
+      test_node_delay(node, &delayed);
+    }
+  }
+
+  if (node->delayed_count > 0 &&
+      node->delay_line[0].deliver_time < blocked_time) {
+    return node->delay_line[0].deliver_time;
+  }
+
+  return blocked_time;
+}
+
+/******************************************************************************
+ Sending
+ ******************************************************************************/
+
+static int test_ring(const void *data, uint32_t len) {
+  const struct test_ring *ring = data;
+
+  (void)len;
+
+  return ftest_shed_ring_doorbell(ring->target->entry, ring->time);
+}
+
+static uint32_t test_node_random(struct test_node *node) {
+  node->rng = node->rng * 6364136223846793005ULL + 1442695040888963407ULL;
+
+  return node->rng >> 33;
+}
+
+/**
+ * Send a frame to a random node, or to all of them, through the switch as the
+ * runner does for the frames which are not built in place.
+ */
+static void test_node_send(struct test_node *node) {
+  union {
+    struct ftest_eth_hdr hdr;
+    uint8_t bytes[sizeof(struct ftest_eth_hdr) + TEST_FRAME_LEN];
+  } frame = {0};
+  uint32_t index = node - test_nodes;
+  uint32_t dst = test_node_random(node) % (TEST_NODE_COUNT + 1);
+  uint8_t *payload = frame.hdr.payload + 2 * FTEST_ETH_BUF_MAC_LEN + 2;
+  uint64_t deliver_time;
+
+  node->seq++;
+
+  if (!ftest_eth_link_transmit(&node->link, node->time, TEST_FRAME_LEN,
+                               &deliver_time)) {
+    fprintf(node->log_file, "%" PRIu64 " lost %" PRIu32 "\n", node->time,
+            node->seq);
+    return;
+  }
+
+  frame.hdr.len = TEST_FRAME_LEN;
+  frame.hdr.sent_time = node->time;
+  frame.hdr.deliver_time = deliver_time;
+  frame.hdr.src_port = node->port;
+  memcpy(frame.hdr.payload,
+         dst < TEST_NODE_COUNT ? test_nodes[dst].mac : test_broadcast,
+         FTEST_ETH_BUF_MAC_LEN);
+  memcpy(frame.hdr.payload + FTEST_ETH_BUF_MAC_LEN, node->mac,
+         FTEST_ETH_BUF_MAC_LEN);
+  frame.hdr.payload[2 * FTEST_ETH_BUF_MAC_LEN] = TEST_ETHERTYPE >> 8;
+  frame.hdr.payload[2 * FTEST_ETH_BUF_MAC_LEN + 1] = TEST_ETHERTYPE & 0xff;
+  memcpy(payload, &index, sizeof(index));
+  memcpy(payload + sizeof(index), &node->seq, sizeof(node->seq));
+
+  CHECK_EQ(ftest_shed_defer(node->entry, ftest_eth_buf_commit, frame.bytes,
+                            sizeof(frame.bytes)),
+           0);
+
+  if (node->ring_target != NULL) {
+    const struct test_ring ring = {node->ring_target, node->time};
+
+    CHECK_EQ(ftest_shed_defer(node->entry, test_ring, &ring, sizeof(ring)), 0);
+  }
+
+  fprintf(node->log_file, "%" PRIu64 " send %" PRIu32 " to %" PRIu32 "\n",
+          node->time, node->seq, dst);
+}
+
+/******************************************************************************
+ Test nodes
+ ******************************************************************************/
+
+static void test_node_init(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+}
+
+static uint64_t test_node_next(const struct test_node *node) {
+  return node->send_time < node->doorbell_time ? node->send_time
+                                               : node->doorbell_time;
+}
+
+static void test_node_exec(struct test_node *node) {
+  node->time = test_node_next(node);
+  fprintf(node->log_file, "%" PRIu64 " event\n", node->time);
+
+  if (node->doorbell_time <= node->time) {
+    node->doorbell_time = NSI_NEVER;
+  }
+
+  if (node->send_time <= node->time) {
+    test_node_send(node);
+    node->send_time +=
+        1 + test_node_random(node) % TEST_MAX_SEND_INTERVAL;
+
+    if (node->send_time >= TEST_END_TIME) {
+      node->send_time = NSI_NEVER;
+    }
+  }
+
+  uint64_t wake_time = test_node_receive(node);
+
+  if (wake_time < node->doorbell_time) {
+    node->doorbell_time = wake_time;
+  }
+}
+
+/* As the entity library does, with the horizon re-read after every event */
+static uint64_t test_node_exec_until(struct test_node *node,
+                                     const uint64_t *horizon) {
+  uint64_t event_count = 0;
+
+  do {
+    test_node_exec(node);
+    event_count++;
+  } while (test_node_next(node) < *horizon);
+
+  return event_count;
+}
+
+static void test_node_doorbell(struct test_node *node, uint64_t time) {
+  if (time < node->doorbell_time) {
+    node->doorbell_time = time;
+  }
+}
+
+static void test_node_find_next_event(void) {}
+
+/* The scheduler asks any entity for its timeline, not only the current one */
+#define TEST_NODE_FUNCS(i)                                                     \
+  static void test_node_exec_##i(void) { test_node_exec(&test_nodes[i]); }     \
+  static uint64_t test_node_exec_until_##i(const uint64_t *horizon) {          \
+    return test_node_exec_until(&test_nodes[i], horizon);                      \
+  }                                                                            \
+  static uint64_t test_node_next_##i(void) {                                   \
+    return test_node_next(&test_nodes[i]);                                     \
+  }                                                                            \
+  static uint64_t test_node_time_##i(void) { return test_nodes[i].time; }      \
+  static void test_node_doorbell_##i(uint64_t time) {                          \
+    test_node_doorbell(&test_nodes[i], time);                                  \
+  }
+
+TEST_NODE_FUNCS(0)
+TEST_NODE_FUNCS(1)
+TEST_NODE_FUNCS(2)
+TEST_NODE_FUNCS(3)
+TEST_NODE_FUNCS(4)
+TEST_NODE_FUNCS(5)
+
+#define TEST_NODE_CONFIG(i)                                                    \
+  {                                                                            \
+      .name = "node",                                                          \
+      .instance = i,                                                           \
+      .init_func = test_node_init,                                             \
+      .exec_func = test_node_exec_##i,                                         \
+      .exec_until_func = test_node_exec_until_##i,                             \
+      .find_next_event = test_node_find_next_event,                            \
+      .get_next_event_time = test_node_next_##i,                               \
+      .get_time = test_node_time_##i,                                          \
+  }
+
+static const struct ftest_shed_entity_config test_node_configs[] = {
+    TEST_NODE_CONFIG(0), TEST_NODE_CONFIG(1), TEST_NODE_CONFIG(2),
+    TEST_NODE_CONFIG(3), TEST_NODE_CONFIG(4), TEST_NODE_CONFIG(5),
+};
+
+static const ftest_shed_doorbell_func_t test_node_doorbells[] = {
+    test_node_doorbell_0, test_node_doorbell_1, test_node_doorbell_2,
+    test_node_doorbell_3, test_node_doorbell_4, test_node_doorbell_5,
+};
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+/**
+ * Register the runner and the nodes, each with an interface of its own on one
+ * segment, as the interfaces of the entities do when they boot, declaring the
+ * given lookahead for links with the given configuration.
+ */
+static void setup(const struct ftest_eth_link_config *link,
+                  uint64_t lookahead) {
+  CHECK_EQ(ftest_add_entity_to_schedule(&runner_entity), 0);
+
+  for (uint32_t i = 0; i < TEST_NODE_COUNT; i++) {
+    struct test_node *node = &test_nodes[i];
+    const uint8_t mac[FTEST_ETH_BUF_MAC_LEN] = {0x02, 0, 0, 0, 0, i + 1};
+
+    node->config = test_node_configs[i];
+    node->rng = i + 1;
+    node->send_time = 1 + test_node_random(node) % TEST_MAX_SEND_INTERVAL;
+    node->doorbell_time = NSI_NEVER;
+    node->log_file = open_memstream(&node->log, &node->log_len);
+    CHECK(node->log_file != NULL);
+    memcpy(node->mac, mac, sizeof(mac));
+
+    CHECK_EQ(ftest_add_entity_to_schedule(&node->config), 0);
+    node->entry = node->config.entry;
+    CHECK_EQ(ftest_shed_set_doorbell(node->entry, test_node_doorbells[i]), 0);
+
+    node->port = ftest_eth_buf_attach("test", mac, TEST_RING_SIZE, 0,
+                                      node->entry);
+    CHECK(node->port >= 0);
+    node->reader_index = rb_get_write_index(ftest_eth_buf_get_ring(node->port));
+
+    ftest_eth_link_init(&node->link, link, mac, sizeof(mac));
+    ftest_shed_declare_lookahead(lookahead);
+  }
+}
+
+/**
+ * Run the scheduler loop until every node went idle.
+ *
+ * @return The number of parallel windows run
+ */
+static size_t run(void) {
+  char *argv[] = {"test_determinism", NULL};
+  size_t window_count = 0;
+
+  while (true) {
+    struct ftest_shed_entity_entry *next =
+        get_next_scheduled_entity_init_if_needed(1, argv);
+
+    if (next->next_event_time == NSI_NEVER) {
+      break;
+    }
+
+#if CONFIG_FTEST_SHED_PARALLEL
+    if (ftest_shed_run_parallel_window()) {
+      window_count++;
+      continue;
+    }
+#endif
+
+    ftest_shed_dispatch(next);
+  }
+
+  return window_count;
+}
+
+static void write_log(void) {
+  FILE *file = fopen(TEST_LOG_FILE, "w");
+
+  CHECK(file != NULL);
+
+  for (size_t i = 0; i < TEST_NODE_COUNT; i++) {
+    struct test_node *node = &test_nodes[i];
+
+    CHECK_EQ(fclose(node->log_file), 0);
+    fprintf(file, "node %zu\n", i);
+    CHECK_EQ(fwrite(node->log, 1, node->log_len, file), node->log_len);
+    free(node->log);
+  }
+
+  CHECK_EQ(fclose(file), 0);
+}
+
+/******************************************************************************
+ Determinism
+ ******************************************************************************/
+
+static void test_network(void) {
+  setup(&test_link, test_link.latency_us);
+
+  size_t window_count = run();
+
+  ftest_pcap_close();
+  write_log();
+
+  /* Enough traffic for the comparison to mean something */
+  for (size_t i = 0; i < TEST_NODE_COUNT; i++) {
+    CHECK(test_nodes[i].receive_count > TEST_END_TIME / TEST_MAX_SEND_INTERVAL);
+    CHECK_EQ(test_nodes[i].delayed_count, 0);
+  }
+
+#if CONFIG_FTEST_SHED_PARALLEL
+  CHECK(window_count > 0);
+#else
+  CHECK_EQ(window_count, 0);
+#endif
+}
+
+#if CONFIG_FTEST_SHED_PARALLEL
+static void test_early_doorbell(void) {
+  int fds[2];
+  char output[256] = {0};
+
+  CHECK_EQ(pipe(fds), 0);
+
+  pid_t pid = fork();
+
+  CHECK(pid >= 0);
+
+  /* A node rings another one at its own time, which the other one may have
+   * run past within the window */
+  if (pid == 0) {
+    dup2(fds[1], STDERR_FILENO);
+
+    /* Without overwriting the capture of test_network */
+    ftest_pcap_failed = true;
+
+    setup(&test_link, test_link.latency_us);
+    test_nodes[0].ring_target = &test_nodes[1];
+    run();
+    exit(0);
+  }
+
+  close(fds[1]);
+
+  int status;
+
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 1);
+  CHECK(read(fds[0], output, sizeof(output) - 1) > 0);
+  CHECK(strstr(output, "within the parallel window") != NULL);
+  close(fds[0]);
+}
+#endif
+
+/******************************************************************************
+ Test cases
+ ******************************************************************************/
+
+static void run_in_child(const struct test_case *test_case) {
+  pid_t pid = fork();
+
+  CHECK(pid >= 0);
+
+  if (pid == 0) {
+    test_run(test_case, 1);
+    exit(0);
+  }
+
+  int status;
+
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(void) {
+  static const struct test_case cases[] = {
+      TEST_CASE(test_network),
+#if CONFIG_FTEST_SHED_PARALLEL
+      TEST_CASE(test_early_doorbell),
+#endif
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    run_in_child(&cases[i]);
+  }
+
+  return 0;
+}
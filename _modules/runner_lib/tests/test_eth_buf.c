@@ -0,0 +1,294 @@
+/*
+ * Switching of the in-process network: the MAC addresses learned on the
+ * ports, the frames flooded to all of them, the isolation of the segments,
+ * and the doorbells rung for the frames written to their rings.
+ *
+ * The switch keeps its ports in static variables, so every test case attaches
+ * ports on segments of its own.
+ */
+
+#include "ftest_eth_buf.h"
+#include "test.h"
+#include <string.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#define TEST_RING_SIZE 4096
+#define TEST_ETHERTYPE_LEN 2
+#define TEST_FRAME_LEN                                                         \
+  (sizeof(struct ftest_eth_hdr) + 2 * FTEST_ETH_BUF_MAC_LEN +                  \
+   TEST_ETHERTYPE_LEN)
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+/* Opaque to the switch, which only hands it back to the scheduler */
+struct ftest_shed_entity_entry {
+  unsigned doorbell_count;
+  uint64_t doorbell_time;
+};
+
+struct test_port {
+  struct ftest_shed_entity_entry entity;
+  uint8_t mac[FTEST_ETH_BUF_MAC_LEN];
+  int port;
+  uint32_t reader_index;
+};
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static const uint8_t test_broadcast[FTEST_ETH_BUF_MAC_LEN] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+static const uint8_t test_multicast[FTEST_ETH_BUF_MAC_LEN] = {
+    0x01, 0x00, 0x5e, 0x00, 0x00, 0xfb};
+
+/******************************************************************************
+ Scheduler
+ ******************************************************************************/
+
+int ftest_shed_ring_doorbell(struct ftest_shed_entity_entry *entity,
+                             uint64_t time) {
+  entity->doorbell_count++;
+  entity->doorbell_time = time;
+
+  return 0;
+}
+
+/* Frames reach the ports as soon as they are sent */
+uint64_t ftest_shed_get_lookahead(void) { return 0; }
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+static void make_mac(uint8_t *mac, uint8_t segment, uint8_t nic) {
+  const uint8_t local[FTEST_ETH_BUF_MAC_LEN] = {0x02, 0, 0, 0, segment, nic};
+
+  memcpy(mac, local, FTEST_ETH_BUF_MAC_LEN);
+}
+
+/**
+ * Attach a port with the given MAC address, and start reading its ring from
+ * the current write index, as an interface does.
+ */
+static void attach(struct test_port *port, const char *segment,
+                   const uint8_t *mac) {
+  memset(port, 0, sizeof(*port));
+  memcpy(port->mac, mac, FTEST_ETH_BUF_MAC_LEN);
+
+  port->port = ftest_eth_buf_attach(segment, mac, TEST_RING_SIZE, 0,
+                                    &port->entity);
+  CHECK(port->port >= 0);
+  port->reader_index = rb_get_write_index(ftest_eth_buf_get_ring(port->port));
+}
+
+/**
+ * Switch a frame from a port, as the runner does for the frames which the
+ * interfaces do not build in place.
+ */
+static void send_frame(const struct test_port *from, const uint8_t *dst_mac,
+                       const uint8_t *src_mac, uint64_t deliver_time) {
+  union {
+    struct ftest_eth_hdr hdr;
+    uint8_t bytes[TEST_FRAME_LEN];
+  } frame = {0};
+
+  frame.hdr.len = 2 * FTEST_ETH_BUF_MAC_LEN + TEST_ETHERTYPE_LEN;
+  frame.hdr.sent_time = deliver_time;
+  frame.hdr.deliver_time = deliver_time;
+  frame.hdr.src_port = from->port;
+  memcpy(frame.hdr.payload, dst_mac, FTEST_ETH_BUF_MAC_LEN);
+  memcpy(frame.hdr.payload + FTEST_ETH_BUF_MAC_LEN, src_mac,
+         FTEST_ETH_BUF_MAC_LEN);
+
+  CHECK_EQ(ftest_eth_buf_commit(frame.bytes, sizeof(frame.bytes)), RB_OK);
+}
+
+/**
+ * Count the frames in the ring of a port not read yet, checking that they
+ * are the ones sent from the given port, and read them.
+ */
+static unsigned receive_frames(struct test_port *port,
+                               const struct test_port *from) {
+  ringbuffer_t *rb = ftest_eth_buf_get_ring(port->port);
+  uint8_t data[TEST_FRAME_LEN];
+  uint32_t read_size;
+  unsigned count = 0;
+
+  while (rb_available(rb, port->reader_index) > 0) {
+    const struct ftest_eth_hdr *hdr = (const struct ftest_eth_hdr *)data;
+
+    CHECK_EQ(rb_read_next(rb, &port->reader_index, data, sizeof(data),
+                          &read_size),
+             RB_OK);
+    CHECK_EQ(read_size, TEST_FRAME_LEN);
+    CHECK_EQ(hdr->src_port, from->port);
+    count++;
+  }
+
+  return count;
+}
+
+/******************************************************************************
+ Learning
+ ******************************************************************************/
+
+static void test_unicast_to_attached(void) {
+  struct test_port a, b, c;
+  uint8_t mac[FTEST_ETH_BUF_MAC_LEN];
+
+  make_mac(mac, 1, 1);
+  attach(&a, "unicast", mac);
+  make_mac(mac, 1, 2);
+  attach(&b, "unicast", mac);
+  make_mac(mac, 1, 3);
+  attach(&c, "unicast", mac);
+
+  /* The address of an interface is known from the moment it is attached */
+  CHECK_EQ(ftest_eth_buf_route(a.port, b.mac, a.mac), b.port);
+  CHECK_EQ(ftest_eth_buf_route(a.port, a.mac, a.mac), FTEST_ETH_BUF_DROP);
+
+  send_frame(&a, b.mac, a.mac, 25);
+  CHECK_EQ(receive_frames(&b, &a), 1);
+  CHECK_EQ(receive_frames(&c, &a), 0);
+  CHECK_EQ(receive_frames(&a, &a), 0);
+
+  /* Only the receiver is woken up, when the frame reaches it */
+  CHECK_EQ(b.entity.doorbell_count, 1);
+  CHECK_EQ(b.entity.doorbell_time, 25);
+  CHECK_EQ(a.entity.doorbell_count, 0);
+  CHECK_EQ(c.entity.doorbell_count, 0);
+}
+
+static void test_learn_source(void) {
+  struct test_port a, b, c;
+  uint8_t mac[FTEST_ETH_BUF_MAC_LEN];
+  uint8_t bridged[FTEST_ETH_BUF_MAC_LEN];
+
+  make_mac(mac, 2, 1);
+  attach(&a, "learn", mac);
+  make_mac(mac, 2, 2);
+  attach(&b, "learn", mac);
+  make_mac(mac, 2, 3);
+  attach(&c, "learn", mac);
+
+  /* A host behind port A, unknown until it sends something */
+  make_mac(bridged, 2, 100);
+  CHECK_EQ(ftest_eth_buf_route(b.port, bridged, b.mac), FTEST_ETH_BUF_FLOOD);
+
+  send_frame(&a, b.mac, bridged, 10);
+  CHECK_EQ(receive_frames(&b, &a), 1);
+  CHECK_EQ(ftest_eth_buf_route(b.port, bridged, b.mac), a.port);
+  CHECK_EQ(ftest_eth_buf_route(c.port, bridged, c.mac), a.port);
+
+  /* Never sent back through the port the address is behind */
+  CHECK_EQ(ftest_eth_buf_route(a.port, bridged, a.mac), FTEST_ETH_BUF_DROP);
+
+  /* Group addresses are not learned when used as the source */
+  send_frame(&a, b.mac, test_multicast, 20);
+  CHECK_EQ(receive_frames(&b, &a), 1);
+  CHECK_EQ(ftest_eth_buf_route(b.port, test_multicast, b.mac),
+           FTEST_ETH_BUF_FLOOD);
+
+  /* And a host which moves is learned on its new port */
+  send_frame(&c, b.mac, bridged, 30);
+  CHECK_EQ(receive_frames(&b, &c), 1);
+  CHECK_EQ(ftest_eth_buf_route(b.port, bridged, b.mac), c.port);
+}
+
+/******************************************************************************
+ Flooding
+ ******************************************************************************/
+
+static void test_flood(void) {
+  struct test_port ports[4];
+  uint8_t mac[FTEST_ETH_BUF_MAC_LEN];
+  uint8_t unknown[FTEST_ETH_BUF_MAC_LEN];
+
+  for (int i = 0; i < 4; i++) {
+    make_mac(mac, 3, i + 1);
+    attach(&ports[i], "flood", mac);
+  }
+
+  make_mac(unknown, 3, 200);
+  CHECK_EQ(ftest_eth_buf_route(ports[0].port, test_broadcast, ports[0].mac),
+           FTEST_ETH_BUF_FLOOD);
+  CHECK_EQ(ftest_eth_buf_route(ports[0].port, test_multicast, ports[0].mac),
+           FTEST_ETH_BUF_FLOOD);
+  CHECK_EQ(ftest_eth_buf_route(ports[0].port, unknown, ports[0].mac),
+           FTEST_ETH_BUF_FLOOD);
+
+  /* Every other port gets each frame once, the sender none of them */
+  send_frame(&ports[0], test_broadcast, ports[0].mac, 5);
+  send_frame(&ports[0], test_multicast, ports[0].mac, 6);
+  send_frame(&ports[0], unknown, ports[0].mac, 7);
+
+  CHECK_EQ(receive_frames(&ports[0], &ports[0]), 0);
+  CHECK_EQ(ports[0].entity.doorbell_count, 0);
+
+  for (int i = 1; i < 4; i++) {
+    CHECK_EQ(receive_frames(&ports[i], &ports[0]), 3);
+    CHECK_EQ(ports[i].entity.doorbell_count, 3);
+    CHECK_EQ(ports[i].entity.doorbell_time, 7);
+  }
+}
+
+/******************************************************************************
+ Segments
+ ******************************************************************************/
+
+static void test_segment_isolation(void) {
+  struct test_port red[2], blue[3];
+  uint8_t mac[FTEST_ETH_BUF_MAC_LEN];
+
+  for (int i = 0; i < 2; i++) {
+    make_mac(mac, 4, i + 1);
+    attach(&red[i], "red", mac);
+    make_mac(mac, 5, i + 1);
+    attach(&blue[i], "blue", mac);
+  }
+
+  /* The same address on another segment is another host */
+  attach(&blue[2], "blue", red[0].mac);
+  CHECK_EQ(ftest_eth_buf_route(red[1].port, red[0].mac, red[1].mac),
+           red[0].port);
+  CHECK_EQ(ftest_eth_buf_route(blue[0].port, red[0].mac, blue[0].mac),
+           blue[2].port);
+
+  /* Floods stay on the segment of the sender */
+  send_frame(&red[0], test_broadcast, red[0].mac, 5);
+  CHECK_EQ(receive_frames(&red[1], &red[0]), 1);
+
+  for (int i = 0; i < 3; i++) {
+    CHECK_EQ(receive_frames(&blue[i], &red[0]), 0);
+    CHECK_EQ(blue[i].entity.doorbell_count, 0);
+  }
+
+  /* An address only known on another segment is unknown, and flooded on the
+   * segment of the sender */
+  CHECK_EQ(ftest_eth_buf_route(red[0].port, blue[0].mac, red[0].mac),
+           FTEST_ETH_BUF_FLOOD);
+  send_frame(&red[0], blue[0].mac, red[0].mac, 6);
+  CHECK_EQ(receive_frames(&red[1], &red[0]), 1);
+  CHECK_EQ(receive_frames(&blue[0], &red[0]), 0);
+}
+
+/******************************************************************************
+ Test cases
+ ******************************************************************************/
+
+int main(void) {
+  static const struct test_case cases[] = {
+      TEST_CASE(test_unicast_to_attached),
+      TEST_CASE(test_learn_source),
+      TEST_CASE(test_flood),
+      TEST_CASE(test_segment_isolation),
+  };
+
+  return test_run(cases, sizeof(cases) / sizeof(cases[0]));
+}
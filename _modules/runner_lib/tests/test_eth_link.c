@@ -0,0 +1,237 @@
+/*
+ * Link emulation of the in-process network interfaces: the delivery time of
+ * the frames from the latency and bandwidth of the link, and the jitter, loss
+ * and reordering drawn from its seed.
+ */
+
+#include "ftest_eth_link.h"
+#include "test.h"
+#include <string.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#define TEST_FRAME_COUNT 10000
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static const uint8_t test_mac_a[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static const uint8_t test_mac_b[] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+/**
+ * Send frames of the given length at the given times, and record when they
+ * are delivered, UINT64_MAX for the lost ones.
+ */
+static void transmit_all(struct ftest_eth_link *link, const uint64_t *now,
+                         size_t len, uint64_t *deliver_times, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (!ftest_eth_link_transmit(link, now[i], len, &deliver_times[i])) {
+      deliver_times[i] = UINT64_MAX;
+    }
+  }
+}
+
+/* Frames sent one every microsecond */
+static void transmit_sequence(const struct ftest_eth_link_config *config,
+                              const uint8_t *mac, uint64_t *deliver_times) {
+  static uint64_t now[TEST_FRAME_COUNT];
+  struct ftest_eth_link link;
+
+  for (size_t i = 0; i < TEST_FRAME_COUNT; i++) {
+    now[i] = i;
+  }
+
+  ftest_eth_link_init(&link, config, mac, sizeof(test_mac_a));
+  transmit_all(&link, now, 64, deliver_times, TEST_FRAME_COUNT);
+}
+
+/******************************************************************************
+ Timing
+ ******************************************************************************/
+
+static void test_latency(void) {
+  const struct ftest_eth_link_config config = {.latency_us = 100};
+  static const uint64_t now[] = {10, 10, 50};
+  uint64_t deliver_times[3];
+  struct ftest_eth_link link;
+
+  ftest_eth_link_init(&link, &config, test_mac_a, sizeof(test_mac_a));
+  transmit_all(&link, now, 1500, deliver_times, 3);
+
+  /* Without a bandwidth, frames take no time to serialize */
+  CHECK_EQ(deliver_times[0], 110);
+  CHECK_EQ(deliver_times[1], 110);
+  CHECK_EQ(deliver_times[2], 150);
+}
+
+static void test_bandwidth(void) {
+  /* A byte per microsecond */
+  const struct ftest_eth_link_config config = {
+      .latency_us = 50,
+      .bandwidth_kbps = 8000,
+  };
+  static const uint64_t now[] = {0, 0, 1500, 5000};
+  uint64_t deliver_times[4];
+  struct ftest_eth_link link;
+
+  ftest_eth_link_init(&link, &config, test_mac_a, sizeof(test_mac_a));
+  transmit_all(&link, now, 1000, deliver_times, 4);
+
+  /* Frames queue up behind the ones still being serialized, and propagate
+   * once they are */
+  CHECK_EQ(deliver_times[0], 1050);
+  CHECK_EQ(deliver_times[1], 2050);
+  CHECK_EQ(deliver_times[2], 3050);
+  CHECK_EQ(deliver_times[3], 6050);
+  CHECK_EQ(link.free_time, 6000);
+
+  /* Serialization times are rounded up to the next microsecond */
+  const struct ftest_eth_link_config slow = {.bandwidth_kbps = 3};
+  uint64_t deliver_time;
+
+  ftest_eth_link_init(&link, &slow, test_mac_a, sizeof(test_mac_a));
+  CHECK(ftest_eth_link_transmit(&link, 0, 1, &deliver_time));
+  CHECK_EQ(deliver_time, 2667);
+}
+
+static void test_jitter(void) {
+  const struct ftest_eth_link_config config = {
+      .latency_us = 100,
+      .jitter_us = 20,
+  };
+  static uint64_t deliver_times[TEST_FRAME_COUNT];
+  uint64_t min_delay = UINT64_MAX;
+  uint64_t max_delay = 0;
+
+  transmit_sequence(&config, test_mac_a, deliver_times);
+
+  /* Every delay from latency-us to latency-us + jitter-us is drawn */
+  for (size_t i = 0; i < TEST_FRAME_COUNT; i++) {
+    uint64_t delay = deliver_times[i] - i;
+
+    min_delay = delay < min_delay ? delay : min_delay;
+    max_delay = delay > max_delay ? delay : max_delay;
+  }
+
+  CHECK_EQ(min_delay, 100);
+  CHECK_EQ(max_delay, 120);
+}
+
+/******************************************************************************
+ Loss and reordering
+ ******************************************************************************/
+
+static void test_loss(void) {
+  struct ftest_eth_link_config config = {.loss_ppm = 250000};
+  static uint64_t deliver_times[TEST_FRAME_COUNT];
+  size_t lost = 0;
+
+  transmit_sequence(&config, test_mac_a, deliver_times);
+
+  for (size_t i = 0; i < TEST_FRAME_COUNT; i++) {
+    lost += deliver_times[i] == UINT64_MAX;
+  }
+
+  CHECK(lost > TEST_FRAME_COUNT / 4 - 300 && lost < TEST_FRAME_COUNT / 4 + 300);
+
+  /* The edges are exact */
+  config.loss_ppm = 1000000;
+  transmit_sequence(&config, test_mac_a, deliver_times);
+  for (size_t i = 0; i < TEST_FRAME_COUNT; i++) {
+    CHECK_EQ(deliver_times[i], UINT64_MAX);
+  }
+
+  config.loss_ppm = 0;
+  transmit_sequence(&config, test_mac_a, deliver_times);
+  for (size_t i = 0; i < TEST_FRAME_COUNT; i++) {
+    CHECK_EQ(deliver_times[i], i);
+  }
+}
+
+static void test_reorder(void) {
+  const struct ftest_eth_link_config config = {
+      .latency_us = 100,
+      .jitter_us = 10,
+      .reorder_ppm = 100000,
+  };
+  static uint64_t deliver_times[TEST_FRAME_COUNT];
+  size_t reordered = 0;
+  size_t overtaken = 0;
+
+  transmit_sequence(&config, test_mac_a, deliver_times);
+
+  /* A reordered frame is held back for another latency-us and jitter-us, so
+   * the frames sent after it overtake it */
+  for (size_t i = 0; i < TEST_FRAME_COUNT; i++) {
+    uint64_t delay = deliver_times[i] - i;
+
+    if (delay > 110) {
+      CHECK(delay >= 210 && delay <= 220);
+      reordered++;
+    } else {
+      CHECK(delay >= 100);
+    }
+
+    if (i > 0 && deliver_times[i] < deliver_times[i - 1]) {
+      overtaken++;
+    }
+  }
+
+  CHECK(reordered > TEST_FRAME_COUNT / 10 - 200 &&
+        reordered < TEST_FRAME_COUNT / 10 + 200);
+  CHECK(overtaken > 0);
+}
+
+/******************************************************************************
+ Seeds
+ ******************************************************************************/
+
+static void test_seed(void) {
+  struct ftest_eth_link_config config = {
+      .latency_us = 100,
+      .jitter_us = 50,
+      .loss_ppm = 100000,
+      .reorder_ppm = 100000,
+      .seed = 42,
+  };
+  static uint64_t first[TEST_FRAME_COUNT];
+  static uint64_t second[TEST_FRAME_COUNT];
+
+  /* The same seed and interface give the same link, whatever else runs */
+  transmit_sequence(&config, test_mac_a, first);
+  transmit_sequence(&config, test_mac_a, second);
+  CHECK(memcmp(first, second, sizeof(first)) == 0);
+
+  /* Interfaces sharing the seed each get a sequence of their own */
+  transmit_sequence(&config, test_mac_b, second);
+  CHECK(memcmp(first, second, sizeof(first)) != 0);
+
+  /* And another seed gives another link */
+  config.seed = 43;
+  transmit_sequence(&config, test_mac_a, second);
+  CHECK(memcmp(first, second, sizeof(first)) != 0);
+}
+
+/******************************************************************************
+ Test cases
+ ******************************************************************************/
+
+int main(void) {
+  static const struct test_case cases[] = {
+      TEST_CASE(test_latency),
+      TEST_CASE(test_bandwidth),
+      TEST_CASE(test_jitter),
+      TEST_CASE(test_loss),
+      TEST_CASE(test_reorder),
+      TEST_CASE(test_seed),
+  };
+
+  return test_run(cases, sizeof(cases) / sizeof(cases[0]));
+}
@@ -0,0 +1,531 @@
+/*
+ * The pcapng capture of the in-process network: the layout of its section,
+ * interface and packet blocks, their nanosecond timestamps, frames being
+ * written exactly once, and the snaplen.
+ *
+ * Built once as is, where the blocks are written through the double buffer,
+ * and once with CONFIG_FTEST_ETH_OUTPUT_PCAP_RECORDER, where they are only
+ * dumped if the process exits with a failure. The capture keeps its state in
+ * static variables, so every test case runs in a process of its own.
+ */
+
+#include "../src/ftest_pcap.c"
+
+#include "ftest_eth_buf.h"
+#include "test.h"
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#define TEST_SHB_LEN 28
+#define TEST_FRAME_COUNT 1000
+#define TEST_FRAME_LEN 101
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+/* Opaque to the switch, which only hands it back to the scheduler */
+struct ftest_shed_entity_entry {
+  const char *name;
+};
+
+/** A block of the capture file, with its body between the two lengths */
+struct test_block {
+  uint32_t type;
+  const uint8_t *body;
+  uint32_t body_len;
+};
+
+/** The capture file, read back in memory */
+struct test_capture {
+  uint8_t *data;
+  size_t len;
+  size_t pos;
+};
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static const uint8_t test_mac[FTEST_PCAP_MAC_LEN] = {0x02, 0, 0, 0, 0, 1};
+
+/******************************************************************************
+ Runner
+ ******************************************************************************/
+
+const char *ftest_jobs_file_name(const char *name, char *buf, size_t size) {
+  (void)buf;
+  (void)size;
+
+  return name;
+}
+
+int ftest_shed_ring_doorbell(struct ftest_shed_entity_entry *entity,
+                             uint64_t time) {
+  (void)entity;
+  (void)time;
+
+  return 0;
+}
+
+uint64_t ftest_shed_get_lookahead(void) { return 0; }
+
+const char *
+ftest_shed_get_entity_name(const struct ftest_shed_entity_entry *entity) {
+  return entity->name;
+}
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+static uint32_t get32(const uint8_t *at) {
+  uint32_t value;
+
+  memcpy(&value, at, sizeof(value));
+
+  return value;
+}
+
+static uint16_t get16(const uint8_t *at) {
+  uint16_t value;
+
+  memcpy(&value, at, sizeof(value));
+
+  return value;
+}
+
+static void read_capture(struct test_capture *capture) {
+  FILE *file = fopen(CONFIG_FTEST_ETH_OUTPUT_PCAP_FILE, "rb");
+
+  CHECK(file != NULL);
+  CHECK(fseek(file, 0, SEEK_END) == 0);
+  capture->len = ftell(file);
+  capture->data = malloc(capture->len);
+  capture->pos = 0;
+  CHECK(capture->data != NULL);
+  rewind(file);
+  CHECK_EQ(fread(capture->data, 1, capture->len, file), capture->len);
+  fclose(file);
+}
+
+/**
+ * Take the next block of the capture, checking that both of its lengths
+ * match and that it is 32-bit aligned.
+ *
+ * @return false at the end of the capture
+ */
+static bool next_block(struct test_capture *capture, struct test_block *block) {
+  if (capture->pos == capture->len) {
+    return false;
+  }
+
+  CHECK(capture->len - capture->pos >= 12);
+
+  const uint8_t *start = capture->data + capture->pos;
+  uint32_t total_len = get32(start + 4);
+
+  CHECK_EQ(total_len % 4, 0);
+  CHECK(total_len >= 12 && total_len <= capture->len - capture->pos);
+  CHECK_EQ(get32(start + total_len - 4), total_len);
+
+  block->type = get32(start);
+  block->body = start + 8;
+  block->body_len = total_len - 12;
+  capture->pos += total_len;
+
+  return true;
+}
+
+/**
+ * Find an option among the ones starting at the given position, checking
+ * that they are padded and end with the end of options.
+ *
+ * @return The value of the option, NULL if there is none with this code
+ */
+static const uint8_t *find_option(const uint8_t *options, const uint8_t *end,
+                                  uint16_t code, uint16_t *len) {
+  const uint8_t *found = NULL;
+
+  while (true) {
+    CHECK(end - options >= 4);
+
+    uint16_t option_code = get16(options);
+    uint16_t option_len = get16(options + 2);
+
+    if (option_code == PCAPNG_OPT_END) {
+      CHECK_EQ(option_len, 0);
+      CHECK(options + 4 == end);
+      return found;
+    }
+
+    CHECK(end - options >= 4 + FTEST_PCAP_ALIGN(option_len));
+
+    if (option_code == code) {
+      found = options + 4;
+      *len = option_len;
+    }
+
+    options += 4 + FTEST_PCAP_ALIGN(option_len);
+  }
+}
+
+static void check_shb(struct test_capture *capture) {
+  struct test_block block;
+
+  CHECK(next_block(capture, &block));
+  CHECK_EQ(block.type, PCAPNG_BLOCK_SHB);
+  CHECK_EQ(block.body_len + 12, TEST_SHB_LEN);
+  CHECK_EQ(get32(block.body), PCAPNG_BYTE_ORDER_MAGIC);
+  CHECK_EQ(get16(block.body + 4), 1);
+  CHECK_EQ(get16(block.body + 6), 0);
+
+  int64_t section_len;
+  memcpy(&section_len, block.body + 8, sizeof(section_len));
+  CHECK_EQ(section_len, -1);
+}
+
+static void check_idb(struct test_capture *capture, const char *name,
+                      uint32_t snaplen) {
+  struct test_block block;
+  const uint8_t *end;
+  const uint8_t *value;
+  uint16_t len;
+
+  CHECK(next_block(capture, &block));
+  CHECK_EQ(block.type, PCAPNG_BLOCK_IDB);
+  CHECK_EQ(get16(block.body), LINKTYPE_ETHERNET);
+  CHECK_EQ(get32(block.body + 4), snaplen);
+
+  end = block.body + block.body_len;
+
+  value = find_option(block.body + 8, end, PCAPNG_OPT_IF_NAME, &len);
+  CHECK(value != NULL);
+  CHECK_EQ(len, strlen(name));
+  CHECK(memcmp(value, name, len) == 0);
+
+  value = find_option(block.body + 8, end, PCAPNG_OPT_IF_MACADDR, &len);
+  CHECK(value != NULL);
+  CHECK_EQ(len, FTEST_PCAP_MAC_LEN);
+
+  /* Virtual microseconds are written in nanoseconds */
+  value = find_option(block.body + 8, end, PCAPNG_OPT_IF_TSRESOL, &len);
+  CHECK(value != NULL);
+  CHECK_EQ(len, 1);
+  CHECK_EQ(value[0], PCAPNG_TSRESOL_NS);
+}
+
+/**
+ * Take the next packet block, check its layout and return its frame.
+ */
+static const uint8_t *check_epb(struct test_capture *capture,
+                                uint32_t interface, uint64_t time,
+                                uint32_t direction, uint32_t captured_len,
+                                uint32_t orig_len) {
+  struct test_block block;
+  const uint8_t *value;
+  uint16_t len;
+
+  CHECK(next_block(capture, &block));
+  CHECK_EQ(block.type, PCAPNG_BLOCK_EPB);
+  CHECK_EQ(get32(block.body), interface);
+  CHECK_EQ((uint64_t)get32(block.body + 4) << 32 | get32(block.body + 8),
+           time * 1000);
+  CHECK_EQ(get32(block.body + 12), captured_len);
+  CHECK_EQ(get32(block.body + 16), orig_len);
+
+  /* The frame is padded with zeros up to the options */
+  const uint8_t *frame = block.body + 20;
+
+  for (uint32_t i = captured_len; i < FTEST_PCAP_ALIGN(captured_len); i++) {
+    CHECK_EQ(frame[i], 0);
+  }
+
+  value = find_option(frame + FTEST_PCAP_ALIGN(captured_len),
+                      block.body + block.body_len, PCAPNG_OPT_EPB_FLAGS, &len);
+  CHECK(value != NULL);
+  CHECK_EQ(len, 4);
+  CHECK_EQ(get32(value), direction);
+
+  return frame;
+}
+
+/**
+ * Write a frame filled with its index, so the frames can be told apart.
+ */
+static void write_frame(int interface, uint32_t index, uint32_t len) {
+  uint8_t frame[2048];
+
+  memset(frame, index & 0xff, len);
+  memcpy(frame, &index, sizeof(index));
+  ftest_pcap_write_frame(interface, FTEST_PCAP_OUTBOUND, frame, len, index);
+}
+
+static void check_frame(struct test_capture *capture, uint32_t index,
+                        uint32_t len) {
+  const uint8_t *frame =
+      check_epb(capture, 0, index, FTEST_PCAP_OUTBOUND, len, len);
+
+  CHECK_EQ(get32(frame), index);
+
+  for (uint32_t i = sizeof(index); i < len; i++) {
+    CHECK_EQ(frame[i], index & 0xff);
+  }
+}
+
+#ifndef CONFIG_FTEST_ETH_OUTPUT_PCAP_RECORDER
+
+/******************************************************************************
+ Layout
+ ******************************************************************************/
+
+static void test_layout(void) {
+  static const uint8_t frame[61] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+  struct test_capture capture;
+
+  CHECK_EQ(ftest_pcap_add_interface("a-0", "Port 0", test_mac), 0);
+  CHECK_EQ(ftest_pcap_add_interface("b-1", NULL, test_mac), 1);
+
+  /* The second one is past 2^32 nanoseconds */
+  ftest_pcap_write_frame(0, FTEST_PCAP_OUTBOUND, frame, sizeof(frame), 7);
+  ftest_pcap_write_frame(1, FTEST_PCAP_INBOUND, frame, sizeof(frame),
+                         5000000);
+  ftest_pcap_close();
+
+  read_capture(&capture);
+  check_shb(&capture);
+  check_idb(&capture, "a-0", 65535);
+  check_idb(&capture, "b-1", 65535);
+
+  const uint8_t *data = check_epb(&capture, 0, 7, FTEST_PCAP_OUTBOUND,
+                                  sizeof(frame), sizeof(frame));
+  CHECK(memcmp(data, frame, sizeof(frame)) == 0);
+
+  data = check_epb(&capture, 1, 5000000, FTEST_PCAP_INBOUND, sizeof(frame),
+                   sizeof(frame));
+  CHECK(memcmp(data, frame, sizeof(frame)) == 0);
+
+  struct test_block block;
+  CHECK(!next_block(&capture, &block));
+}
+
+static void test_flood_captured_once(void) {
+  struct ftest_shed_entity_entry entities[3] = {{"a"}, {"b"}, {"c"}};
+  uint8_t frame[sizeof(struct ftest_eth_hdr) + 60] = {0};
+  struct ftest_eth_hdr *hdr = (struct ftest_eth_hdr *)frame;
+  struct test_capture capture;
+  struct test_block block;
+  int ports[3];
+
+  for (int i = 0; i < 3; i++) {
+    uint8_t mac[FTEST_PCAP_MAC_LEN] = {0x02, 0, 0, 0, 0, i + 1};
+
+    ports[i] = ftest_eth_buf_attach("test", mac, 4096, 0, &entities[i]);
+    CHECK(ports[i] >= 0);
+  }
+
+  /* A broadcast, copied to both other ports but captured as it is sent */
+  hdr->len = 60;
+  hdr->sent_time = 3;
+  hdr->deliver_time = 4;
+  hdr->src_port = ports[1];
+  memset(hdr->payload, 0xff, FTEST_ETH_BUF_MAC_LEN);
+  CHECK_EQ(ftest_eth_buf_commit(frame, sizeof(frame)), RB_OK);
+  ftest_pcap_close();
+
+  read_capture(&capture);
+  check_shb(&capture);
+  check_idb(&capture, "a-0", 65535);
+  check_idb(&capture, "b-1", 65535);
+  check_idb(&capture, "c-2", 65535);
+  check_epb(&capture, 1, 3, FTEST_PCAP_OUTBOUND, 60, 60);
+  CHECK(!next_block(&capture, &block));
+}
+
+/******************************************************************************
+ Buffering
+ ******************************************************************************/
+
+static void test_each_frame_once(void) {
+  struct test_capture capture;
+  struct test_block block;
+
+  CHECK_EQ(ftest_pcap_add_interface("a-0", NULL, test_mac), 0);
+
+  /* Many times the size of the buffers, so they are swapped over and over */
+  for (uint32_t i = 0; i < TEST_FRAME_COUNT; i++) {
+    write_frame(0, i, TEST_FRAME_LEN);
+  }
+
+  ftest_pcap_close();
+
+  read_capture(&capture);
+  check_shb(&capture);
+  check_idb(&capture, "a-0", 65535);
+
+  for (uint32_t i = 0; i < TEST_FRAME_COUNT; i++) {
+    check_frame(&capture, i, TEST_FRAME_LEN);
+  }
+
+  CHECK(!next_block(&capture, &block));
+}
+
+/******************************************************************************
+ Snaplen
+ ******************************************************************************/
+
+static void test_snaplen(void) {
+  struct test_capture capture;
+
+  ftest_pcap_snaplen = 16;
+  CHECK_EQ(ftest_pcap_add_interface("a-0", NULL, test_mac), 0);
+  write_frame(0, 1, TEST_FRAME_LEN);
+
+  /* 0 does not limit the capture, as the interface block says */
+  ftest_pcap_snaplen = 0;
+  write_frame(0, 2, TEST_FRAME_LEN);
+  ftest_pcap_close();
+
+  read_capture(&capture);
+  check_shb(&capture);
+  check_idb(&capture, "a-0", 16);
+  check_epb(&capture, 0, 1, FTEST_PCAP_OUTBOUND, 16, TEST_FRAME_LEN);
+  check_frame(&capture, 2, TEST_FRAME_LEN);
+}
+
+#else
+
+/******************************************************************************
+ Flight recorder
+ ******************************************************************************/
+
+/**
+ * Record frames of the given length in a process of its own, which exits
+ * with the given status.
+ */
+static void record(int exit_status, uint32_t count, uint32_t len) {
+  pid_t pid = fork();
+
+  CHECK(pid >= 0);
+
+  if (pid == 0) {
+    CHECK_EQ(ftest_pcap_add_interface("a-0", NULL, test_mac), 0);
+
+    for (uint32_t i = 0; i < count; i++) {
+      write_frame(0, i, len);
+    }
+
+    exit(exit_status);
+  }
+
+  int status;
+
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == exit_status);
+}
+
+static void test_recorder_success(void) {
+  struct stat st;
+
+  unlink(CONFIG_FTEST_ETH_OUTPUT_PCAP_FILE);
+  record(0, 10, TEST_FRAME_LEN);
+  CHECK(stat(CONFIG_FTEST_ETH_OUTPUT_PCAP_FILE, &st) < 0 && errno == ENOENT);
+}
+
+static void test_recorder_failure(void) {
+  struct test_capture capture;
+  struct test_block block;
+
+  unlink(CONFIG_FTEST_ETH_OUTPUT_PCAP_FILE);
+  record(1, 10, TEST_FRAME_LEN);
+
+  read_capture(&capture);
+  check_shb(&capture);
+  check_idb(&capture, "a-0", 65535);
+
+  for (uint32_t i = 0; i < 10; i++) {
+    check_frame(&capture, i, TEST_FRAME_LEN);
+  }
+
+  CHECK(!next_block(&capture, &block));
+}
+
+static void test_recorder_evicts(void) {
+  /* Twice as many frames as the recorder holds */
+  uint32_t total = 2 * FTEST_PCAP_RECORDER_SIZE / 1500;
+  struct test_capture capture;
+  struct test_block block;
+  uint32_t first;
+  uint32_t count = 0;
+
+  unlink(CONFIG_FTEST_ETH_OUTPUT_PCAP_FILE);
+  record(1, total, 1500);
+
+  read_capture(&capture);
+  check_shb(&capture);
+  check_idb(&capture, "a-0", 65535);
+
+  /* Only complete frames, the most recent ones in order */
+  CHECK(next_block(&capture, &block));
+  CHECK_EQ(block.type, PCAPNG_BLOCK_EPB);
+  first = get32(block.body + 20);
+  CHECK(first > 0);
+  capture.pos -= block.body_len + 12;
+
+  while (capture.pos < capture.len) {
+    check_frame(&capture, first + count, 1500);
+    count++;
+  }
+
+  CHECK_EQ(first + count, total);
+
+  /* And as many of them as fit */
+  CHECK((count + 1) * (block.body_len + 12) > FTEST_PCAP_RECORDER_SIZE);
+}
+
+#endif
+
+/******************************************************************************
+ Test cases
+ ******************************************************************************/
+
+static void run_in_child(const struct test_case *test_case) {
+  pid_t pid = fork();
+
+  CHECK(pid >= 0);
+
+  if (pid == 0) {
+    test_run(test_case, 1);
+    exit(0);
+  }
+
+  int status;
+
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(void) {
+  static const struct test_case cases[] = {
+#ifndef CONFIG_FTEST_ETH_OUTPUT_PCAP_RECORDER
+      TEST_CASE(test_layout),
+      TEST_CASE(test_flood_captured_once),
+      TEST_CASE(test_each_frame_once),
+      TEST_CASE(test_snaplen),
+#else
+      TEST_CASE(test_recorder_success),
+      TEST_CASE(test_recorder_failure),
+      TEST_CASE(test_recorder_evicts),
+#endif
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    run_in_child(&cases[i]);
+  }
+
+  return 0;
+}
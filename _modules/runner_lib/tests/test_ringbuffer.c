@@ -0,0 +1,510 @@
+/*
+ * Ring buffer layouts, the edges of their wrap-around and the detection of
+ * overrun readers.
+ */
+
+#include "ringbuffer.h"
+#include "test.h"
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+static void write_u32(ringbuffer_t *rb, uint32_t value) {
+  CHECK_EQ(rb_write(rb, &value, sizeof(value)), RB_OK);
+}
+
+static uint32_t read_u32(ringbuffer_t *rb, uint32_t *reader_index) {
+  uint32_t value = 0;
+
+  CHECK_EQ(rb_read_next(rb, reader_index, &value, sizeof(value), NULL), RB_OK);
+
+  return value;
+}
+
+static void write_bytes(ringbuffer_t *rb, uint8_t fill, uint32_t len) {
+  uint8_t data[256];
+
+  memset(data, fill, len);
+  CHECK_EQ(rb_write(rb, data, len), RB_OK);
+}
+
+/**
+ * Read a variable-length record and check that it is intact.
+ */
+static void read_bytes(ringbuffer_t *rb, uint32_t *reader_index, uint8_t fill,
+                       uint32_t len) {
+  uint8_t data[256];
+  uint32_t read_size;
+
+  CHECK_EQ(rb_read_next(rb, reader_index, data, sizeof(data), &read_size),
+           RB_OK);
+  CHECK_EQ(read_size, len);
+
+  for (uint32_t i = 0; i < len; i++) {
+    CHECK_EQ(data[i], fill);
+  }
+}
+
+/******************************************************************************
+ Fixed-size entries
+ ******************************************************************************/
+
+static void test_fixed_read_write(void) {
+  uint8_t buffer[4 * (sizeof(rb_entry_t) + sizeof(uint32_t))];
+  ringbuffer_t rb;
+  uint32_t reader = 0;
+
+  CHECK_EQ(rb_init(&rb, buffer, sizeof(buffer), sizeof(uint32_t)), RB_OK);
+  CHECK_EQ(rb_get_capacity(&rb), 4);
+
+  for (uint32_t i = 0; i < 10; i++) {
+    write_u32(&rb, i);
+    CHECK_EQ(rb_available(&rb, reader), 1);
+    CHECK_EQ(read_u32(&rb, &reader), i);
+  }
+
+  CHECK_EQ(reader, 10);
+  CHECK_EQ(rb_available(&rb, reader), 0);
+}
+
+static void test_fixed_overrun(void) {
+  uint8_t buffer[4 * (sizeof(rb_entry_t) + sizeof(uint32_t))];
+  ringbuffer_t rb;
+  uint32_t value;
+
+  CHECK_EQ(rb_init(&rb, buffer, sizeof(buffer), sizeof(uint32_t)), RB_OK);
+
+  for (uint32_t i = 0; i < 5; i++) {
+    write_u32(&rb, i);
+  }
+
+  /* The fifth entry took the slot of the first one */
+  CHECK(rb_is_overrun(&rb, 0));
+  CHECK(!rb_is_overrun(&rb, 1));
+  CHECK_EQ(rb_read(&rb, 0, &value, sizeof(value), NULL), RB_OVERRUN);
+  CHECK_EQ(rb_available(&rb, 0), 4);
+
+  /* The reader moves past what it lost */
+  uint32_t reader = 0;
+  CHECK_EQ(rb_read_next(&rb, &reader, &value, sizeof(value), NULL),
+           RB_OVERRUN);
+  CHECK_EQ(reader, 1);
+  CHECK_EQ(read_u32(&rb, &reader), 1);
+
+  /* A reader a whole lap behind is overrun whatever the slot holds */
+  for (uint32_t i = 5; i < 9; i++) {
+    write_u32(&rb, i);
+  }
+  CHECK(rb_is_overrun(&rb, 4));
+  CHECK(!rb_is_overrun(&rb, 5));
+}
+
+static void test_fixed_reject(void) {
+  uint8_t buffer[16];
+  uint32_t value = 0;
+  ringbuffer_t rb;
+
+  CHECK_EQ(rb_init(&rb, buffer, sizeof(buffer), sizeof(buffer)),
+           RB_INVALID_PARAM);
+  CHECK_EQ(rb_init(&rb, buffer, sizeof(buffer), 4), RB_OK);
+  CHECK_EQ(rb_write(&rb, buffer, 5), RB_INVALID_PARAM);
+  CHECK_EQ(rb_write(&rb, &value, 0), RB_INVALID_PARAM);
+}
+
+/******************************************************************************
+ Power-of-two entries
+ ******************************************************************************/
+
+static void test_pow2_layout(void) {
+  uint8_t buffer[100];
+  ringbuffer_t rb;
+
+  /* Entries of 4 + 10 bytes take 16, 6 fit and are rounded down to 4 */
+  CHECK_EQ(rb_init_pow2(&rb, buffer, sizeof(buffer), 10), RB_OK);
+  CHECK_EQ(rb_get_capacity(&rb), 4);
+  CHECK_EQ(rb.entry_size, 16);
+
+  for (uint32_t i = 0; i < 9; i++) {
+    write_u32(&rb, i);
+  }
+
+  CHECK(rb_is_overrun(&rb, 4));
+
+  uint32_t reader = 5;
+  for (uint32_t i = 5; i < 9; i++) {
+    CHECK_EQ(read_u32(&rb, &reader), i);
+  }
+
+  CHECK_EQ(rb_init_pow2(&rb, buffer, 8, 10), RB_INVALID_PARAM);
+}
+
+static void test_pow2_index_wrap(void) {
+  uint8_t buffer[4 * 8];
+  ringbuffer_t rb;
+
+  CHECK_EQ(rb_init_pow2(&rb, buffer, sizeof(buffer), sizeof(uint32_t)),
+           RB_OK);
+
+  /* The mask keeps the slots in step across the end of the index space */
+  rb.write_index = UINT32_MAX - 1;
+  uint32_t reader = rb.write_index;
+
+  for (uint32_t i = 0; i < 4; i++) {
+    write_u32(&rb, i);
+  }
+
+  CHECK_EQ(rb.write_index, 2);
+  CHECK(rb_is_overrun(&rb, UINT32_MAX - 2));
+
+  for (uint32_t i = 0; i < 4; i++) {
+    CHECK_EQ(read_u32(&rb, &reader), i);
+  }
+
+  CHECK_EQ(reader, 2);
+}
+
+/******************************************************************************
+ Variable-length records
+ ******************************************************************************/
+
+static void test_var_records(void) {
+  uint8_t buffer[64];
+  ringbuffer_t rb;
+  uint32_t reader = 0;
+
+  CHECK_EQ(rb_init_var(&rb, buffer, sizeof(buffer)), RB_OK);
+  CHECK_EQ(rb_init_var(&rb, buffer, 48), RB_INVALID_PARAM);
+
+  write_bytes(&rb, 0xa1, 5);
+  write_bytes(&rb, 0xa2, 13);
+
+  /* Records are aligned, the reader index is a byte position */
+  read_bytes(&rb, &reader, 0xa1, 5);
+  CHECK_EQ(reader, 16);
+  read_bytes(&rb, &reader, 0xa2, 13);
+  CHECK_EQ(reader, 40);
+
+  /* Never split, so never larger than the buffer */
+  uint8_t large[64] = {0};
+  CHECK_EQ(rb_write(&rb, large, sizeof(large) - sizeof(rb_var_entry_t) + 1),
+           RB_INVALID_PARAM);
+}
+
+static void test_var_wrap_marker(void) {
+  uint8_t buffer[64];
+  ringbuffer_t rb;
+  uint32_t reader = 0;
+
+  CHECK_EQ(rb_init_var(&rb, buffer, sizeof(buffer)), RB_OK);
+
+  /* Records of 24 bytes, the third does not fit in the 16 bytes left */
+  write_bytes(&rb, 1, 16);
+  write_bytes(&rb, 2, 16);
+  read_bytes(&rb, &reader, 1, 16);
+  read_bytes(&rb, &reader, 2, 16);
+  CHECK_EQ(reader, 48);
+
+  write_bytes(&rb, 3, 16);
+  CHECK_EQ(rb.write_index, 88);
+
+  read_bytes(&rb, &reader, 3, 16);
+  CHECK_EQ(reader, 88);
+
+  /* The first record was overwritten by the one past the marker */
+  CHECK(rb_is_overrun(&rb, 0));
+  CHECK(!rb_is_overrun(&rb, 48));
+}
+
+static void test_var_overrun_resync(void) {
+  uint8_t buffer[64];
+  ringbuffer_t rb;
+  uint8_t data[64];
+  uint32_t read_size;
+
+  CHECK_EQ(rb_init_var(&rb, buffer, sizeof(buffer)), RB_OK);
+
+  for (uint8_t i = 0; i < 5; i++) {
+    write_bytes(&rb, i, 8);
+  }
+
+  /* The boundaries of the lost records are unknown, so the reader skips to
+   * the next record to be written */
+  uint32_t reader = 0;
+  CHECK_EQ(rb_read_next(&rb, &reader, data, sizeof(data), &read_size),
+           RB_OVERRUN);
+  CHECK_EQ(reader, rb.write_index);
+
+  write_bytes(&rb, 9, 8);
+  read_bytes(&rb, &reader, 9, 8);
+}
+
+static void test_var_index_wrap(void) {
+  uint8_t buffer[64];
+  ringbuffer_t rb;
+
+  CHECK_EQ(rb_init_var(&rb, buffer, sizeof(buffer)), RB_OK);
+
+  /* Byte positions wrap at 2^32, a multiple of the buffer size */
+  rb.write_index = UINT32_MAX - 31;
+  uint32_t reader = rb.write_index;
+
+  for (uint8_t i = 0; i < 6; i++) {
+    write_bytes(&rb, i, 8);
+    read_bytes(&rb, &reader, i, 8);
+  }
+
+  CHECK_EQ(reader, 64);
+}
+
+/******************************************************************************
+ Batches
+ ******************************************************************************/
+
+static void test_read_batch(void) {
+  uint8_t buffer[128];
+  rb_iovec_t iov[3];
+  ringbuffer_t rb;
+  uint32_t count;
+
+  CHECK_EQ(rb_init_var(&rb, buffer, sizeof(buffer)), RB_OK);
+
+  for (uint8_t i = 0; i < 5; i++) {
+    write_bytes(&rb, i, 1 + i);
+  }
+
+  uint32_t reader = 0;
+  CHECK_EQ(rb_read_batch(&rb, reader, iov, 3, &count), RB_OK);
+  CHECK_EQ(count, 3);
+
+  for (uint32_t i = 0; i < count; i++) {
+    CHECK_EQ(iov[i].len, 1 + i);
+    CHECK_EQ(((const uint8_t *)iov[i].base)[0], i);
+  }
+
+  reader = iov[2].next_index;
+  CHECK_EQ(rb_read_batch(&rb, reader, iov, 3, &count), RB_OK);
+  CHECK_EQ(count, 2);
+  CHECK_EQ(iov[1].len, 5);
+  CHECK_EQ(iov[1].next_index, rb.write_index);
+
+  reader = iov[1].next_index;
+  CHECK_EQ(rb_read_batch(&rb, reader, iov, 3, &count), RB_OK);
+  CHECK_EQ(count, 0);
+
+  /* A reader a lap behind gets nothing */
+  for (uint8_t i = 0; i < 16; i++) {
+    write_bytes(&rb, i, 8);
+  }
+  CHECK_EQ(rb_read_batch(&rb, reader, iov, 3, &count), RB_OVERRUN);
+  CHECK_EQ(count, 0);
+}
+
+static void test_read_batch_wrap(void) {
+  uint8_t buffer[64];
+  rb_iovec_t iov[4];
+  ringbuffer_t rb;
+  uint32_t count;
+
+  CHECK_EQ(rb_init_var(&rb, buffer, sizeof(buffer)), RB_OK);
+
+  uint32_t reader = 0;
+  write_bytes(&rb, 1, 16);
+  write_bytes(&rb, 2, 16);
+  read_bytes(&rb, &reader, 1, 16);
+
+  /* The batch steps over the wrap marker at 48 */
+  write_bytes(&rb, 3, 16);
+  CHECK_EQ(rb_read_batch(&rb, reader, iov, 4, &count), RB_OK);
+  CHECK_EQ(count, 2);
+  CHECK_EQ(((const uint8_t *)iov[1].base)[0], 3);
+  CHECK(iov[1].base == buffer + sizeof(rb_var_entry_t));
+  CHECK_EQ(iov[1].next_index, 88);
+}
+
+/******************************************************************************
+ Reservations
+ ******************************************************************************/
+
+static void test_reserve_commit(void) {
+  uint8_t buffer[128];
+  ringbuffer_t rb;
+  uint32_t reader = 0;
+
+  CHECK_EQ(rb_init_var(&rb, buffer, sizeof(buffer)), RB_OK);
+
+  uint8_t *data = rb_reserve(&rb, 32);
+  CHECK(data != NULL);
+  CHECK(rb_reserve(&rb, 8) == NULL);
+  CHECK_EQ(rb_write(&rb, data, 8), RB_ERROR);
+
+  /* Nothing is visible before the commit */
+  CHECK_EQ(rb_available(&rb, reader), 0);
+
+  memset(data, 7, 10);
+  CHECK_EQ(rb_commit(&rb, 40), RB_INVALID_PARAM);
+  CHECK_EQ(rb_commit(&rb, 10), RB_OK);
+  CHECK_EQ(rb_commit(&rb, 10), RB_INVALID_PARAM);
+
+  read_bytes(&rb, &reader, 7, 10);
+  CHECK_EQ(reader, rb.write_index);
+}
+
+static void test_cancel_reservation(void) {
+  uint8_t buffer[64];
+  ringbuffer_t rb;
+  const void *data;
+  uint32_t len;
+
+  CHECK_EQ(rb_init_var(&rb, buffer, sizeof(buffer)), RB_OK);
+
+  /* A dropped reservation does not read as a record */
+  uint32_t reader = 0;
+  memset(rb_reserve(&rb, 16), 5, 16);
+  CHECK_EQ(rb_commit(&rb, 0), RB_OK);
+  CHECK(rb_peek(&rb, reader, &data, &len) != RB_OK);
+
+  write_bytes(&rb, 1, 16);
+  write_bytes(&rb, 2, 16);
+  read_bytes(&rb, &reader, 1, 16);
+  read_bytes(&rb, &reader, 2, 16);
+
+  /* Neither does the one moved past a wrap marker */
+  CHECK(rb_reserve(&rb, 16) != NULL);
+  CHECK_EQ(rb_commit(&rb, 0), RB_OK);
+  CHECK(rb_peek(&rb, reader, &data, &len) != RB_OK);
+
+  write_bytes(&rb, 3, 16);
+  read_bytes(&rb, &reader, 3, 16);
+
+  /* Nor a dropped fixed-size entry */
+  uint8_t fixed_buffer[4 * (sizeof(rb_entry_t) + sizeof(uint32_t))];
+  ringbuffer_t fixed;
+
+  CHECK_EQ(rb_init(&fixed, fixed_buffer, sizeof(fixed_buffer), 4), RB_OK);
+  write_u32(&fixed, 1);
+  CHECK(rb_reserve(&fixed, 4) != NULL);
+  CHECK_EQ(rb_commit(&fixed, 0), RB_OK);
+  CHECK_EQ(rb_peek(&fixed, 1, &data, &len), RB_OVERRUN);
+
+  write_u32(&fixed, 2);
+  reader = 0;
+  CHECK_EQ(read_u32(&fixed, &reader), 1);
+  CHECK_EQ(read_u32(&fixed, &reader), 2);
+}
+
+/******************************************************************************
+ Readers
+ ******************************************************************************/
+
+struct reader_wait {
+  ringbuffer_t *rb;
+  uint32_t *reader;
+  unsigned calls;
+};
+
+/* Reads one entry per call, as a reader running in between would */
+static bool reader_wait_read_one(void *arg) {
+  struct reader_wait *wait = arg;
+  uint32_t value;
+
+  wait->calls++;
+  return rb_read_next(wait->rb, wait->reader, &value, sizeof(value), NULL) ==
+         RB_OK;
+}
+
+static bool reader_wait_give_up(void *arg) {
+  (void)arg;
+  return false;
+}
+
+static void test_lossless_readers(void) {
+  uint8_t buffer[4 * (sizeof(rb_entry_t) + sizeof(uint32_t))];
+  ringbuffer_t rb;
+  uint32_t reader = 0;
+  rb_stats_t stats;
+
+  CHECK_EQ(rb_init(&rb, buffer, sizeof(buffer), sizeof(uint32_t)), RB_OK);
+
+  int handle = rb_register_reader(&rb, &reader);
+  CHECK(handle >= 0);
+  rb_set_lossless(&rb, true);
+
+  for (uint32_t i = 0; i < 4; i++) {
+    write_u32(&rb, i);
+  }
+
+  uint32_t value = 4;
+  CHECK(!rb_has_room(&rb, sizeof(value)));
+  CHECK_EQ(rb_write(&rb, &value, sizeof(value)), RB_FULL);
+  CHECK(rb_reserve(&rb, sizeof(value)) == NULL);
+
+  CHECK(rb_reserve_wait(&rb, sizeof(value), reader_wait_give_up, NULL) ==
+        NULL);
+
+  struct reader_wait wait = {&rb, &reader, 0};
+  uint32_t *slot = rb_reserve_wait(&rb, sizeof(value), reader_wait_read_one,
+                                   &wait);
+  CHECK(slot != NULL);
+  CHECK_EQ(wait.calls, 1);
+  *slot = 4;
+  CHECK_EQ(rb_commit(&rb, sizeof(value)), RB_OK);
+
+  rb_get_stats(&rb, &stats);
+  CHECK_EQ(stats.stalls, 2);
+  CHECK_EQ(stats.saved, 1);
+
+  /* An unregistered reader holds nothing back */
+  rb_unregister_reader(&rb, handle);
+  for (uint32_t i = 5; i < 12; i++) {
+    write_u32(&rb, i);
+  }
+  CHECK(rb_is_overrun(&rb, reader));
+}
+
+static void test_lossless_ignores_overrun_readers(void) {
+  uint8_t buffer[4 * (sizeof(rb_entry_t) + sizeof(uint32_t))];
+  ringbuffer_t rb;
+  uint32_t lagging = 0;
+  uint32_t reader = 0;
+
+  CHECK_EQ(rb_init(&rb, buffer, sizeof(buffer), sizeof(uint32_t)), RB_OK);
+
+  for (uint32_t i = 0; i < 6; i++) {
+    write_u32(&rb, i);
+  }
+
+  /* Registered when its data is already lost */
+  CHECK(rb_register_reader(&rb, &lagging) >= 0);
+  CHECK(rb_register_reader(&rb, &reader) >= 0);
+  reader = rb.write_index;
+  rb_set_lossless(&rb, true);
+
+  CHECK(rb_has_room(&rb, sizeof(uint32_t)));
+}
+
+/******************************************************************************
+ Test cases
+ ******************************************************************************/
+
+int main(void) {
+  static const struct test_case cases[] = {
+      TEST_CASE(test_fixed_read_write),
+      TEST_CASE(test_fixed_overrun),
+      TEST_CASE(test_fixed_reject),
+      TEST_CASE(test_pow2_layout),
+      TEST_CASE(test_pow2_index_wrap),
+      TEST_CASE(test_var_records),
+      TEST_CASE(test_var_wrap_marker),
+      TEST_CASE(test_var_overrun_resync),
+      TEST_CASE(test_var_index_wrap),
+      TEST_CASE(test_read_batch),
+      TEST_CASE(test_read_batch_wrap),
+      TEST_CASE(test_reserve_commit),
+      TEST_CASE(test_cancel_reservation),
+      TEST_CASE(test_lossless_readers),
+      TEST_CASE(test_lossless_ignores_overrun_readers),
+  };
+
+  return test_run(cases, sizeof(cases) / sizeof(cases[0]));
+}
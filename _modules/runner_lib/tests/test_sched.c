@@ -0,0 +1,732 @@
+/*
+ * Dispatch order of the scheduler heap, suspension of entities and delivery
+ * of their doorbells, event batches, and the error codes of the scheduler API.
+ *
+ * The scheduler keeps its state in static variables, so every test case runs
+ * in a process of its own. The cases drive the scheduler loop one dispatch at
+ * a time, with a runner whose time is set by the test and whose own event is
+ * never reached.
+ *
+ * Built once as is and once with CONFIG_FTEST_SHED_BATCH, where the entities
+ * set up with setup_batched() execute their events in batches. The dispatch
+ * order checked by the test cases is the same in both builds.
+ */
+
+#define main ftest_shed_main
+#include "../src/ftest_sched.c"
+#undef main
+
+#include "ftest_eth_buf.h"
+#include "ftest_sock_chan.h"
+#include "test.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#define TEST_ENTITY_COUNT 4
+#define TEST_LOG_SIZE 64
+#define TEST_BATCH_LOG_SIZE 16
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+struct test_entity {
+  struct ftest_shed_entity_config config;
+  uint64_t time;
+  uint64_t next;
+  uint64_t period;
+  unsigned doorbell_count;
+  uint64_t doorbell_time;
+
+  /* Rings the doorbell of another entity ring_delay after executing the
+   * event at ring_at */
+  struct test_entity *ring_target;
+  uint64_t ring_at;
+  uint64_t ring_delay;
+};
+
+struct test_dispatch {
+  uint64_t time;
+  unsigned index;
+};
+
+struct test_batch {
+  unsigned index;
+  uint64_t start_horizon;
+  uint64_t end_horizon;
+  uint64_t event_count;
+};
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static struct test_entity test_entities[TEST_ENTITY_COUNT];
+
+static struct test_dispatch test_log[TEST_LOG_SIZE];
+static size_t test_log_count;
+
+static struct test_batch test_batch_log[TEST_BATCH_LOG_SIZE];
+static size_t test_batch_count;
+
+static uint64_t test_runner_time;
+static uint64_t test_runner_next = NSI_NEVER;
+
+/******************************************************************************
+ Test entities
+ ******************************************************************************/
+
+static void test_entity_init(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+}
+
+static void test_entity_exec(struct test_entity *entity) {
+  entity->time = entity->next;
+  entity->next = entity->time + entity->period;
+
+  CHECK(test_log_count < TEST_LOG_SIZE);
+  test_log[test_log_count++] = (struct test_dispatch){
+      .time = ftest_shed_get_time(ftest_shed_get_current_entity()),
+      .index = entity->config.instance,
+  };
+
+  if (entity->ring_target != NULL && entity->time == entity->ring_at) {
+    struct test_entity *target = entity->ring_target;
+    uint64_t now = ftest_shed_get_time(ftest_shed_get_current_entity());
+
+    CHECK_EQ(ftest_shed_ring_doorbell(target->config.entry,
+                                      now + entity->ring_delay),
+             0);
+  }
+}
+
+/* As the entity library does, with the horizon re-read after every event */
+static uint64_t test_entity_exec_until(struct test_entity *entity,
+                                       const uint64_t *horizon) {
+  struct test_batch batch = {
+      .index = entity->config.instance,
+      .start_horizon = *horizon,
+  };
+
+  do {
+    test_entity_exec(entity);
+    batch.event_count++;
+  } while (entity->next < *horizon);
+
+  batch.end_horizon = *horizon;
+
+  CHECK(test_batch_count < TEST_BATCH_LOG_SIZE);
+  test_batch_log[test_batch_count++] = batch;
+
+  return batch.event_count;
+}
+
+static void test_entity_doorbell(struct test_entity *entity, uint64_t time) {
+  entity->doorbell_count++;
+  entity->doorbell_time = time;
+
+  if (time < entity->next) {
+    entity->next = time;
+  }
+}
+
+static void test_entity_find_next_event(void) {}
+
+/* The scheduler asks any entity for its timeline, not only the current one */
+#define TEST_ENTITY_FUNCS(i)                                                   \
+  static void test_entity_exec_##i(void) {                                     \
+    test_entity_exec(&test_entities[i]);                                       \
+  }                                                                            \
+  static uint64_t test_entity_next_##i(void) { return test_entities[i].next; } \
+  static uint64_t test_entity_time_##i(void) { return test_entities[i].time; } \
+  static void test_entity_doorbell_##i(uint64_t time) {                        \
+    test_entity_doorbell(&test_entities[i], time);                             \
+  }                                                                            \
+  static uint64_t test_entity_exec_until_##i(const uint64_t *horizon) {        \
+    return test_entity_exec_until(&test_entities[i], horizon);                 \
+  }
+
+TEST_ENTITY_FUNCS(0)
+TEST_ENTITY_FUNCS(1)
+TEST_ENTITY_FUNCS(2)
+TEST_ENTITY_FUNCS(3)
+
+#define TEST_ENTITY_CONFIG(i)                                                  \
+  {                                                                            \
+      .name = "test",                                                          \
+      .instance = i,                                                           \
+      .init_func = test_entity_init,                                           \
+      .exec_func = test_entity_exec_##i,                                       \
+      .find_next_event = test_entity_find_next_event,                          \
+      .get_next_event_time = test_entity_next_##i,                             \
+      .get_time = test_entity_time_##i,                                        \
+  }
+
+static const struct ftest_shed_entity_config test_entity_configs[] = {
+    TEST_ENTITY_CONFIG(0),
+    TEST_ENTITY_CONFIG(1),
+    TEST_ENTITY_CONFIG(2),
+    TEST_ENTITY_CONFIG(3),
+};
+
+static const ftest_shed_doorbell_func_t test_entity_doorbells[] = {
+    test_entity_doorbell_0,
+    test_entity_doorbell_1,
+    test_entity_doorbell_2,
+    test_entity_doorbell_3,
+};
+
+static uint64_t (*const test_entity_exec_untils[])(const uint64_t *) = {
+    test_entity_exec_until_0,
+    test_entity_exec_until_1,
+    test_entity_exec_until_2,
+    test_entity_exec_until_3,
+};
+
+/******************************************************************************
+ Runner
+ ******************************************************************************/
+
+void nsi_init(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+}
+
+void nsi_hws_one_event(void) { CHECK(false); }
+
+void nsi_hws_find_next_event(void) {}
+
+uint64_t nsi_hws_get_next_event_time(void) { return test_runner_next; }
+
+uint64_t nsi_hws_get_time(void) { return test_runner_time; }
+
+void ftest_jobs_fork(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+}
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+/**
+ * Register the runner, which has to come first, and the given number of test
+ * entities with the given periods.
+ */
+static void setup(unsigned count, const uint64_t *periods) {
+  CHECK_EQ(ftest_add_entity_to_schedule(&runner_entity), 0);
+
+  for (unsigned i = 0; i < count; i++) {
+    struct test_entity *entity = &test_entities[i];
+
+    entity->config = test_entity_configs[i];
+    entity->period = periods[i];
+    entity->next = periods[i];
+    CHECK_EQ(ftest_add_entity_to_schedule(&entity->config), 0);
+  }
+}
+
+/**
+ * Register the entities as setup() does, able to execute events in batches
+ * and with their doorbells set.
+ */
+static void setup_batched(unsigned count, const uint64_t *periods) {
+  setup(count, periods);
+
+  for (unsigned i = 0; i < count; i++) {
+    test_entities[i].config.exec_until_func = test_entity_exec_untils[i];
+    CHECK_EQ(ftest_shed_set_doorbell(test_entities[i].config.entry,
+                                     test_entity_doorbells[i]),
+             0);
+  }
+}
+
+static struct ftest_shed_entity_entry *next_entity(void) {
+  char *argv[] = {"test_sched", NULL};
+
+  return get_next_scheduled_entity_init_if_needed(1, argv);
+}
+
+static void step(void) { ftest_shed_dispatch(next_entity()); }
+
+/* Dispatch every event due up to the given time */
+static void run_until(uint64_t time) {
+  while (next_entity()->next_event_time <= time) {
+    step();
+  }
+}
+
+static void check_log(const struct test_dispatch *expected, size_t count) {
+  CHECK_EQ(test_log_count, count);
+
+  for (size_t i = 0; i < count; i++) {
+    CHECK_EQ(test_log[i].time, expected[i].time);
+    CHECK_EQ(test_log[i].index, expected[i].index);
+  }
+}
+
+/******************************************************************************
+ Dispatch order
+ ******************************************************************************/
+
+static void test_dispatch_order(void) {
+  static const uint64_t periods[] = {3, 2, 3};
+  static const struct test_dispatch expected[] = {
+      {2, 1}, {3, 0}, {3, 2}, {4, 1}, {6, 0}, {6, 1}, {6, 2},
+  };
+
+  /* More than the initial capacity, so the tables grow on the way */
+  setup(3, periods);
+
+  for (size_t i = 0; i < sizeof(expected) / sizeof(expected[0]); i++) {
+    step();
+  }
+
+  /* Ties go to the entity registered first */
+  check_log(expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+static void test_touched(void) {
+  static const uint64_t periods[] = {10, 20, 30};
+  static const struct test_dispatch expected[] = {
+      {10, 0}, {15, 2}, {20, 0}, {20, 1},
+  };
+
+  setup(3, periods);
+  step();
+
+  /* Woken up earlier from outside of its own execution */
+  test_entities[2].next = 15;
+  CHECK_EQ(ftest_shed_entity_touched(&test_entities[2].config), 0);
+  CHECK_EQ(ftest_shed_entity_touched(&test_entities[2].config), 0);
+  CHECK_EQ(ftest_shed_touched_count, 1);
+
+  /* Its heap key is refreshed before the next selection */
+  struct ftest_shed_entity_entry *entry = test_entities[2].config.entry;
+  ftest_shed_refresh_touched_entities();
+  CHECK_EQ(ftest_shed_touched_count, 0);
+  CHECK(!entry->touched);
+  CHECK(next_entity() == entry);
+
+  step();
+  step();
+  step();
+
+  check_log(expected, sizeof(expected) / sizeof(expected[0]));
+}
+
+static void test_remove_and_add(void) {
+  static const uint64_t periods[] = {3, 2, 3};
+  static const struct test_dispatch expected[] = {
+      {3, 0}, {3, 2}, {6, 0}, {6, 2}, {6, 1},
+  };
+
+  setup(3, periods);
+  next_entity();
+
+  CHECK_EQ(ftest_remove_entity_from_schedule(&test_entities[1].config), 0);
+  CHECK(test_entities[1].config.entry == NULL);
+  step();
+  step();
+
+  /* Back at its own time, now registered after the others. Its entry is the
+   * one it just freed. */
+  test_runner_time = 3;
+  test_entities[1].time = 0;
+  test_entities[1].next = 3;
+  CHECK_EQ(ftest_add_entity_to_schedule(&test_entities[1].config), 0);
+  step();
+  step();
+  step();
+
+  check_log(expected, sizeof(expected) / sizeof(expected[0]));
+  CHECK_EQ(ftest_shed_allocated_count, 4);
+}
+
+/******************************************************************************
+ Suspension
+ ******************************************************************************/
+
+static void test_suspend_resume(void) {
+  static const uint64_t periods[] = {10, 4};
+
+  setup(2, periods);
+  next_entity();
+  step();
+  step();
+  step();
+  CHECK_EQ(test_entities[0].time, 10);
+
+  test_runner_time = 10;
+  CHECK_EQ(ftest_shed_suspend_entity(&test_entities[0].config), 0);
+  CHECK_EQ(ftest_shed_suspend_entity(&test_entities[0].config), 0);
+  CHECK_EQ(ftest_shed_heap_size, 2);
+
+  /* The other entity keeps running, the suspended one is never dispatched */
+  for (unsigned i = 0; i < 10; i++) {
+    step();
+  }
+  CHECK_EQ(test_entities[1].time, 48);
+  CHECK_EQ(test_log[test_log_count - 1].index, 1);
+
+  /* Its clock stood still, so it picks up 40 later than it left off */
+  test_runner_time = 50;
+  CHECK_EQ(ftest_shed_resume_entity(&test_entities[0].config), 0);
+  CHECK_EQ(ftest_shed_resume_entity(&test_entities[0].config), 0);
+
+  struct ftest_shed_entity_entry *entry = test_entities[0].config.entry;
+  CHECK_EQ(ftest_shed_get_time(entry), 50);
+  CHECK_EQ(entry->next_event_time, 60);
+
+  /* And comes first at 60, being registered first */
+  step();
+  step();
+  step();
+  CHECK_EQ(test_log[test_log_count - 1].time, 60);
+  CHECK_EQ(test_log[test_log_count - 1].index, 0);
+  CHECK_EQ(test_entities[0].time, 20);
+}
+
+/******************************************************************************
+ Doorbells
+ ******************************************************************************/
+
+static void test_doorbell_wakes(void) {
+  static const uint64_t periods[] = {10, 100};
+
+  setup(2, periods);
+  next_entity();
+
+  struct ftest_shed_entity_entry *entry = test_entities[1].config.entry;
+
+  /* Without a doorbell there is nothing to ring */
+  CHECK_EQ(ftest_shed_ring_doorbell(entry, 5), 0);
+  CHECK_EQ(test_entities[1].doorbell_count, 0);
+
+  CHECK_EQ(ftest_shed_set_doorbell(entry, test_entity_doorbells[1]), 0);
+  CHECK_EQ(ftest_shed_ring_doorbell(entry, 5), 0);
+  CHECK_EQ(test_entities[1].doorbell_count, 1);
+  CHECK_EQ(test_entities[1].doorbell_time, 5);
+  CHECK(entry->touched);
+
+  /* Its heap key is refreshed before the next selection */
+  ftest_shed_refresh_touched_entities();
+  CHECK(!entry->touched);
+  CHECK(next_entity() == entry);
+  CHECK_EQ(entry->next_event_time, 5);
+}
+
+static void test_doorbell_while_suspended(void) {
+  static const uint64_t periods[] = {10, 4};
+
+  setup(2, periods);
+  next_entity();
+  step();
+  step();
+  step();
+
+  struct ftest_shed_entity_entry *entry = test_entities[0].config.entry;
+  CHECK_EQ(ftest_shed_set_doorbell(entry, test_entity_doorbells[0]), 0);
+
+  test_runner_time = 10;
+  CHECK_EQ(ftest_shed_suspend_entity(&test_entities[0].config), 0);
+
+  /* Held until it resumes, and only the earliest ring counts */
+  CHECK_EQ(ftest_shed_ring_doorbell(entry, 20), 0);
+  CHECK_EQ(ftest_shed_ring_doorbell(entry, 15), 0);
+  CHECK_EQ(ftest_shed_ring_doorbell(entry, 30), 0);
+  CHECK_EQ(test_entities[0].doorbell_count, 0);
+  CHECK(!entry->touched);
+
+  /* Rung in the past of the resumed timeline, it arrives at the time at which
+   * the clock of the entity stopped */
+  test_runner_time = 50;
+  CHECK_EQ(ftest_shed_resume_entity(&test_entities[0].config), 0);
+  CHECK_EQ(test_entities[0].doorbell_count, 1);
+  CHECK_EQ(test_entities[0].doorbell_time, 10);
+  CHECK_EQ(entry->next_event_time, 50);
+
+  CHECK_EQ(ftest_shed_resume_entity(&test_entities[0].config), 0);
+  CHECK_EQ(test_entities[0].doorbell_count, 1);
+}
+
+static void test_doorbell_after_resume_time(void) {
+  static const uint64_t periods[] = {10, 4};
+
+  setup(2, periods);
+  next_entity();
+
+  struct ftest_shed_entity_entry *entry = test_entities[0].config.entry;
+  CHECK_EQ(ftest_shed_set_doorbell(entry, test_entity_doorbells[0]), 0);
+  CHECK_EQ(ftest_shed_suspend_entity(&test_entities[0].config), 0);
+
+  /* Rung for a time the runner has not reached yet */
+  CHECK_EQ(ftest_shed_ring_doorbell(entry, 70), 0);
+
+  test_runner_time = 50;
+  CHECK_EQ(ftest_shed_resume_entity(&test_entities[0].config), 0);
+  CHECK_EQ(test_entities[0].doorbell_time, 20);
+}
+
+static void test_remove_touched(void) {
+  static const uint64_t periods[] = {10, 100, 20};
+
+  setup(3, periods);
+  next_entity();
+
+  struct ftest_shed_entity_entry *entry = test_entities[1].config.entry;
+  CHECK_EQ(ftest_shed_set_doorbell(entry, test_entity_doorbells[1]), 0);
+  CHECK_EQ(ftest_shed_entity_touched(&test_entities[2].config), 0);
+  CHECK_EQ(ftest_shed_ring_doorbell(entry, 5), 0);
+  CHECK_EQ(ftest_shed_touched_count, 2);
+
+  CHECK_EQ(ftest_remove_entity_from_schedule(&test_entities[1].config), 0);
+  CHECK_EQ(ftest_shed_touched_count, 1);
+  CHECK(touched[0] == test_entities[2].config.entry);
+  CHECK(!entry->touched);
+  CHECK(test_entities[1].config.entry == NULL);
+
+  /* A stale entry pointer rings nothing */
+  CHECK_EQ(ftest_shed_ring_doorbell(entry, 5), 0);
+  CHECK_EQ(test_entities[1].doorbell_count, 1);
+
+  step();
+  CHECK_EQ(test_log[0].index, 0);
+  CHECK_EQ(ftest_shed_heap_size, 3);
+}
+
+static void test_remove_detaches_network(void) {
+  static const uint64_t periods[] = {10, 100, 20};
+  static const uint8_t mac[FTEST_ETH_BUF_MAC_LEN] = {0x02, 0, 0, 0, 0, 1};
+  const struct ftest_sock_chan_addr addr = {.ip = 0x0a000001, .port = 7};
+
+  setup(2, periods);
+  next_entity();
+
+  struct ftest_shed_entity_entry *entry = test_entities[1].config.entry;
+  CHECK_EQ(ftest_shed_set_doorbell(entry, test_entity_doorbells[1]), 0);
+
+  int port = ftest_eth_buf_attach("test", mac, 4096, 0, entry);
+  CHECK(port >= 0);
+
+  struct ftest_sock_chan *chan =
+      ftest_sock_chan_open(FTEST_SOCK_CHAN_DGRAM, addr.ip, entry);
+  struct ftest_sock_chan *sender = ftest_sock_chan_open(
+      FTEST_SOCK_CHAN_DGRAM, addr.ip, test_entities[0].config.entry);
+  CHECK_EQ(ftest_sock_chan_bind(chan, &addr), FTEST_SOCK_CHAN_OK);
+
+  CHECK_EQ(ftest_eth_buf_notify(port, 5), 0);
+  CHECK_EQ(ftest_sock_chan_send(sender, "x", 1, &addr), 1);
+  CHECK_EQ(test_entities[1].doorbell_count, 2);
+
+  /* The entry goes to the next entity added, which the port and the channel
+   * of the removed one must not wake up */
+  CHECK_EQ(ftest_remove_entity_from_schedule(&test_entities[1].config), 0);
+  test_entities[2].config = test_entity_configs[2];
+  test_entities[2].next = periods[2];
+  CHECK_EQ(ftest_add_entity_to_schedule(&test_entities[2].config), 0);
+  CHECK(test_entities[2].config.entry == entry);
+  CHECK_EQ(ftest_shed_set_doorbell(entry, test_entity_doorbells[2]), 0);
+
+  CHECK_EQ(ftest_eth_buf_notify(port, 5), 0);
+  CHECK_EQ(ftest_sock_chan_send(sender, "x", 1, &addr), 1);
+  CHECK_EQ(test_entities[2].doorbell_count, 0);
+  CHECK_EQ(test_entities[1].doorbell_count, 2);
+}
+
+/******************************************************************************
+ Batches
+ ******************************************************************************/
+
+static void test_batch_order(void) {
+  static const uint64_t periods[] = {3, 2, 3};
+  static const struct test_dispatch expected[] = {
+      {2, 1}, {3, 0}, {3, 2}, {4, 1}, {6, 0}, {6, 1}, {6, 2},
+  };
+
+  setup_batched(3, periods);
+  run_until(6);
+
+  check_log(expected, sizeof(expected) / sizeof(expected[0]));
+
+#if CONFIG_FTEST_SHED_BATCH
+  /* Entity 1 stops short of the event of entity 0 at 3, which was registered
+   * earlier, while entity 0 may run its events at 3 before the one of entity
+   * 2, registered later */
+  CHECK_EQ(test_batch_log[0].index, 1);
+  CHECK_EQ(test_batch_log[0].start_horizon, 3);
+  CHECK_EQ(test_batch_log[1].index, 0);
+  CHECK_EQ(test_batch_log[1].start_horizon, 4);
+#endif
+}
+
+static void test_batch_horizon(void) {
+  static const uint64_t periods[] = {1, 10};
+  static const struct test_dispatch expected[] = {
+      {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 0}, {6, 0}, {7, 0}, {7, 2},
+  };
+
+  setup_batched(2, periods);
+  next_entity();
+
+  /* Started later, so its local time is 3 behind */
+  struct test_entity *late = &test_entities[2];
+  late->config = test_entity_configs[2];
+  late->config.exec_until_func = test_entity_exec_untils[2];
+  late->period = 4;
+  late->next = 4;
+  test_runner_time = 3;
+  CHECK_EQ(ftest_add_entity_to_schedule(&late->config), 0);
+
+  run_until(7);
+  check_log(expected, sizeof(expected) / sizeof(expected[0]));
+
+#if CONFIG_FTEST_SHED_BATCH
+  /* Up to the next event of entity 2 at 7, the earliest of any other
+   * entity, which comes after the ones of entity 0 at the same time */
+  CHECK_EQ(test_batch_count, 2);
+  CHECK_EQ(test_batch_log[0].index, 0);
+  CHECK_EQ(test_batch_log[0].start_horizon, 8);
+  CHECK_EQ(test_batch_log[0].event_count, 7);
+
+  /* Then up to entity 0 at 8, which is 5 in the local time of entity 2 */
+  CHECK_EQ(test_batch_log[1].index, 2);
+  CHECK_EQ(test_batch_log[1].start_horizon, 5);
+  CHECK_EQ(test_batch_log[1].event_count, 1);
+#endif
+}
+
+static void test_batch_doorbell(void) {
+  static const uint64_t periods[] = {1, 100};
+  static const struct test_dispatch expected[] = {
+      {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 0}, {5, 1}, {6, 0},
+  };
+
+  /* The runner ends the batches at 7 */
+  test_runner_next = 7;
+  setup_batched(2, periods);
+  test_entities[0].ring_target = &test_entities[1];
+  test_entities[0].ring_at = 3;
+  test_entities[0].ring_delay = 2;
+
+  run_until(6);
+  check_log(expected, sizeof(expected) / sizeof(expected[0]));
+  CHECK_EQ(test_entities[1].doorbell_time, 5);
+
+#if CONFIG_FTEST_SHED_BATCH
+  /* Cut short by the doorbell, up to and including the time of the woken
+   * entity, which was registered later */
+  CHECK_EQ(test_batch_log[0].index, 0);
+  CHECK_EQ(test_batch_log[0].start_horizon, 7);
+  CHECK_EQ(test_batch_log[0].end_horizon, 6);
+  CHECK_EQ(test_batch_log[0].event_count, 5);
+#endif
+}
+
+static void test_batch_doorbell_tie(void) {
+  static const uint64_t periods[] = {100, 1};
+  static const struct test_dispatch expected[] = {
+      {1, 1}, {2, 1}, {3, 1}, {4, 1}, {5, 0}, {5, 1}, {6, 1},
+  };
+
+  test_runner_next = 7;
+  setup_batched(2, periods);
+  test_entities[1].ring_target = &test_entities[0];
+  test_entities[1].ring_at = 3;
+  test_entities[1].ring_delay = 2;
+
+  run_until(6);
+  check_log(expected, sizeof(expected) / sizeof(expected[0]));
+
+#if CONFIG_FTEST_SHED_BATCH
+  /* The woken entity was registered earlier, so it goes first at 5 */
+  CHECK_EQ(test_batch_log[0].index, 1);
+  CHECK_EQ(test_batch_log[0].start_horizon, 7);
+  CHECK_EQ(test_batch_log[0].end_horizon, 5);
+  CHECK_EQ(test_batch_log[0].event_count, 4);
+#endif
+}
+
+/******************************************************************************
+ Errors
+ ******************************************************************************/
+
+static void test_errors(void) {
+  static const uint64_t periods[] = {10};
+  struct ftest_shed_entity_config invalid = test_entity_configs[0];
+
+  invalid.get_time = NULL;
+  CHECK_EQ(ftest_add_entity_to_schedule(&invalid), -EINVAL);
+  CHECK_EQ(ftest_add_entity_to_schedule(NULL), -EINVAL);
+
+  setup(1, periods);
+  CHECK_EQ(ftest_add_entity_to_schedule(&test_entities[0].config), -EEXIST);
+
+  /* Not initialized yet */
+  CHECK_EQ(ftest_shed_suspend_entity(&test_entities[0].config), -EAGAIN);
+
+  next_entity();
+  CHECK_EQ(ftest_remove_entity_from_schedule(&runner_entity), -EPERM);
+  CHECK_EQ(ftest_shed_suspend_entity(&runner_entity), -EPERM);
+
+  struct ftest_shed_entity_config *missing = &test_entities[1].config;
+  *missing = test_entity_configs[1];
+  CHECK_EQ(ftest_remove_entity_from_schedule(missing), -ENOENT);
+  CHECK_EQ(ftest_shed_suspend_entity(missing), -ENOENT);
+  CHECK_EQ(ftest_shed_resume_entity(missing), -ENOENT);
+  CHECK_EQ(ftest_shed_entity_touched(missing), -ENOENT);
+
+  CHECK_EQ(ftest_shed_set_doorbell(NULL, test_entity_doorbells[0]), -EINVAL);
+  CHECK_EQ(ftest_shed_ring_doorbell(NULL, 0), -EINVAL);
+  CHECK_EQ(ftest_shed_defer(NULL, NULL, NULL, 0), -EINVAL);
+}
+
+/******************************************************************************
+ Test cases
+ ******************************************************************************/
+
+static void run_in_child(const struct test_case *test_case) {
+  pid_t pid = fork();
+
+  CHECK(pid >= 0);
+
+  if (pid == 0) {
+    test_run(test_case, 1);
+    exit(0);
+  }
+
+  int status;
+
+  CHECK(waitpid(pid, &status, 0) == pid);
+  CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main(void) {
+  static const struct test_case cases[] = {
+      TEST_CASE(test_dispatch_order),
+      TEST_CASE(test_touched),
+      TEST_CASE(test_remove_and_add),
+      TEST_CASE(test_suspend_resume),
+      TEST_CASE(test_doorbell_wakes),
+      TEST_CASE(test_doorbell_while_suspended),
+      TEST_CASE(test_doorbell_after_resume_time),
+      TEST_CASE(test_remove_touched),
+      TEST_CASE(test_remove_detaches_network),
+      TEST_CASE(test_batch_order),
+      TEST_CASE(test_batch_horizon),
+      TEST_CASE(test_batch_doorbell),
+      TEST_CASE(test_batch_doorbell_tie),
+      TEST_CASE(test_errors),
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    run_in_child(&cases[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,302 @@
+/*
+ * Stream and datagram channels between the sockets of entities, and the
+ * doorbells they ring. Built with a receive buffer of TEST_RCVBUF bytes.
+ */
+
+#include "ftest_sock_chan.h"
+#include "test.h"
+#include <string.h>
+
+/******************************************************************************
+ Definitions
+ ******************************************************************************/
+
+#define TEST_IP_A 0x0a000001
+#define TEST_IP_B 0x0a000002
+#define TEST_PORT 5000
+
+/******************************************************************************
+ Structures
+ ******************************************************************************/
+
+/* Opaque to the channels, which only hand it back to the scheduler */
+struct ftest_shed_entity_entry {
+  uint64_t time;
+  unsigned doorbell_count;
+  uint64_t doorbell_time;
+};
+
+/******************************************************************************
+ Data
+ ******************************************************************************/
+
+static struct ftest_shed_entity_entry entity_a;
+static struct ftest_shed_entity_entry entity_b;
+
+/******************************************************************************
+ Scheduler
+ ******************************************************************************/
+
+int ftest_shed_ring_doorbell(struct ftest_shed_entity_entry *entity,
+                             uint64_t time) {
+  entity->doorbell_count++;
+  entity->doorbell_time = time;
+
+  return 0;
+}
+
+uint64_t ftest_shed_get_time(const struct ftest_shed_entity_entry *entity) {
+  return entity->time;
+}
+
+/******************************************************************************
+ Utils
+ ******************************************************************************/
+
+/**
+ * Connect a stream endpoint of entity A to a listening one of entity B.
+ */
+static void connect_stream(struct ftest_sock_chan **listener,
+                           struct ftest_sock_chan **client,
+                           struct ftest_sock_chan **server) {
+  const struct ftest_sock_chan_addr addr = {TEST_IP_B, TEST_PORT};
+  struct ftest_sock_chan_addr peer;
+
+  *listener = ftest_sock_chan_open(FTEST_SOCK_CHAN_STREAM, TEST_IP_B,
+                                   &entity_b);
+  *client = ftest_sock_chan_open(FTEST_SOCK_CHAN_STREAM, TEST_IP_A, &entity_a);
+  CHECK(*listener != NULL && *client != NULL);
+
+  CHECK_EQ(ftest_sock_chan_bind(*listener, &addr), FTEST_SOCK_CHAN_OK);
+  CHECK_EQ(ftest_sock_chan_listen(*listener, 1), FTEST_SOCK_CHAN_OK);
+  CHECK_EQ(ftest_sock_chan_accept(*listener, server, &peer),
+           FTEST_SOCK_CHAN_AGAIN);
+
+  entity_b.doorbell_count = 0;
+  CHECK_EQ(ftest_sock_chan_connect(*client, &addr), FTEST_SOCK_CHAN_OK);
+  CHECK_EQ(entity_b.doorbell_count, 1);
+  CHECK(ftest_sock_chan_is_readable(*listener));
+
+  CHECK_EQ(ftest_sock_chan_accept(*listener, server, &peer),
+           FTEST_SOCK_CHAN_OK);
+  CHECK_EQ(peer.ip, TEST_IP_A);
+  CHECK(peer.port >= 49152);
+}
+
+/******************************************************************************
+ Streams
+ ******************************************************************************/
+
+static void test_stream_send_recv(void) {
+  struct ftest_sock_chan *listener, *client, *server;
+  char buf[16];
+
+  connect_stream(&listener, &client, &server);
+
+  entity_a.time = 42;
+  entity_b.doorbell_count = 0;
+  CHECK_EQ(ftest_sock_chan_send(client, "hello", 5, NULL), 5);
+  CHECK_EQ(ftest_sock_chan_send(client, "world", 5, NULL), 5);
+  CHECK_EQ(entity_b.doorbell_count, 2);
+  CHECK_EQ(entity_b.doorbell_time, 42);
+
+  /* Received across the chunks it was sent in */
+  CHECK_EQ(ftest_sock_chan_recv(server, buf, 3, NULL, true), 3);
+  CHECK_EQ(ftest_sock_chan_recv(server, buf, 7, NULL, false), 7);
+  CHECK(memcmp(buf, "hellowo", 7) == 0);
+  CHECK_EQ(ftest_sock_chan_recv(server, buf, sizeof(buf), NULL, false), 3);
+  CHECK(memcmp(buf, "rld", 3) == 0);
+  CHECK_EQ(ftest_sock_chan_recv(server, buf, sizeof(buf), NULL, false),
+           FTEST_SOCK_CHAN_AGAIN);
+
+  ftest_sock_chan_close(server);
+  ftest_sock_chan_close(client);
+  ftest_sock_chan_close(listener);
+}
+
+static void test_stream_empty_send(void) {
+  struct ftest_sock_chan *listener, *client, *server;
+  char buf[16];
+
+  connect_stream(&listener, &client, &server);
+
+  /* Nothing is queued, so the peer does not read the end of the stream */
+  entity_b.doorbell_count = 0;
+  CHECK_EQ(ftest_sock_chan_send(client, NULL, 0, NULL), 0);
+  CHECK_EQ(entity_b.doorbell_count, 0);
+  CHECK(!ftest_sock_chan_is_readable(server));
+  CHECK_EQ(ftest_sock_chan_recv(server, buf, sizeof(buf), NULL, false),
+           FTEST_SOCK_CHAN_AGAIN);
+
+  CHECK_EQ(ftest_sock_chan_send(client, "x", 1, NULL), 1);
+  CHECK_EQ(ftest_sock_chan_recv(server, buf, sizeof(buf), NULL, false), 1);
+
+  ftest_sock_chan_close(server);
+  ftest_sock_chan_close(client);
+  ftest_sock_chan_close(listener);
+}
+
+static void test_stream_close(void) {
+  struct ftest_sock_chan *listener, *client, *server;
+  char buf[16];
+
+  connect_stream(&listener, &client, &server);
+
+  CHECK_EQ(ftest_sock_chan_send(client, "bye", 3, NULL), 3);
+
+  entity_b.doorbell_count = 0;
+  ftest_sock_chan_close(client);
+  CHECK_EQ(entity_b.doorbell_count, 1);
+
+  /* What was sent before the close is received first */
+  CHECK_EQ(ftest_sock_chan_recv(server, buf, sizeof(buf), NULL, false), 3);
+  CHECK(ftest_sock_chan_is_readable(server));
+  CHECK_EQ(ftest_sock_chan_recv(server, buf, sizeof(buf), NULL, false), 0);
+
+  CHECK(ftest_sock_chan_is_writable(server));
+  CHECK_EQ(ftest_sock_chan_send(server, "x", 1, NULL), FTEST_SOCK_CHAN_PIPE);
+
+  ftest_sock_chan_close(server);
+  ftest_sock_chan_close(listener);
+}
+
+static void test_stream_rcvbuf(void) {
+  struct ftest_sock_chan *listener, *client, *server;
+  char data[TEST_RCVBUF + 4];
+  char buf[TEST_RCVBUF + 4];
+
+  connect_stream(&listener, &client, &server);
+  memset(data, 'd', sizeof(data));
+
+  /* Takes what fits, then nothing until the peer reads */
+  CHECK_EQ(ftest_sock_chan_send(client, data, sizeof(data), NULL),
+           TEST_RCVBUF);
+  CHECK(!ftest_sock_chan_is_writable(client));
+  CHECK_EQ(ftest_sock_chan_send(client, data, 1, NULL),
+           FTEST_SOCK_CHAN_AGAIN);
+
+  entity_a.doorbell_count = 0;
+  CHECK_EQ(ftest_sock_chan_recv(server, buf, 4, NULL, false), 4);
+  CHECK_EQ(entity_a.doorbell_count, 1);
+  CHECK(ftest_sock_chan_is_writable(client));
+  CHECK_EQ(ftest_sock_chan_send(client, data, sizeof(data), NULL), 4);
+
+  ftest_sock_chan_close(server);
+  ftest_sock_chan_close(client);
+  ftest_sock_chan_close(listener);
+}
+
+static void test_stream_refused(void) {
+  const struct ftest_sock_chan_addr addr = {TEST_IP_B, TEST_PORT};
+  struct ftest_sock_chan *client =
+      ftest_sock_chan_open(FTEST_SOCK_CHAN_STREAM, TEST_IP_A, &entity_a);
+  char buf[4];
+
+  /* Ready, as both fail right away rather than waiting */
+  CHECK(ftest_sock_chan_is_readable(client));
+  CHECK(ftest_sock_chan_is_writable(client));
+  CHECK_EQ(ftest_sock_chan_send(client, "x", 1, NULL),
+           FTEST_SOCK_CHAN_NOTCONN);
+  CHECK_EQ(ftest_sock_chan_recv(client, buf, sizeof(buf), NULL, false),
+           FTEST_SOCK_CHAN_NOTCONN);
+  CHECK_EQ(ftest_sock_chan_connect(client, &addr),
+           FTEST_SOCK_CHAN_CONNREFUSED);
+
+  /* A full backlog refuses the connection as well */
+  struct ftest_sock_chan *listener, *other, *server;
+  connect_stream(&listener, &other, &server);
+
+  struct ftest_sock_chan *second =
+      ftest_sock_chan_open(FTEST_SOCK_CHAN_STREAM, TEST_IP_A, &entity_a);
+  CHECK_EQ(ftest_sock_chan_connect(second, &addr), FTEST_SOCK_CHAN_OK);
+  CHECK_EQ(ftest_sock_chan_connect(second, &addr), FTEST_SOCK_CHAN_ISCONN);
+  CHECK_EQ(ftest_sock_chan_connect(client, &addr),
+           FTEST_SOCK_CHAN_CONNREFUSED);
+
+  /* Only readable when there is a connection to accept */
+  CHECK(ftest_sock_chan_is_readable(listener));
+  CHECK(ftest_sock_chan_is_writable(listener));
+  CHECK_EQ(ftest_sock_chan_recv(listener, buf, sizeof(buf), NULL, false),
+           FTEST_SOCK_CHAN_INVAL);
+
+  /* Closing the listener closes the connection not accepted yet */
+  ftest_sock_chan_close(listener);
+  CHECK_EQ(ftest_sock_chan_recv(second, buf, sizeof(buf), NULL, false), 0);
+
+  ftest_sock_chan_close(second);
+  ftest_sock_chan_close(server);
+  ftest_sock_chan_close(other);
+  ftest_sock_chan_close(client);
+}
+
+/******************************************************************************
+ Datagrams
+ ******************************************************************************/
+
+static void test_dgram(void) {
+  const struct ftest_sock_chan_addr addr_b = {TEST_IP_B, TEST_PORT};
+  struct ftest_sock_chan_addr src;
+  char buf[TEST_RCVBUF];
+
+  struct ftest_sock_chan *a =
+      ftest_sock_chan_open(FTEST_SOCK_CHAN_DGRAM, TEST_IP_A, &entity_a);
+  struct ftest_sock_chan *b =
+      ftest_sock_chan_open(FTEST_SOCK_CHAN_DGRAM, TEST_IP_B, &entity_b);
+  CHECK_EQ(ftest_sock_chan_bind(b, &addr_b), FTEST_SOCK_CHAN_OK);
+
+  struct ftest_sock_chan *taken =
+      ftest_sock_chan_open(FTEST_SOCK_CHAN_DGRAM, TEST_IP_B, &entity_b);
+  CHECK_EQ(ftest_sock_chan_bind(taken, &addr_b), FTEST_SOCK_CHAN_ADDRINUSE);
+  ftest_sock_chan_close(taken);
+
+  /* Sent from an ephemeral port, one datagram per receive */
+  CHECK_EQ(ftest_sock_chan_send(a, "one", 3, NULL), FTEST_SOCK_CHAN_NOTCONN);
+  CHECK_EQ(ftest_sock_chan_send(a, "one", 3, &addr_b), 3);
+  CHECK_EQ(ftest_sock_chan_send(a, "", 0, &addr_b), 0);
+  CHECK_EQ(ftest_sock_chan_recv(b, buf, sizeof(buf), &src, false), 3);
+  CHECK_EQ(src.ip, TEST_IP_A);
+  CHECK(src.port >= 49152);
+
+  /* An empty datagram is one all the same */
+  CHECK(ftest_sock_chan_is_readable(b));
+  CHECK_EQ(ftest_sock_chan_recv(b, buf, sizeof(buf), NULL, false), 0);
+  CHECK_EQ(ftest_sock_chan_recv(b, buf, sizeof(buf), NULL, false),
+           FTEST_SOCK_CHAN_AGAIN);
+
+  /* Truncated to the buffer, and the rest is gone */
+  CHECK_EQ(ftest_sock_chan_send(a, "truncated", 9, &addr_b), 9);
+  CHECK_EQ(ftest_sock_chan_recv(b, buf, 5, NULL, false), 5);
+  CHECK_EQ(ftest_sock_chan_recv(b, buf, sizeof(buf), NULL, false),
+           FTEST_SOCK_CHAN_AGAIN);
+
+  /* Lost when they do not fit, as on a network */
+  memset(buf, 'd', sizeof(buf));
+  CHECK_EQ(ftest_sock_chan_connect(a, &addr_b), FTEST_SOCK_CHAN_OK);
+  CHECK_EQ(ftest_sock_chan_send(a, buf, TEST_RCVBUF - 2, NULL),
+           TEST_RCVBUF - 2);
+  CHECK_EQ(ftest_sock_chan_send(a, buf, 4, NULL), 4);
+  CHECK_EQ(ftest_sock_chan_recv(b, buf, sizeof(buf), NULL, false),
+           TEST_RCVBUF - 2);
+  CHECK_EQ(ftest_sock_chan_recv(b, buf, sizeof(buf), NULL, false),
+           FTEST_SOCK_CHAN_AGAIN);
+
+  ftest_sock_chan_close(a);
+  ftest_sock_chan_close(b);
+}
+
+/******************************************************************************
+ Test cases
+ ******************************************************************************/
+
+int main(void) {
+  static const struct test_case cases[] = {
+      TEST_CASE(test_stream_send_recv),
+      TEST_CASE(test_stream_empty_send),
+      TEST_CASE(test_stream_close),
+      TEST_CASE(test_stream_rcvbuf),
+      TEST_CASE(test_stream_refused),
+      TEST_CASE(test_dgram),
+  };
+
+  return test_run(cases, sizeof(cases) / sizeof(cases[0]));
+}